@@ -0,0 +1,280 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "functions.hpp"
+#include "stats.hpp"
+#include "symbols.hpp"
+
+enum ASTNodeType
+{
+    Undefined,
+    OperatorPlus,
+    OperatorMinus,
+    OperatorMul,
+    OperatorDiv,
+    UnaryMinus,
+    NumberValue,
+    VariableValue,
+    OperatorPow,
+    OperatorMod,
+    OperatorLess,
+    OperatorLessEqual,
+    OperatorGreater,
+    OperatorGreaterEqual,
+    OperatorEqual,
+    OperatorNotEqual,
+    FunctionCall
+};
+
+inline bool IsBinaryOperator(ASTNodeType type)
+{
+    return (type >= OperatorPlus && type <= OperatorDiv) || (type >= OperatorPow && type <= OperatorNotEqual);
+}
+
+//二元运算的语义,各种运算方式共用;比较运算的结果为 1 或 0
+inline double ApplyBinaryOperator(ASTNodeType type, double left, double right)
+{
+    switch (type)
+    {
+    case OperatorPlus:
+        return left + right;
+    case OperatorMinus:
+        return left - right;
+    case OperatorMul:
+        return left * right;
+    case OperatorDiv:
+        return left / right;
+    case OperatorPow:
+        return std::pow(left, right);
+    case OperatorMod:
+        return std::fmod(left, right);
+    case OperatorLess:
+        return left < right ? 1.0 : 0.0;
+    case OperatorLessEqual:
+        return left <= right ? 1.0 : 0.0;
+    case OperatorGreater:
+        return left > right ? 1.0 : 0.0;
+    case OperatorGreaterEqual:
+        return left >= right ? 1.0 : 0.0;
+    case OperatorEqual:
+        return left == right ? 1.0 : 0.0;
+    case OperatorNotEqual:
+        return left != right ? 1.0 : 0.0;
+    default:
+        return 0.0;
+    }
+}
+
+//节点索引,子节点通过索引引用
+using NodeIndex = std::uint32_t;
+constexpr NodeIndex InvalidNode = 0xFFFFFFFFu;
+
+//FunctionCall 的 Left 为第一个参数,双参数函数的 Right 为第二个参数,单参数函数的 Right 为 InvalidNode
+struct ASTNode
+{
+    ASTNodeType Type = Undefined;
+    NodeIndex Left = InvalidNode;
+    NodeIndex Right = InvalidNode;
+    std::uint32_t Slot = 0; //VariableValue 的变量槽位,FunctionCall 在 FunctionRegistry 中的编号
+    double Value = 0;
+};
+
+//只有 Left 一个子节点的节点:一元负号与单参数函数
+inline bool IsUnaryNode(const ASTNode &node)
+{
+    return node.Type == UnaryMinus || (node.Type == FunctionCall && node.Right == InvalidNode);
+}
+
+//函数编号已注册且参数个数与函数一致
+inline bool IsValidFunctionCall(const ASTNode &node)
+{
+    return node.Type == FunctionCall && node.Slot < Functions().Size() &&
+           (Functions()[node.Slot].Arity == 1) == (node.Right == InvalidNode);
+}
+
+//除叶子节点外合法的节点类型;FunctionCall 还要检查编号与参数个数
+inline bool IsInnerNode(const ASTNode &node)
+{
+    return node.Type == UnaryMinus || IsBinaryOperator(node.Type) || IsValidFunctionCall(node);
+}
+
+//一元负号与单参数函数的运算
+inline double ApplyUnaryNode(const ASTNode &node, double value)
+{
+    return node.Type == UnaryMinus ? -value : Functions()[node.Slot].Unary(value);
+}
+
+//二元运算与双参数函数的运算
+inline double ApplyBinaryNode(const ASTNode &node, double left, double right)
+{
+    return node.Type == FunctionCall ? Functions()[node.Slot].Binary(left, right) : ApplyBinaryOperator(node.Type, left, right);
+}
+
+//节点存储在一块连续内存中,整棵树随 Reset 一次性释放,已分配的内存留给下次解析复用
+class ASTArena
+{
+    std::vector<ASTNode> m_Nodes;
+
+public:
+    NodeIndex Create(ASTNodeType type, NodeIndex left, NodeIndex right, double value = 0, std::uint32_t slot = 0)
+    {
+        if (m_Nodes.size() >= InvalidNode)
+            throw std::length_error("Too many nodes in syntax tree!");
+
+        ASTNode node;
+        node.Type = type;
+        node.Left = left;
+        node.Right = right;
+        node.Slot = slot;
+        node.Value = value;
+        EXPRESSION_STATS_ADD(Nodes, 1);
+#if EXPRESSION_STATS
+        std::size_t capacity = m_Nodes.capacity();
+        m_Nodes.push_back(node);
+        if (m_Nodes.capacity() != capacity)
+        {
+            EXPRESSION_STATS_ADD(ArenaGrowths, 1);
+            EXPRESSION_STATS_ADD(ArenaBytes, m_Nodes.capacity() * sizeof(ASTNode));
+        }
+#else
+        m_Nodes.push_back(node);
+#endif
+        return static_cast<NodeIndex>(m_Nodes.size() - 1);
+    }
+
+    bool Contains(NodeIndex index) const noexcept
+    {
+        return index < m_Nodes.size();
+    }
+
+    const ASTNode &operator[](NodeIndex index) const
+    {
+        return m_Nodes[index];
+    }
+
+    ASTNode &operator[](NodeIndex index)
+    {
+        return m_Nodes[index];
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Nodes.size();
+    }
+
+    std::size_t Capacity() const noexcept
+    {
+        return m_Nodes.capacity();
+    }
+
+    //追加 count 个默认构造的节点,返回第一个的索引;用于由多个线程分别填入互不重叠的节点
+    NodeIndex Extend(std::size_t count)
+    {
+        if (count >= InvalidNode - m_Nodes.size())
+            throw std::length_error("Too many nodes in syntax tree!");
+        NodeIndex first = static_cast<NodeIndex>(m_Nodes.size());
+        m_Nodes.resize(m_Nodes.size() + count);
+        EXPRESSION_STATS_ADD(Nodes, count);
+        return first;
+    }
+
+    void Reserve(std::size_t count)
+    {
+        if (count > m_Nodes.capacity())
+        {
+            EXPRESSION_STATS_ADD(ArenaGrowths, 1);
+            EXPRESSION_STATS_ADD(ArenaBytes, count * sizeof(ASTNode));
+        }
+        m_Nodes.reserve(count);
+    }
+
+    void Reset() noexcept
+    {
+        m_Nodes.clear();
+    }
+};
+
+//变量名按首次出现的顺序分配槽位,运算时以槽位为下标从变量数组(或列数组)中取值;
+//名称只在解析时查找一次,之后更换变量值只需写入数组
+class VariableTable
+{
+    SymbolTable m_Symbols;
+
+public:
+    static constexpr std::uint32_t NoSlot = SymbolTable::NoSymbol;
+
+    std::uint32_t Resolve(std::string_view name)
+    {
+        return m_Symbols.Intern(name);
+    }
+
+    //不存在时返回 NoSlot
+    std::uint32_t Find(std::string_view name) const
+    {
+        return m_Symbols.Find(name);
+    }
+
+    const std::string &Name(std::uint32_t slot) const
+    {
+        return m_Symbols.Name(slot);
+    }
+
+    const std::vector<std::string> &Names() const noexcept
+    {
+        return m_Symbols.Names();
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Symbols.Size();
+    }
+
+    void Reset() noexcept
+    {
+        m_Symbols.Reset();
+    }
+};
+
+//将 from 中以 root 为根的子树按后序追加到 to 中,返回新的根节点;from 中不可达的节点不会被复制
+inline NodeIndex CopySubtree(const ASTArena &from, NodeIndex root, ASTArena &to)
+{
+    if (!from.Contains(root))
+        return InvalidNode;
+
+    std::vector<NodeIndex> mapping(from.Size(), InvalidNode);
+    std::vector<NodeIndex> pending{root};
+    while (!pending.empty())
+    {
+        NodeIndex index = pending.back();
+        const ASTNode &node = from[index];
+        if (mapping[index] != InvalidNode)
+        {
+            pending.pop_back();
+            continue;
+        }
+        bool ready = true;
+        for (NodeIndex child : {node.Left, node.Right})
+        {
+            if (from.Contains(child) && mapping[child] == InvalidNode)
+            {
+                pending.push_back(child);
+                ready = false;
+            }
+        }
+        if (!ready)
+            continue;
+
+        pending.pop_back();
+        NodeIndex left = from.Contains(node.Left) ? mapping[node.Left] : InvalidNode;
+        NodeIndex right = from.Contains(node.Right) ? mapping[node.Right] : InvalidNode;
+        mapping[index] = to.Create(node.Type, left, right, node.Value, node.Slot);
+    }
+    return mapping[root];
+}
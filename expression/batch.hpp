@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "cpufeatures.hpp"
+
+enum BatchIsa
+{
+    BatchIsaAuto,
+    BatchIsaScalar,
+    BatchIsaSSE2,
+    BatchIsaAVX2
+};
+
+//按列批量运算时使用的计算核,dst 可以与输入重叠
+struct BatchKernels
+{
+    BatchIsa Isa;
+    const char *Name;
+    void (*Binary)(OpCode op, double *dst, const double *lhs, const double *rhs, std::size_t n);
+    void (*Negate)(double *dst, const double *src, std::size_t n);
+};
+
+inline void ScalarBinaryKernel(OpCode op, double *dst, const double *lhs, const double *rhs, std::size_t n)
+{
+    switch (op)
+    {
+    case OpAdd:
+        for (std::size_t i = 0; i < n; i++)
+            dst[i] = lhs[i] + rhs[i];
+        break;
+    case OpSub:
+        for (std::size_t i = 0; i < n; i++)
+            dst[i] = lhs[i] - rhs[i];
+        break;
+    case OpMul:
+        for (std::size_t i = 0; i < n; i++)
+            dst[i] = lhs[i] * rhs[i];
+        break;
+    case OpDiv:
+        for (std::size_t i = 0; i < n; i++)
+            dst[i] = lhs[i] / rhs[i];
+        break;
+    default:
+    {
+        //其它运算没有向量化版本,SSE2/AVX2 计算核也会落到这里
+        ASTNodeType type = ExtendedOperatorNode(op);
+        for (std::size_t i = 0; i < n; i++)
+            dst[i] = ApplyBinaryOperator(type, lhs[i], rhs[i]);
+        break;
+    }
+    }
+}
+
+inline void ScalarNegateKernel(double *dst, const double *src, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++)
+        dst[i] = -src[i];
+}
+
+#if EXPRESSION_SSE2
+inline void Sse2BinaryKernel(OpCode op, double *dst, const double *lhs, const double *rhs, std::size_t n)
+{
+    std::size_t i = 0;
+    switch (op)
+    {
+    case OpAdd:
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(lhs + i), _mm_loadu_pd(rhs + i)));
+        break;
+    case OpSub:
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(dst + i, _mm_sub_pd(_mm_loadu_pd(lhs + i), _mm_loadu_pd(rhs + i)));
+        break;
+    case OpMul:
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(lhs + i), _mm_loadu_pd(rhs + i)));
+        break;
+    case OpDiv:
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(dst + i, _mm_div_pd(_mm_loadu_pd(lhs + i), _mm_loadu_pd(rhs + i)));
+        break;
+    default:
+        break;
+    }
+    ScalarBinaryKernel(op, dst + i, lhs + i, rhs + i, n - i);
+}
+
+inline void Sse2NegateKernel(double *dst, const double *src, std::size_t n)
+{
+    const __m128d sign = _mm_set1_pd(-0.0);
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(dst + i, _mm_xor_pd(_mm_loadu_pd(src + i), sign));
+    ScalarNegateKernel(dst + i, src + i, n - i);
+}
+#endif
+
+#if EXPRESSION_AVX2
+EXPRESSION_TARGET_AVX2 inline void Avx2BinaryKernel(OpCode op, double *dst, const double *lhs, const double *rhs, std::size_t n)
+{
+    std::size_t i = 0;
+    switch (op)
+    {
+    case OpAdd:
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(lhs + i), _mm256_loadu_pd(rhs + i)));
+        break;
+    case OpSub:
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(dst + i, _mm256_sub_pd(_mm256_loadu_pd(lhs + i), _mm256_loadu_pd(rhs + i)));
+        break;
+    case OpMul:
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(lhs + i), _mm256_loadu_pd(rhs + i)));
+        break;
+    case OpDiv:
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(dst + i, _mm256_div_pd(_mm256_loadu_pd(lhs + i), _mm256_loadu_pd(rhs + i)));
+        break;
+    default:
+        break;
+    }
+    ScalarBinaryKernel(op, dst + i, lhs + i, rhs + i, n - i);
+}
+
+EXPRESSION_TARGET_AVX2 inline void Avx2NegateKernel(double *dst, const double *src, std::size_t n)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(dst + i, _mm256_xor_pd(_mm256_loadu_pd(src + i), sign));
+    ScalarNegateKernel(dst + i, src + i, n - i);
+}
+#endif
+
+//Auto 时按运行时检测的结果选择,请求的指令集不可用时退回到可用的最高指令集
+inline BatchKernels SelectBatchKernels(BatchIsa isa = BatchIsaAuto)
+{
+#if EXPRESSION_AVX2
+    if ((isa == BatchIsaAuto || isa == BatchIsaAVX2) && CpuSupportsAvx2())
+        return {BatchIsaAVX2, "AVX2", &Avx2BinaryKernel, &Avx2NegateKernel};
+#endif
+#if EXPRESSION_SSE2
+    if (isa != BatchIsaScalar)
+        return {BatchIsaSSE2, "SSE2", &Sse2BinaryKernel, &Sse2NegateKernel};
+#endif
+    return {BatchIsaScalar, "Scalar", &ScalarBinaryKernel, &ScalarNegateKernel};
+}
+
+//对同一份字节码按列批量运算:每次处理 BlockSize 行,栈中每个元素是一整块数据,
+//每条指令对整块数据调用一次向量化的计算核
+class BatchEvaluator
+{
+    struct Step
+    {
+        OpCode Op;
+        std::uint32_t Operand; //变量槽位、常量块编号或函数指针的下标
+    };
+
+    BatchKernels m_Kernels;
+    std::vector<Step> m_Steps;
+    std::vector<double> m_Constants; //每个常量展开为一整块,避免计算核区分标量/向量
+    std::unordered_map<std::uint64_t, std::uint32_t> m_ConstantBlocks;
+    std::vector<UnaryFunction> m_UnaryFunctions;
+    std::vector<BinaryFunction> m_BinaryFunctions;
+    std::vector<double> m_Blocks;
+    std::vector<const double *> m_Stack;
+
+    void Decode(const Bytecode &bytecode)
+    {
+        m_Steps.clear();
+        m_Constants.clear();
+        m_ConstantBlocks.clear();
+        m_UnaryFunctions.clear();
+        m_BinaryFunctions.clear();
+
+        const std::uint8_t *ip = bytecode.Code.data();
+        const std::uint8_t *end = ip + bytecode.Code.size();
+        while (ip != end)
+        {
+            Step step{static_cast<OpCode>(*ip++), 0};
+            switch (step.Op)
+            {
+            case OpPushNumber:
+            {
+                double value;
+                std::uint64_t bits;
+                std::memcpy(&value, ip, sizeof(value));
+                std::memcpy(&bits, ip, sizeof(bits));
+                ip += sizeof(value);
+                auto result = m_ConstantBlocks.emplace(bits, static_cast<std::uint32_t>(m_Constants.size() / BlockSize));
+                if (result.second)
+                    m_Constants.insert(m_Constants.end(), BlockSize, value);
+                step.Operand = result.first->second;
+                break;
+            }
+            case OpLoadVariable:
+                std::memcpy(&step.Operand, ip, sizeof(step.Operand));
+                ip += sizeof(step.Operand);
+                break;
+            case OpCall1:
+            {
+                UnaryFunction function;
+                std::memcpy(&function, ip, sizeof(function));
+                ip += sizeof(function);
+                step.Operand = static_cast<std::uint32_t>(m_UnaryFunctions.size());
+                m_UnaryFunctions.push_back(function);
+                break;
+            }
+            case OpCall2:
+            {
+                BinaryFunction function;
+                std::memcpy(&function, ip, sizeof(function));
+                ip += sizeof(function);
+                step.Operand = static_cast<std::uint32_t>(m_BinaryFunctions.size());
+                m_BinaryFunctions.push_back(function);
+                break;
+            }
+            case OpAdd:
+            case OpSub:
+            case OpMul:
+            case OpDiv:
+            case OpNegate:
+            case OpPow:
+            case OpMod:
+            case OpLess:
+            case OpLessEqual:
+            case OpGreater:
+            case OpGreaterEqual:
+            case OpEqual:
+            case OpNotEqual:
+                break;
+            case OpReturn:
+                m_Steps.push_back(step);
+                return;
+            default:
+                throw CompilerException("Invalid bytecode!");
+            }
+            m_Steps.push_back(step);
+        }
+        throw CompilerException("Invalid bytecode!");
+    }
+
+    void EvaluateBlock(const double *const *columns, double *out, std::size_t row, std::size_t count)
+    {
+        const double **sp = m_Stack.data();
+        for (std::size_t i = 0; i < m_Steps.size(); i++)
+        {
+            const Step &step = m_Steps[i];
+            //最后一步直接写入输出,省去一次拷贝
+            const bool last = i + 2 == m_Steps.size();
+            switch (step.Op)
+            {
+            case OpPushNumber:
+                *sp++ = m_Constants.data() + step.Operand * BlockSize;
+                break;
+            case OpLoadVariable:
+                *sp++ = columns[step.Operand] + row;
+                break;
+            case OpNegate:
+            {
+                double *dst = last ? out + row : Block(sp - 1);
+                m_Kernels.Negate(dst, sp[-1], count);
+                sp[-1] = dst;
+                break;
+            }
+            //函数调用没有向量化版本,逐行调用
+            case OpCall1:
+            {
+                double *dst = last ? out + row : Block(sp - 1);
+                UnaryFunction function = m_UnaryFunctions[step.Operand];
+                const double *src = sp[-1];
+                for (std::size_t j = 0; j < count; j++)
+                    dst[j] = function(src[j]);
+                sp[-1] = dst;
+                break;
+            }
+            case OpCall2:
+            {
+                --sp;
+                double *dst = last ? out + row : Block(sp - 1);
+                BinaryFunction function = m_BinaryFunctions[step.Operand];
+                const double *lhs = sp[-1];
+                const double *rhs = sp[0];
+                for (std::size_t j = 0; j < count; j++)
+                    dst[j] = function(lhs[j], rhs[j]);
+                sp[-1] = dst;
+                break;
+            }
+            case OpReturn:
+                if (sp[-1] != out + row)
+                    std::memmove(out + row, sp[-1], count * sizeof(double));
+                return;
+            default:
+            {
+                --sp;
+                double *dst = last ? out + row : Block(sp - 1);
+                m_Kernels.Binary(step.Op, dst, sp[-1], sp[0], count);
+                sp[-1] = dst;
+                break;
+            }
+            }
+        }
+    }
+
+    double *Block(const double **slot)
+    {
+        return m_Blocks.data() + (slot - m_Stack.data()) * BlockSize;
+    }
+
+public:
+    static constexpr std::size_t BlockSize = 256;
+
+    explicit BatchEvaluator(BatchIsa isa = BatchIsaAuto)
+        : m_Kernels(SelectBatchKernels(isa))
+    {
+    }
+
+    const char *IsaName() const noexcept
+    {
+        return m_Kernels.Name;
+    }
+
+    //columns[slot] 指向第 slot 个变量的 n 行数据,结果写入 out[0..n)
+    void Evaluate(const Bytecode &bytecode, const double *const *columns, double *out, std::size_t n)
+    {
+        if (bytecode.Code.empty())
+            throw CompilerException("Empty bytecode!");
+        if (bytecode.VariableCount != 0 && columns == nullptr)
+            throw CompilerException("Variable values not provided!");
+
+        Decode(bytecode);
+        m_Stack.resize(bytecode.MaxStackDepth);
+        m_Blocks.resize(static_cast<std::size_t>(bytecode.MaxStackDepth) * BlockSize);
+
+        for (std::size_t row = 0; row < n; row += BlockSize)
+            EvaluateBlock(columns, out, row, std::min(BlockSize, n - row));
+    }
+};
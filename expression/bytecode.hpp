@@ -0,0 +1,381 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+
+//指令为 1 字节操作码,常量以 8 字节内联在 OpPushNumber 之后,变量槽位以 4 字节内联在 OpLoadVariable 之后,
+//函数指针内联在 OpCall1 / OpCall2 之后
+enum OpCode : std::uint8_t
+{
+    OpPushNumber,
+    OpLoadVariable,
+    OpAdd,
+    OpSub,
+    OpMul,
+    OpDiv,
+    OpNegate,
+    OpReturn,
+    //以下运算按与 ASTNodeType 中 OperatorPow..OperatorNotEqual 相同的顺序排列
+    OpPow,
+    OpMod,
+    OpLess,
+    OpLessEqual,
+    OpGreater,
+    OpGreaterEqual,
+    OpEqual,
+    OpNotEqual,
+    OpCall1, //调用 UnaryFunction
+    OpCall2  //调用 BinaryFunction
+};
+
+static_assert(OpNotEqual - OpPow == OperatorNotEqual - OperatorPow, "OpCode and ASTNodeType must stay in sync");
+
+inline OpCode BinaryOpCode(ASTNodeType type)
+{
+    switch (type)
+    {
+    case OperatorPlus:
+        return OpAdd;
+    case OperatorMinus:
+        return OpSub;
+    case OperatorMul:
+        return OpMul;
+    case OperatorDiv:
+        return OpDiv;
+    default:
+        return static_cast<OpCode>(OpPow + (type - OperatorPow));
+    }
+}
+
+//OpPow..OpNotEqual 对应的节点类型,用于调用 ApplyBinaryOperator
+inline ASTNodeType ExtendedOperatorNode(OpCode op)
+{
+    return static_cast<ASTNodeType>(OperatorPow + (op - OpPow));
+}
+
+//后缀(逆波兰)形式的指令流,以 OpReturn 结尾
+struct Bytecode
+{
+    std::vector<std::uint8_t> Code;
+    std::uint32_t MaxStackDepth = 0;
+    std::uint32_t VariableCount = 0; //运行时需要提供的变量个数(最大槽位 + 1)
+};
+
+//指向外部存储(例如内存映射的文件)中的指令流,不拥有内存
+struct BytecodeView
+{
+    const std::uint8_t *Code = nullptr;
+    std::size_t Size = 0;
+    std::uint32_t MaxStackDepth = 0;
+    std::uint32_t VariableCount = 0;
+
+    BytecodeView() = default;
+
+    BytecodeView(const std::uint8_t *code, std::size_t size, std::uint32_t maxStackDepth, std::uint32_t variableCount)
+        : Code(code), Size(size), MaxStackDepth(maxStackDepth), VariableCount(variableCount)
+    {
+    }
+
+    BytecodeView(const Bytecode &bytecode)
+        : Code(bytecode.Code.data()), Size(bytecode.Code.size()),
+          MaxStackDepth(bytecode.MaxStackDepth), VariableCount(bytecode.VariableCount)
+    {
+    }
+};
+
+//检查来自外部的指令流:操作码与内联操作数完整、栈不会下溢、槽位小于 VariableCount,
+//MaxStackDepth 恰为实际的最大深度(VirtualMachine 按它分配栈,声明得过大同样拒绝),且以栈上只剩一个值的 OpReturn 结束.通过检查的指令流可以直接交给 VirtualMachine 运行;
+//函数指针只在本进程内有效,外部的指令流中出现 OpCall1 / OpCall2 一律拒绝
+inline bool VerifyBytecode(const BytecodeView &bytecode)
+{
+    const std::uint8_t *ip = bytecode.Code;
+    const std::uint8_t *end = ip + bytecode.Size;
+    std::uint32_t depth = 0;
+    std::uint32_t peak = 0;
+    while (ip != end)
+    {
+        std::uint8_t op = *ip++;
+        switch (op)
+        {
+        case OpPushNumber:
+            if (std::size_t(end - ip) < sizeof(double))
+                return false;
+            ip += sizeof(double);
+            depth++;
+            break;
+        case OpLoadVariable:
+        {
+            std::uint32_t slot;
+            if (std::size_t(end - ip) < sizeof(slot))
+                return false;
+            std::memcpy(&slot, ip, sizeof(slot));
+            ip += sizeof(slot);
+            if (slot >= bytecode.VariableCount)
+                return false;
+            depth++;
+            break;
+        }
+        case OpNegate:
+            if (depth < 1)
+                return false;
+            break;
+        case OpReturn:
+            return depth == 1 && ip == end && peak == bytecode.MaxStackDepth;
+        default:
+            if (op > OpNotEqual || depth < 2)
+                return false;
+            depth--;
+            break;
+        }
+        if (depth > bytecode.MaxStackDepth)
+            return false;
+        peak = std::max(peak, depth);
+    }
+    return false;
+}
+
+class CompilerException : public std::runtime_error
+{
+public:
+    CompilerException(const std::string &message) : std::runtime_error(message)
+    {
+    }
+};
+
+class Compiler
+{
+    const ASTArena *m_Arena = nullptr;
+    Bytecode *m_Output = nullptr;
+    std::uint32_t m_Depth = 0;
+
+    struct Frame
+    {
+        NodeIndex Index;
+        bool Expanded;
+    };
+    std::vector<Frame> m_Pending;
+
+    void Emit(OpCode op)
+    {
+        m_Output->Code.push_back(op);
+    }
+
+    void EmitNumber(double value)
+    {
+        std::uint8_t bytes[sizeof(double)];
+        std::memcpy(bytes, &value, sizeof(double));
+        m_Output->Code.push_back(OpPushNumber);
+        m_Output->Code.insert(m_Output->Code.end(), bytes, bytes + sizeof(double));
+        Push();
+    }
+
+    void EmitVariable(std::uint32_t slot)
+    {
+        std::uint8_t bytes[sizeof(slot)];
+        std::memcpy(bytes, &slot, sizeof(slot));
+        m_Output->Code.push_back(OpLoadVariable);
+        m_Output->Code.insert(m_Output->Code.end(), bytes, bytes + sizeof(slot));
+        if (slot >= m_Output->VariableCount)
+            m_Output->VariableCount = slot + 1;
+        Push();
+    }
+
+    //编译时就从 FunctionRegistry 取出函数指针,运行时直接调用
+    void EmitCall(const ASTNode &node)
+    {
+        const FunctionInfo &function = Functions()[node.Slot];
+        std::uint8_t bytes[sizeof(void *)];
+        if (function.Arity == 1)
+            std::memcpy(bytes, &function.Unary, sizeof(bytes));
+        else
+            std::memcpy(bytes, &function.Binary, sizeof(bytes));
+        m_Output->Code.push_back(function.Arity == 1 ? OpCall1 : OpCall2);
+        m_Output->Code.insert(m_Output->Code.end(), bytes, bytes + sizeof(bytes));
+        m_Depth -= function.Arity - 1;
+    }
+
+    void Push()
+    {
+        if (++m_Depth > m_Output->MaxStackDepth)
+            m_Output->MaxStackDepth = m_Depth;
+    }
+
+    //显式栈上的后序遍历,与 Evaluator 一样不受调用栈深度限制
+    void CompileSubtree(NodeIndex root)
+    {
+        m_Pending.clear();
+        m_Pending.push_back({root, false});
+        while (!m_Pending.empty())
+        {
+            Frame &frame = m_Pending.back();
+            if (!m_Arena->Contains(frame.Index))
+                throw CompilerException("Incorrect syntax tree!");
+
+            const ASTNode &ast = (*m_Arena)[frame.Index];
+            if (ast.Type == NumberValue)
+            {
+                m_Pending.pop_back();
+                EmitNumber(ast.Value);
+            }
+            else if (ast.Type == VariableValue)
+            {
+                m_Pending.pop_back();
+                EmitVariable(ast.Slot);
+            }
+            else if (!IsInnerNode(ast))
+            {
+                throw CompilerException("Incorrect syntax tree!");
+            }
+            else if (!frame.Expanded)
+            {
+                frame.Expanded = true;
+                if (!IsUnaryNode(ast))
+                    m_Pending.push_back({ast.Right, false});
+                m_Pending.push_back({ast.Left, false});
+            }
+            else if (ast.Type == UnaryMinus)
+            {
+                m_Pending.pop_back();
+                Emit(OpNegate);
+            }
+            else if (ast.Type == FunctionCall)
+            {
+                m_Pending.pop_back();
+                EmitCall(ast);
+            }
+            else
+            {
+                m_Pending.pop_back();
+                Emit(BinaryOpCode(ast.Type));
+                m_Depth--;
+            }
+        }
+    }
+
+public:
+    //结果写入 output,复用其已分配的内存
+    void Compile(const ASTArena &arena, NodeIndex root, Bytecode &output)
+    {
+        if (!arena.Contains(root))
+            throw CompilerException("Incorrect abstract syntax tree");
+
+        m_Arena = &arena;
+        m_Output = &output;
+        m_Depth = 0;
+        output.Code.clear();
+        output.MaxStackDepth = 0;
+        output.VariableCount = 0;
+        CompileSubtree(root);
+        Emit(OpReturn);
+    }
+
+    Bytecode Compile(const ASTArena &arena, NodeIndex root)
+    {
+        Bytecode result;
+        Compile(arena, root, result);
+        return result;
+    }
+};
+
+//栈式虚拟机,值栈按指令流的最大深度预先分配,运行期间不再分配内存
+class VirtualMachine
+{
+    std::vector<double> m_Stack;
+
+public:
+    //variables 按槽位存放变量值,至少包含 bytecode.VariableCount 个元素
+    double Run(const Bytecode &bytecode, const double *variables = nullptr)
+    {
+        return Run(BytecodeView(bytecode), variables);
+    }
+
+    //直接运行外部存储中的指令流;来源不可信时应先用 VerifyBytecode 检查
+    double Run(const BytecodeView &bytecode, const double *variables = nullptr)
+    {
+        if (bytecode.Size == 0)
+            throw CompilerException("Empty bytecode!");
+        if (bytecode.VariableCount != 0 && variables == nullptr)
+            throw CompilerException("Variable values not provided!");
+        if (m_Stack.size() < bytecode.MaxStackDepth)
+            m_Stack.resize(bytecode.MaxStackDepth);
+
+        const std::uint8_t *ip = bytecode.Code;
+        double *sp = m_Stack.data();
+        for (;;)
+        {
+            switch (*ip++)
+            {
+            case OpPushNumber:
+                std::memcpy(sp++, ip, sizeof(double));
+                ip += sizeof(double);
+                break;
+            case OpLoadVariable:
+            {
+                std::uint32_t slot;
+                std::memcpy(&slot, ip, sizeof(slot));
+                ip += sizeof(slot);
+                *sp++ = variables[slot];
+                break;
+            }
+            case OpAdd:
+                --sp;
+                sp[-1] += sp[0];
+                break;
+            case OpSub:
+                --sp;
+                sp[-1] -= sp[0];
+                break;
+            case OpMul:
+                --sp;
+                sp[-1] *= sp[0];
+                break;
+            case OpDiv:
+                --sp;
+                sp[-1] /= sp[0];
+                break;
+            case OpNegate:
+                sp[-1] = -sp[-1];
+                break;
+            case OpReturn:
+                return sp[-1];
+            case OpPow:
+            case OpMod:
+            case OpLess:
+            case OpLessEqual:
+            case OpGreater:
+            case OpGreaterEqual:
+            case OpEqual:
+            case OpNotEqual:
+                --sp;
+                sp[-1] = ApplyBinaryOperator(ExtendedOperatorNode(static_cast<OpCode>(ip[-1])), sp[-1], sp[0]);
+                break;
+            case OpCall1:
+            {
+                UnaryFunction function;
+                std::memcpy(&function, ip, sizeof(function));
+                ip += sizeof(function);
+                sp[-1] = function(sp[-1]);
+                break;
+            }
+            case OpCall2:
+            {
+                BinaryFunction function;
+                std::memcpy(&function, ip, sizeof(function));
+                ip += sizeof(function);
+                --sp;
+                sp[-1] = function(sp[-1], sp[0]);
+                break;
+            }
+            default:
+                throw CompilerException("Invalid bytecode!");
+            }
+        }
+    }
+};
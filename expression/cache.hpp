@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "compiled.hpp"
+
+struct ExpressionCacheStats
+{
+    std::uint64_t Hits = 0;
+    std::uint64_t Misses = 0;
+    std::uint64_t Evictions = 0;
+    std::size_t Entries = 0;
+    std::size_t Bytes = 0;
+};
+
+//以规范化后的表达式文本为键缓存编译结果:按键的哈希分片,每个分片独立加锁、独立做 LRU 淘汰,
+//内存预算平均分配给各分片;编译在锁外进行
+class ExpressionCache
+{
+    using Value = std::shared_ptr<const CompiledExpression>;
+
+    struct Entry
+    {
+        std::string Key;
+        Value Expression;
+        std::size_t Bytes = 0;
+    };
+
+    struct Shard
+    {
+        std::mutex Mutex;
+        std::list<Entry> Entries; //头部为最近使用
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> Index; //键指向 Entries 中的字符串
+        std::size_t Bytes = 0;
+        ExpressionCacheStats Stats;
+    };
+
+    std::vector<std::unique_ptr<Shard>> m_Shards;
+    std::size_t m_ShardBudget;
+
+    static constexpr std::size_t EntryOverhead = sizeof(Entry) + 4 * sizeof(void *) + sizeof(std::pair<std::string_view, void *>);
+
+    Shard &ShardFor(std::string_view key)
+    {
+        return *m_Shards[std::hash<std::string_view>{}(key) % m_Shards.size()];
+    }
+
+    Value Find(Shard &shard, std::string_view key)
+    {
+        auto it = shard.Index.find(key);
+        if (it == shard.Index.end())
+            return nullptr;
+        shard.Entries.splice(shard.Entries.begin(), shard.Entries, it->second);
+        shard.Stats.Hits++;
+        return it->second->Expression;
+    }
+
+    void Evict(Shard &shard)
+    {
+        while (shard.Bytes > m_ShardBudget && !shard.Entries.empty())
+        {
+            Entry &victim = shard.Entries.back();
+            shard.Index.erase(victim.Key);
+            shard.Bytes -= victim.Bytes;
+            shard.Entries.pop_back();
+            shard.Stats.Evictions++;
+        }
+    }
+
+public:
+    explicit ExpressionCache(std::size_t memoryBudget = 64 * 1024 * 1024, std::size_t shardCount = 16)
+    {
+        if (shardCount == 0)
+            shardCount = 1;
+        for (std::size_t i = 0; i < shardCount; i++)
+            m_Shards.push_back(std::make_unique<Shard>());
+        m_ShardBudget = memoryBudget / shardCount;
+    }
+
+    //命中时返回缓存的编译结果,否则编译并放入缓存;输入有误时抛出 ParserException,不缓存.
+    //编译的是调用者的原文,错误位置相对于原文
+    Value Get(std::string_view text)
+    {
+        std::string key = NormalizeExpression(text);
+        Shard &shard = ShardFor(key);
+        {
+            std::lock_guard<std::mutex> lock(shard.Mutex);
+            if (Value found = Find(shard, key))
+                return found;
+            shard.Stats.Misses++;
+        }
+
+        auto compiled = std::make_shared<const CompiledExpression>(CompileExpression(text));
+        std::size_t bytes = EntryOverhead + key.capacity() + compiled->MemoryUsage();
+        if (bytes > m_ShardBudget)
+            return compiled;
+
+        std::lock_guard<std::mutex> lock(shard.Mutex);
+        //其它线程可能已经编译并放入了同一个键
+        auto it = shard.Index.find(key);
+        if (it != shard.Index.end())
+            return it->second->Expression;
+
+        shard.Entries.push_front(Entry{std::move(key), compiled, bytes});
+        shard.Index.emplace(shard.Entries.front().Key, shard.Entries.begin());
+        shard.Bytes += bytes;
+        Evict(shard);
+        return compiled;
+    }
+
+    ExpressionCacheStats Stats() const
+    {
+        ExpressionCacheStats result;
+        for (const auto &shard : m_Shards)
+        {
+            std::lock_guard<std::mutex> lock(shard->Mutex);
+            result.Hits += shard->Stats.Hits;
+            result.Misses += shard->Stats.Misses;
+            result.Evictions += shard->Stats.Evictions;
+            result.Entries += shard->Entries.size();
+            result.Bytes += shard->Bytes;
+        }
+        return result;
+    }
+
+    void Clear()
+    {
+        for (const auto &shard : m_Shards)
+        {
+            std::lock_guard<std::mutex> lock(shard->Mutex);
+            shard->Index.clear();
+            shard->Entries.clear();
+            shard->Bytes = 0;
+        }
+    }
+};
@@ -0,0 +1,543 @@
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.hpp"
+#include "evaluator.hpp"
+#include "optimizer.hpp"
+
+//8 字节的紧凑节点.所有节点按后序排列,父节点紧跟在右子节点之后,因此只需要记录左子节点的距离;
+//距离是相对的,整棵子树搬到别处时不必修改其中的节点
+struct CompactNode
+{
+    std::uint8_t Type;     //ASTNodeType
+    std::uint8_t Function; //FunctionCall 在 FunctionRegistry 中的编号
+    std::uint8_t Inline;   //NumberValue:为 1 时 Operand 是数值本身(float 的位),否则为常量池下标
+    std::uint8_t Reserved;
+    std::uint32_t Operand; //二元运算与双参数函数为左子节点的距离,一元节点为 0;NumberValue 见 Inline;VariableValue 为变量槽位
+};
+
+static_assert(sizeof(CompactNode) == 8, "CompactNode must stay 8 bytes");
+static_assert(FunctionRegistry::Capacity <= 256, "Function id must fit in CompactNode::Function");
+
+//CompactArena 中的一棵树:节点 [First, Root],Root 为根
+struct CompactExpression
+{
+    std::uint32_t First = 0;
+    std::uint32_t Root = 0;
+
+    std::size_t Size() const noexcept
+    {
+        return std::size_t(Root) - First + 1;
+    }
+};
+
+//大量常驻表达式的紧凑存储:节点放在一块连续内存中,float 能精确表示的数值直接放在节点里,
+//其它数值放入共享的常量池(相同的位模式只保存一份)
+class CompactArena
+{
+    std::vector<CompactNode> m_Nodes;
+    std::vector<double> m_Constants;
+    std::unordered_map<std::uint64_t, std::uint32_t> m_ConstantIndex; //按位去重,区分 0.0 与 -0.0
+
+    struct Frame
+    {
+        NodeIndex Index;
+        bool Expanded;
+    };
+    std::vector<Frame> m_Pending;
+    std::vector<std::uint32_t> m_Roots; //已编码子树的根,用于计算左子节点的距离
+
+    std::uint32_t Constant(double value)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        auto result = m_ConstantIndex.emplace(bits, static_cast<std::uint32_t>(m_Constants.size()));
+        if (result.second)
+        {
+            if (m_Constants.size() >= UINT32_MAX)
+                throw std::length_error("Too many constants in compact arena!");
+            m_Constants.push_back(value);
+        }
+        return result.first->second;
+    }
+
+    std::uint32_t Push(const CompactNode &node)
+    {
+        if (m_Nodes.size() >= UINT32_MAX)
+            throw std::length_error("Too many nodes in compact arena!");
+        m_Nodes.push_back(node);
+        return static_cast<std::uint32_t>(m_Nodes.size() - 1);
+    }
+
+    //float 能逐位还原的数值(含 -0.0 与无穷)放在节点里
+    static bool FitsInline(double value)
+    {
+        if (std::isnan(value) || !(std::isinf(value) || std::fabs(value) <= FLT_MAX))
+            return false;
+        return static_cast<double>(static_cast<float>(value)) == value;
+    }
+
+public:
+    //追加一个运算节点或变量,返回其下标;left 为左子节点的下标,只对二元运算与双参数函数有意义,
+    //VariableValue 的 slot 为变量槽位,FunctionCall 的 slot 为函数编号
+    std::uint32_t Append(ASTNodeType type, std::uint32_t left = 0, std::uint32_t slot = 0)
+    {
+        std::uint32_t index = static_cast<std::uint32_t>(m_Nodes.size());
+        CompactNode node{static_cast<std::uint8_t>(type), 0, 0, 0, 0};
+        if (type == VariableValue)
+            node.Operand = slot;
+        else if (IsBinaryOperator(type) || (type == FunctionCall && Functions()[slot].Arity == 2))
+            node.Operand = index - left;
+        if (type == FunctionCall)
+            node.Function = static_cast<std::uint8_t>(slot);
+        return Push(node);
+    }
+
+    std::uint32_t AppendNumber(double value)
+    {
+        CompactNode node{static_cast<std::uint8_t>(NumberValue), 0, 0, 0, 0};
+        if (FitsInline(value))
+        {
+            float narrow = static_cast<float>(value);
+            node.Inline = 1;
+            std::memcpy(&node.Operand, &narrow, sizeof(narrow));
+        }
+        else
+        {
+            node.Operand = Constant(value);
+        }
+        return Push(node);
+    }
+
+    //将 source 中以 root 为根的树按后序编码追加到本 arena;共享的子树按出现次数展开
+    CompactExpression Add(const ASTArena &source, NodeIndex root)
+    {
+        if (!source.Contains(root))
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        CompactExpression expression;
+        expression.First = static_cast<std::uint32_t>(m_Nodes.size());
+        m_Pending.assign(1, {root, false});
+        m_Roots.clear();
+        while (!m_Pending.empty())
+        {
+            Frame &frame = m_Pending.back();
+            if (!source.Contains(frame.Index))
+                throw EvaluatorException("Incorrect syntax tree!");
+
+            const ASTNode &node = source[frame.Index];
+            if (node.Type == NumberValue)
+            {
+                m_Pending.pop_back();
+                m_Roots.push_back(AppendNumber(node.Value));
+            }
+            else if (node.Type == VariableValue)
+            {
+                m_Pending.pop_back();
+                m_Roots.push_back(Append(VariableValue, 0, node.Slot));
+            }
+            else if (!IsInnerNode(node))
+            {
+                throw EvaluatorException("Incorrect syntax tree!");
+            }
+            else if (!frame.Expanded)
+            {
+                frame.Expanded = true;
+                if (!IsUnaryNode(node))
+                    m_Pending.push_back({node.Right, false});
+                m_Pending.push_back({node.Left, false});
+            }
+            else
+            {
+                m_Pending.pop_back();
+                std::uint32_t left = m_Roots.back();
+                if (!IsUnaryNode(node))
+                {
+                    m_Roots.pop_back();
+                    left = m_Roots.back();
+                }
+                m_Roots.back() = Append(node.Type, left, node.Slot);
+            }
+        }
+        expression.Root = m_Roots.back();
+        return expression;
+    }
+
+    //解码为普通的语法树,用于只接受 ASTArena 的编译器等
+    NodeIndex Decode(CompactExpression expression, ASTArena &target) const
+    {
+        std::vector<NodeIndex> roots;
+        for (std::uint32_t i = expression.First; i <= expression.Root; i++)
+        {
+            const CompactNode &node = m_Nodes[i];
+            ASTNodeType type = static_cast<ASTNodeType>(node.Type);
+            if (type == NumberValue)
+            {
+                roots.push_back(target.Create(NumberValue, InvalidNode, InvalidNode, Value(i)));
+            }
+            else if (type == VariableValue)
+            {
+                roots.push_back(target.Create(VariableValue, InvalidNode, InvalidNode, 0, node.Operand));
+            }
+            else if (IsUnary(i))
+            {
+                roots.back() = target.Create(type, roots.back(), InvalidNode, 0, node.Function);
+            }
+            else
+            {
+                NodeIndex right = roots.back();
+                roots.pop_back();
+                roots.back() = target.Create(type, roots.back(), right, 0, node.Function);
+            }
+        }
+        return roots.back();
+    }
+
+    const CompactNode &operator[](std::uint32_t index) const
+    {
+        return m_Nodes[index];
+    }
+
+    ASTNodeType Type(std::uint32_t index) const
+    {
+        return static_cast<ASTNodeType>(m_Nodes[index].Type);
+    }
+
+    //只有一个子节点:一元负号与单参数函数
+    bool IsUnary(std::uint32_t index) const
+    {
+        const CompactNode &node = m_Nodes[index];
+        return node.Type == UnaryMinus || (node.Type == FunctionCall && node.Operand == 0);
+    }
+
+    std::uint32_t Left(std::uint32_t index) const
+    {
+        return IsUnary(index) ? index - 1 : index - m_Nodes[index].Operand;
+    }
+
+    std::uint32_t Right(std::uint32_t index) const
+    {
+        return index - 1;
+    }
+
+    //仅对 NumberValue 有意义
+    double Value(std::uint32_t index) const
+    {
+        const CompactNode &node = m_Nodes[index];
+        if (!node.Inline)
+            return m_Constants[node.Operand];
+        float value;
+        std::memcpy(&value, &node.Operand, sizeof(value));
+        return value;
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Nodes.size();
+    }
+
+    std::size_t ConstantCount() const noexcept
+    {
+        return m_Constants.size();
+    }
+
+    //节点与常量池占用的内存,不含去重索引(可以用 ReleaseIndex 释放)
+    std::size_t MemoryUsage() const noexcept
+    {
+        return m_Nodes.capacity() * sizeof(CompactNode) + m_Constants.capacity() * sizeof(double);
+    }
+
+    void Reserve(std::size_t count)
+    {
+        m_Nodes.reserve(count);
+    }
+
+    //不再添加表达式时释放常量去重索引与编码用的临时栈,并归还多余的容量
+    void ReleaseIndex()
+    {
+        std::unordered_map<std::uint64_t, std::uint32_t>().swap(m_ConstantIndex);
+        std::vector<Frame>().swap(m_Pending);
+        std::vector<std::uint32_t>().swap(m_Roots);
+        m_Nodes.shrink_to_fit();
+        m_Constants.shrink_to_fit();
+    }
+
+    void Reset() noexcept
+    {
+        m_Nodes.clear();
+        m_Constants.clear();
+        m_ConstantIndex.clear();
+    }
+};
+
+//按下标顺序线性运算:后序排列即是逆波兰顺序,不需要递归,也不需要读取子节点的距离
+class CompactEvaluator
+{
+    std::vector<double> m_Stack;
+
+public:
+    double Evaluate(const CompactArena &arena, CompactExpression expression, const double *variables = nullptr)
+    {
+        if (expression.First > expression.Root || expression.Root >= arena.Size())
+            throw EvaluatorException("Incorrect abstract syntax tree");
+        EXPRESSION_STATS_ADD(Evaluations, 1);
+        EXPRESSION_STATS_TIME(EvaluateNanoseconds);
+
+        //值栈深度不超过叶子节点数
+        std::size_t depth = expression.Size() / 2 + 1;
+        if (m_Stack.size() < depth)
+            m_Stack.resize(depth);
+        double *sp = m_Stack.data();
+        for (std::uint32_t i = expression.First; i <= expression.Root; i++)
+        {
+            const CompactNode &node = arena[i];
+            switch (node.Type)
+            {
+            case NumberValue:
+                *sp++ = arena.Value(i);
+                break;
+            case VariableValue:
+                if (variables == nullptr)
+                    throw EvaluatorException("Variable values not provided!");
+                *sp++ = variables[node.Operand];
+                break;
+            case UnaryMinus:
+                sp[-1] = -sp[-1];
+                break;
+            case OperatorPlus:
+                --sp;
+                sp[-1] += sp[0];
+                break;
+            case OperatorMinus:
+                --sp;
+                sp[-1] -= sp[0];
+                break;
+            case OperatorMul:
+                --sp;
+                sp[-1] *= sp[0];
+                break;
+            case OperatorDiv:
+                --sp;
+                sp[-1] /= sp[0];
+                break;
+            case FunctionCall:
+                if (node.Operand == 0)
+                {
+                    sp[-1] = Functions()[node.Function].Unary(sp[-1]);
+                }
+                else
+                {
+                    --sp;
+                    sp[-1] = Functions()[node.Function].Binary(sp[-1], sp[0]);
+                }
+                break;
+            default:
+                --sp;
+                sp[-1] = ApplyBinaryOperator(static_cast<ASTNodeType>(node.Type), sp[-1], sp[0]);
+                break;
+            }
+        }
+        EXPRESSION_STATS_ADD(EvaluationSteps, expression.Size());
+        return sp[-1];
+    }
+};
+
+//直接在紧凑编码上做的单趟化简:折叠常量子树与常量参数的函数调用,消除右侧的单位元(x*1、x/1、x-0、x+(-0))
+//与双重负号.按后序扫描源节点,结果按后序输出;子树总是输出的一段后缀,化简只需截断或追加.
+//与 Optimizer 一样,StrictIEEE 时结果与化简前逐位一致
+class CompactOptimizer
+{
+    //已输出的子树:从 Start 开始的后缀;Constant 时只有一个数值节点
+    struct Entry
+    {
+        std::uint32_t Start;
+        bool Constant;
+        double Value;
+    };
+
+    //输出的节点,数值节点的值暂时放在 Value 中,最后写入目标时再决定内联还是放入常量池
+    struct Output
+    {
+        CompactNode Node;
+        double Value;
+    };
+
+    OptimizerOptions m_Options;
+    OptimizerStats m_Stats;
+    std::vector<Entry> m_Entries;
+    std::vector<Output> m_Output;
+
+    static bool Is(const Entry &entry, double value)
+    {
+        return entry.Constant && entry.Value == value && std::signbit(entry.Value) == std::signbit(value);
+    }
+
+    std::uint32_t End() const
+    {
+        return static_cast<std::uint32_t>(m_Output.size());
+    }
+
+    void PushConstant(std::uint32_t start, double value)
+    {
+        m_Output.resize(start);
+        m_Output.push_back({{static_cast<std::uint8_t>(NumberValue), 0, 0, 0, 0}, value});
+        m_Entries.push_back({start, true, value});
+    }
+
+    //栈顶的子树换成 value
+    void Fold(double value)
+    {
+        m_Stats.Folded++;
+        std::uint32_t start = m_Entries.back().Start;
+        m_Entries.pop_back();
+        PushConstant(start, value);
+    }
+
+    //栈顶的子树换成它的相反数
+    void Negate()
+    {
+        Entry &entry = m_Entries.back();
+        if (entry.Constant)
+        {
+            Fold(-entry.Value);
+            return;
+        }
+        if (m_Output.back().Node.Type == UnaryMinus)
+        {
+            m_Stats.Simplified++;
+            m_Output.pop_back();
+            return;
+        }
+        m_Output.push_back({{static_cast<std::uint8_t>(UnaryMinus), 0, 0, 0, 0}, 0});
+    }
+
+    //右侧为常量的单位元:结果就是左子树
+    bool RightIdentity(ASTNodeType type, const Entry &right) const
+    {
+        const bool strict = m_Options.StrictIEEE;
+        switch (type)
+        {
+        case OperatorPlus:
+            return Is(right, -0.0) || (!strict && Is(right, 0.0));
+        case OperatorMinus:
+            return Is(right, 0.0) || (!strict && Is(right, -0.0));
+        case OperatorMul:
+        case OperatorDiv:
+            return Is(right, 1.0);
+        default:
+            return false;
+        }
+    }
+
+    void Binary(const CompactNode &node)
+    {
+        ASTNodeType type = static_cast<ASTNodeType>(node.Type);
+        Entry right = m_Entries.back();
+        m_Entries.pop_back();
+        Entry &left = m_Entries.back();
+        if (left.Constant && right.Constant)
+        {
+            Fold(type == FunctionCall ? Functions()[node.Function].Binary(left.Value, right.Value)
+                                      : ApplyBinaryOperator(type, left.Value, right.Value));
+        }
+        else if (RightIdentity(type, right))
+        {
+            m_Stats.Simplified++;
+            m_Output.resize(right.Start);
+        }
+        else if ((type == OperatorMul || type == OperatorDiv) && Is(right, -1.0))
+        {
+            m_Stats.Simplified++;
+            m_Output.resize(right.Start);
+            Negate();
+        }
+        else if (!m_Options.StrictIEEE && type == OperatorMul && (Is(left, 0.0) || Is(right, 0.0)))
+        {
+            m_Stats.Simplified++;
+            std::uint32_t start = left.Start;
+            m_Entries.pop_back();
+            PushConstant(start, 0.0);
+        }
+        else
+        {
+            //左子树的根紧挨在右子树之前
+            CompactNode result = node;
+            result.Operand = End() - (right.Start - 1);
+            m_Output.push_back({result, 0});
+            left.Constant = false;
+        }
+    }
+
+public:
+    explicit CompactOptimizer(OptimizerOptions options = {})
+        : m_Options(options)
+    {
+    }
+
+    //将 source 中的 expression 化简后追加到 target,返回新的表达式
+    CompactExpression Optimize(const CompactArena &source, CompactExpression expression, CompactArena &target)
+    {
+        if (expression.First > expression.Root || expression.Root >= source.Size())
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        m_Stats = OptimizerStats{};
+        m_Stats.Before.Nodes = m_Stats.Before.Steps = expression.Size();
+        m_Entries.clear();
+        m_Output.clear();
+        for (std::uint32_t i = expression.First; i <= expression.Root; i++)
+        {
+            const CompactNode &node = source[i];
+            switch (node.Type)
+            {
+            case NumberValue:
+                PushConstant(End(), source.Value(i));
+                break;
+            case VariableValue:
+                m_Entries.push_back({End(), false, 0});
+                m_Output.push_back({node, 0});
+                break;
+            case UnaryMinus:
+                Negate();
+                break;
+            default:
+                if (!source.IsUnary(i))
+                    Binary(node);
+                else if (m_Entries.back().Constant)
+                    Fold(Functions()[node.Function].Unary(m_Entries.back().Value));
+                else
+                    m_Output.push_back({node, 0});
+                break;
+            }
+        }
+
+        CompactExpression result;
+        result.First = static_cast<std::uint32_t>(target.Size());
+        for (std::uint32_t i = 0; i < End(); i++)
+        {
+            const CompactNode &node = m_Output[i].Node;
+            std::uint32_t left = result.First + i - node.Operand;
+            if (node.Type == NumberValue)
+                target.AppendNumber(m_Output[i].Value);
+            else if (node.Type == VariableValue)
+                target.Append(VariableValue, 0, node.Operand);
+            else
+                target.Append(static_cast<ASTNodeType>(node.Type), left, node.Function);
+        }
+        result.Root = static_cast<std::uint32_t>(target.Size() - 1);
+        m_Stats.After.Nodes = m_Stats.After.Steps = result.Size();
+        return result;
+    }
+
+    const OptimizerStats &Stats() const noexcept
+    {
+        return m_Stats;
+    }
+};
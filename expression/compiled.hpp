@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parser.hpp"
+#include "textscan.hpp"
+#include "optimizer.hpp"
+#include "bytecode.hpp"
+
+//编译完成的表达式,创建后不再修改,可以在多个线程之间共享
+struct CompiledExpression
+{
+    Bytecode Code;
+    std::vector<std::string> Variables; //按槽位排列的变量名
+
+    std::size_t MemoryUsage() const noexcept
+    {
+        std::size_t bytes = sizeof(CompiledExpression) + Code.Code.capacity();
+        for (const std::string &name : Variables)
+            bytes += sizeof(std::string) + name.capacity();
+        return bytes;
+    }
+};
+
+//解析、优化并编译,输入有误时抛出 ParserException
+inline CompiledExpression CompileExpression(std::string_view text)
+{
+    ASTArena arena;
+    ASTArena optimized;
+    VariableTable variables;
+    Parser parser;
+    NodeIndex root = parser.Parse(text.data(), text.size(), arena, variables);
+    root = Optimizer{}.Optimize(arena, root, optimized);
+
+    CompiledExpression result;
+    Compiler{}.Compile(optimized, root, result.Code);
+    result.Variables = variables.Names();
+    return result;
+}
+
+inline bool IsWordCharacter(char ch)
+{
+    return IsIdentifierCharacter(ch) || ch == '.';
+}
+
+inline bool IsExponentMarker(char ch)
+{
+    return ch == 'e' || ch == 'E' || ch == 'p' || ch == 'P';
+}
+
+inline bool IsSign(char ch)
+{
+    return ch == '+' || ch == '-';
+}
+
+//去掉空白后 left 与 right 相邻会并成一个令牌时须保留一个空格:两侧都是标识符/数字字符("1 2" 不能变成 "12"),
+//或者可能被读作数值的指数部分("2e -5"、"2e- 5" 不能变成合法的 "2e-5").before 为 left 之前的字符
+inline bool NeedsSeparator(char before, char left, char right)
+{
+    if (IsWordCharacter(left) && IsWordCharacter(right))
+        return true;
+    if (IsExponentMarker(left) && IsSign(right))
+        return true;
+    return IsSign(left) && IsExponentMarker(before) && IsWordCharacter(right);
+}
+
+//去掉不影响含义的空白,规范化前后的文本解析为相同的令牌序列(针对默认运算符表,运算符都是单个字符)
+inline std::string NormalizeExpression(std::string_view text)
+{
+    std::string result;
+    result.reserve(text.size());
+    bool pendingSpace = false;
+    for (char ch : text)
+    {
+        if (IsAsciiSpace(ch))
+        {
+            pendingSpace = true;
+            continue;
+        }
+        std::size_t size = result.size();
+        if (pendingSpace && size != 0 && NeedsSeparator(size > 1 ? result[size - 2] : ' ', result.back(), ch))
+            result.push_back(' ');
+        pendingSpace = false;
+        result.push_back(ch);
+    }
+    return result;
+}
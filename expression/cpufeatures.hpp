@@ -0,0 +1,55 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define EXPRESSION_X86 1
+#else
+#define EXPRESSION_X86 0
+#endif
+
+//x86-64 必然支持 SSE2,32 位需要编译器开启
+#if EXPRESSION_X86 && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define EXPRESSION_SSE2 1
+#else
+#define EXPRESSION_SSE2 0
+#endif
+
+//AVX2 函数单独以目标属性编译,调用前需要运行时检测
+#if EXPRESSION_X86 && (defined(__GNUC__) || defined(__clang__))
+#define EXPRESSION_AVX2 1
+#define EXPRESSION_TARGET_AVX2 __attribute__((target("avx2")))
+#elif EXPRESSION_X86 && defined(_MSC_VER)
+#define EXPRESSION_AVX2 1
+#define EXPRESSION_TARGET_AVX2
+#else
+#define EXPRESSION_AVX2 0
+#define EXPRESSION_TARGET_AVX2
+#endif
+
+#if EXPRESSION_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+inline bool CpuSupportsAvx2()
+{
+#if EXPRESSION_AVX2 && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif EXPRESSION_AVX2
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
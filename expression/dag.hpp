@@ -0,0 +1,318 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.hpp"
+#include "evaluator.hpp"
+
+struct DagStats
+{
+    std::size_t TreeNodes = 0; //按树展开时的节点数
+    std::size_t DagNodes = 0;  //去重后的节点数
+
+    double Ratio() const noexcept
+    {
+        return DagNodes == 0 ? 1.0 : double(TreeNodes) / DagNodes;
+    }
+};
+
+//哈希共享(hash-consing):结构相同的子树只保存一份,整棵树变成有向无环图;
+//节点总是在其子节点之后创建,索引顺序即为一种拓扑顺序.变量按名称共享:图有自己的 VariableTable,
+//各棵树的槽位在并入时换成图中的槽位,运算时的变量数组按图的槽位排列
+class ExpressionDag
+{
+    struct Key
+    {
+        ASTNodeType Type;
+        NodeIndex Left;
+        NodeIndex Right;
+        std::uint32_t Slot;
+        std::uint64_t Bits; //按位比较数值,区分 0.0 与 -0.0
+
+        bool operator==(const Key &other) const noexcept
+        {
+            return Type == other.Type && Left == other.Left && Right == other.Right && Slot == other.Slot &&
+                   Bits == other.Bits;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key &key) const noexcept
+        {
+            std::uint64_t hash = key.Bits * 0x9E3779B97F4A7C15ull;
+            hash ^= (std::uint64_t(key.Left) << 32 | key.Right) + 0x7F4A7C159E3779B9ull + (hash << 6) + (hash >> 2);
+            hash ^= (std::uint64_t(key.Type) << 32 | key.Slot) + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+            return static_cast<std::size_t>(hash);
+        }
+    };
+
+    ASTArena m_Nodes;
+    VariableTable m_Variables;
+    std::unordered_map<Key, NodeIndex, KeyHash> m_Index;
+    std::unordered_map<NodeIndex, std::vector<NodeIndex>> m_Schedules; //每棵树可达的节点,按索引升序
+    std::vector<NodeIndex> m_Mapping;
+    std::vector<NodeIndex> m_Pending;
+    std::vector<std::uint32_t> m_Slots; //源树的槽位 -> 图的槽位
+    DagStats m_Stats;
+
+    NodeIndex Intern(const ASTNode &node, NodeIndex left, NodeIndex right)
+    {
+        std::uint32_t slot = 0;
+        if (node.Type == FunctionCall)
+            slot = node.Slot;
+        else if (node.Type == VariableValue)
+        {
+            if (node.Slot >= m_Slots.size())
+                throw EvaluatorException("Variable names not provided!");
+            slot = m_Slots[node.Slot];
+        }
+        Key key{node.Type, left, right, slot, 0};
+        if (node.Type == NumberValue)
+            std::memcpy(&key.Bits, &node.Value, sizeof(key.Bits));
+        auto it = m_Index.find(key);
+        if (it != m_Index.end())
+            return it->second;
+        NodeIndex index = m_Nodes.Create(node.Type, left, right, node.Value, key.Slot);
+        m_Index.emplace(key, index);
+        return index;
+    }
+
+    NodeIndex Merge(const ASTArena &source, NodeIndex root)
+    {
+        if (!source.Contains(root))
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        std::vector<NodeIndex> reachable;
+        m_Mapping.assign(source.Size(), InvalidNode);
+        m_Pending.assign(1, root);
+        while (!m_Pending.empty())
+        {
+            NodeIndex index = m_Pending.back();
+            if (m_Mapping[index] != InvalidNode)
+            {
+                m_Pending.pop_back();
+                continue;
+            }
+            const ASTNode &node = source[index];
+            bool ready = true;
+            for (NodeIndex child : {node.Left, node.Right})
+            {
+                if (child == InvalidNode)
+                    continue;
+                if (!source.Contains(child))
+                    throw EvaluatorException("Incorrect syntax tree!");
+                if (m_Mapping[child] == InvalidNode)
+                {
+                    m_Pending.push_back(child);
+                    ready = false;
+                }
+            }
+            if (!ready)
+                continue;
+
+            m_Pending.pop_back();
+            NodeIndex left = node.Left == InvalidNode ? InvalidNode : m_Mapping[node.Left];
+            NodeIndex right = node.Right == InvalidNode ? InvalidNode : m_Mapping[node.Right];
+            m_Mapping[index] = Intern(node, left, right);
+            reachable.push_back(m_Mapping[index]);
+        }
+
+        //源树中不同的节点可能对应图中同一个节点
+        std::sort(reachable.begin(), reachable.end());
+        reachable.erase(std::unique(reachable.begin(), reachable.end()), reachable.end());
+        m_Schedules.emplace(m_Mapping[root], std::move(reachable));
+        m_Stats.TreeNodes += MeasureTreeSize(source, root);
+        m_Stats.DagNodes = m_Nodes.Size();
+        return m_Mapping[root];
+    }
+
+public:
+    //将 source 中以 root 为根的树并入图中,返回对应的节点;多次调用时不同的树之间同样共享子树.
+    //variables 中的名称按槽位顺序登记到图的 VariableTable,同名变量在各棵树之间共享
+    NodeIndex Add(const ASTArena &source, NodeIndex root, const VariableTable &variables)
+    {
+        m_Slots.resize(variables.Size());
+        for (std::uint32_t slot = 0; slot < m_Slots.size(); slot++)
+            m_Slots[slot] = m_Variables.Resolve(variables.Name(slot));
+        return Merge(source, root);
+    }
+
+    //只用于不含变量的树,遇到变量时抛出 EvaluatorException
+    NodeIndex Add(const ASTArena &source, NodeIndex root)
+    {
+        m_Slots.clear();
+        return Merge(source, root);
+    }
+
+    //运算时变量数组按其中的槽位排列
+    const VariableTable &Variables() const noexcept
+    {
+        return m_Variables;
+    }
+
+    //root 由 Add 返回时为其可达的节点(按索引升序),否则为 nullptr
+    const std::vector<NodeIndex> *Schedule(NodeIndex root) const
+    {
+        auto it = m_Schedules.find(root);
+        return it == m_Schedules.end() ? nullptr : &it->second;
+    }
+
+    const ASTArena &Nodes() const noexcept
+    {
+        return m_Nodes;
+    }
+
+    const DagStats &Stats() const noexcept
+    {
+        return m_Stats;
+    }
+
+    //节点与去重索引占用的内存(近似值)
+    std::size_t MemoryUsage() const noexcept
+    {
+        std::size_t bytes = m_Nodes.Capacity() * sizeof(ASTNode) + m_Index.bucket_count() * sizeof(void *) +
+                            m_Index.size() * (sizeof(Key) + sizeof(NodeIndex) + 2 * sizeof(void *));
+        for (const auto &schedule : m_Schedules)
+            bytes += sizeof(schedule) + 2 * sizeof(void *) + schedule.second.capacity() * sizeof(NodeIndex);
+        return bytes;
+    }
+
+    //不再添加新的树时可以释放去重索引,只保留节点
+    void ReleaseIndex()
+    {
+        std::unordered_map<Key, NodeIndex, KeyHash>().swap(m_Index);
+        std::vector<NodeIndex>().swap(m_Mapping);
+        std::vector<NodeIndex>().swap(m_Pending);
+        std::vector<std::uint32_t>().swap(m_Slots);
+    }
+
+    void Reset()
+    {
+        m_Nodes.Reset();
+        m_Variables.Reset();
+        m_Index.clear();
+        m_Schedules.clear();
+        m_Stats = DagStats{};
+    }
+
+    //按树展开时以 root 为根的节点数,共享的子树按出现次数重复计算
+    static std::size_t MeasureTreeSize(const ASTArena &arena, NodeIndex root)
+    {
+        std::vector<std::size_t> sizes(arena.Size(), 0);
+        std::vector<NodeIndex> pending{root};
+        while (!pending.empty())
+        {
+            NodeIndex index = pending.back();
+            const ASTNode &node = arena[index];
+            bool ready = true;
+            for (NodeIndex child : {node.Left, node.Right})
+            {
+                if (arena.Contains(child) && sizes[child] == 0)
+                {
+                    pending.push_back(child);
+                    ready = false;
+                }
+            }
+            if (!ready)
+                continue;
+            pending.pop_back();
+            sizes[index] = 1 + (arena.Contains(node.Left) ? sizes[node.Left] : 0) +
+                           (arena.Contains(node.Right) ? sizes[node.Right] : 0);
+        }
+        return sizes[root];
+    }
+};
+
+//按索引顺序线性运算 root 可达的节点,每个不同的子表达式只运算一次,不需要递归或栈
+class DagEvaluator
+{
+    std::vector<double> m_Values;
+    std::vector<NodeIndex> m_Schedule;
+    std::vector<bool> m_Reachable;
+
+    //root 不是某棵树的根时临时求出可达的节点
+    const std::vector<NodeIndex> &Reachable(const ASTArena &nodes, NodeIndex root)
+    {
+        m_Reachable.assign(static_cast<std::size_t>(root) + 1, false);
+        m_Reachable[root] = true;
+        m_Schedule.clear();
+        for (NodeIndex i = root + 1; i-- > 0;)
+        {
+            if (!m_Reachable[i])
+                continue;
+            m_Schedule.push_back(i);
+            for (NodeIndex child : {nodes[i].Left, nodes[i].Right})
+            {
+                if (child != InvalidNode)
+                    m_Reachable[child] = true;
+            }
+        }
+        std::reverse(m_Schedule.begin(), m_Schedule.end());
+        return m_Schedule;
+    }
+
+public:
+    //variables 按 dag.Variables() 的槽位排列
+    double Evaluate(const ExpressionDag &dag, NodeIndex root, const double *variables = nullptr)
+    {
+        const ASTArena &nodes = dag.Nodes();
+        if (!nodes.Contains(root))
+            throw EvaluatorException("Incorrect abstract syntax tree");
+
+        const std::vector<NodeIndex> *schedule = dag.Schedule(root);
+        if (schedule == nullptr)
+            schedule = &Reachable(nodes, root);
+        m_Values.resize(static_cast<std::size_t>(root) + 1);
+        double *values = m_Values.data();
+        for (NodeIndex i : *schedule)
+        {
+            const ASTNode &node = nodes[i];
+            switch (node.Type)
+            {
+            case NumberValue:
+                values[i] = node.Value;
+                break;
+            case VariableValue:
+                if (variables == nullptr)
+                    throw EvaluatorException("Variable values not provided!");
+                values[i] = variables[node.Slot];
+                break;
+            case UnaryMinus:
+                values[i] = -values[node.Left];
+                break;
+            case OperatorPlus:
+                values[i] = values[node.Left] + values[node.Right];
+                break;
+            case OperatorMinus:
+                values[i] = values[node.Left] - values[node.Right];
+                break;
+            case OperatorMul:
+                values[i] = values[node.Left] * values[node.Right];
+                break;
+            case OperatorDiv:
+                values[i] = values[node.Left] / values[node.Right];
+                break;
+            case FunctionCall:
+                if (!IsValidFunctionCall(node))
+                    throw EvaluatorException("Incorrect syntax tree!");
+                if (node.Right == InvalidNode)
+                    values[i] = ApplyUnaryNode(node, values[node.Left]);
+                else
+                    values[i] = ApplyBinaryNode(node, values[node.Left], values[node.Right]);
+                break;
+            default:
+                if (!IsBinaryOperator(node.Type))
+                    throw EvaluatorException("Incorrect syntax tree!");
+                values[i] = ApplyBinaryOperator(node.Type, values[node.Left], values[node.Right]);
+                break;
+            }
+        }
+        return values[root];
+    }
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+
+class EvaluatorException : public std::runtime_error
+{
+public:
+    EvaluatorException(const std::string &message) : std::runtime_error(message)
+    {
+    }
+};
+
+//浅层子树直接递归;更深的部分改用显式的栈:沿左子树下行时途经的节点入栈,
+//右子树不是叶子节点时才保存中间结果,树的深度不受调用栈限制
+class Evaluator
+{
+    struct Frame
+    {
+        NodeIndex Index;
+        bool Expanded; //正在运算右子树,左子树的结果在 m_Values 栈顶
+    };
+
+    std::vector<Frame> m_Pending;
+    std::vector<double> m_Values;
+
+    static constexpr int MaxRecursion = 64;
+
+    static const ASTNode &Node(const ASTArena &arena, NodeIndex index)
+    {
+        if (!arena.Contains(index))
+            throw EvaluatorException("Incorrect syntax tree!");
+        return arena[index];
+    }
+
+    static bool IsLeaf(const ASTNode &node)
+    {
+        return node.Type == NumberValue || node.Type == VariableValue;
+    }
+
+    static double Leaf(const ASTNode &node, const double *variables)
+    {
+        if (node.Type == NumberValue)
+            return node.Value;
+        if (variables == nullptr)
+            throw EvaluatorException("Variable values not provided!");
+        return variables[node.Slot];
+    }
+
+    static double Apply(const ASTNode &node, double v1, double v2)
+    {
+        switch (node.Type)
+        {
+        case OperatorPlus:
+            return v1 + v2;
+        case OperatorMinus:
+            return v1 - v2;
+        case OperatorMul:
+            return v1 * v2;
+        case OperatorDiv:
+            return v1 / v2;
+        default:
+            return ApplyBinaryNode(node, v1, v2);
+        }
+    }
+
+    //超过 MaxRecursion 层的子树交给 EvaluateIterative
+    double EvaluateSubtree(const ASTArena &arena, NodeIndex index, const double *variables, int depth)
+    {
+        const ASTNode &ast = Node(arena, index);
+        if (depth >= MaxRecursion && !IsLeaf(ast))
+            return EvaluateIterative(arena, index, variables, depth);
+        EXPRESSION_STATS_ADD(EvaluationSteps, 1);
+        EXPRESSION_STATS_MAX(MaxEvaluationDepth, depth);
+        if (IsLeaf(ast))
+            return Leaf(ast, variables);
+        if (ast.Type == UnaryMinus)
+            return -EvaluateSubtree(arena, ast.Left, variables, depth + 1);
+        if (!IsInnerNode(ast))
+            throw EvaluatorException("Incorrect syntax tree!");
+        double v1 = EvaluateSubtree(arena, ast.Left, variables, depth + 1);
+        if (IsUnaryNode(ast))
+            return ApplyUnaryNode(ast, v1);
+        double v2 = EvaluateSubtree(arena, ast.Right, variables, depth + 1);
+        return Apply(ast, v1, v2);
+    }
+
+    //depth 为 root 所在的层数,只用于统计
+    double EvaluateIterative(const ASTArena &arena, NodeIndex root, const double *variables, [[maybe_unused]] int depth)
+    {
+        m_Pending.clear();
+        m_Values.clear();
+        NodeIndex index = root;
+        for (;;)
+        {
+            const ASTNode *node = &Node(arena, index);
+            while (!IsLeaf(*node))
+            {
+                if (!IsInnerNode(*node))
+                    throw EvaluatorException("Incorrect syntax tree!");
+                EXPRESSION_STATS_ADD(EvaluationSteps, 1);
+                m_Pending.push_back({index, false});
+                index = node->Left;
+                node = &Node(arena, index);
+            }
+            EXPRESSION_STATS_ADD(EvaluationSteps, 1);
+            EXPRESSION_STATS_MAX(MaxEvaluationDepth, depth + m_Pending.size());
+            double value = Leaf(*node, variables);
+
+            //向上归约,直到遇到右子树需要单独运算的节点
+            for (;;)
+            {
+                if (m_Pending.empty())
+                    return value;
+                Frame &frame = m_Pending.back();
+                const ASTNode &ast = arena[frame.Index];
+                if (IsUnaryNode(ast))
+                {
+                    value = ApplyUnaryNode(ast, value);
+                }
+                else if (frame.Expanded)
+                {
+                    value = Apply(ast, m_Values.back(), value);
+                    m_Values.pop_back();
+                }
+                else
+                {
+                    const ASTNode &right = Node(arena, ast.Right);
+                    if (!IsLeaf(right))
+                    {
+                        frame.Expanded = true;
+                        m_Values.push_back(value);
+                        index = ast.Right;
+                        break;
+                    }
+                    EXPRESSION_STATS_ADD(EvaluationSteps, 1);
+                    value = Apply(ast, value, Leaf(right, variables));
+                }
+                m_Pending.pop_back();
+            }
+        }
+    }
+
+public:
+    //variables 按 VariableTable 分配的槽位存放变量值
+    double Evalute(const ASTArena &arena, NodeIndex root, const double *variables = nullptr)
+    {
+        if (!arena.Contains(root))
+            throw EvaluatorException("Incorrect abstract syntax tree");
+        EXPRESSION_STATS_ADD(Evaluations, 1);
+        EXPRESSION_STATS_TIME(EvaluateNanoseconds);
+        return EvaluateSubtree(arena, root, variables, 0);
+    }
+};
@@ -0,0 +1,465 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "parser.hpp"
+#include "evaluator.hpp"
+#include "bytecode.hpp"
+#include "optimizer.hpp"
+#include "jit.hpp"
+#include "dag.hpp"
+#include "staticexpr.hpp"
+#include "textscan.hpp"
+
+//统计堆分配次数,用于计算每次解析的分配次数;各种形式的 new/delete 都经过下面这一对函数.
+//CountedRelease 不内联:否则 GCC 在内联后看到 new 返回的指针交给 free,会误报 -Wmismatched-new-delete
+#if defined(__GNUC__) || defined(__clang__)
+#define BENCHMARK_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define BENCHMARK_NOINLINE __declspec(noinline)
+#else
+#define BENCHMARK_NOINLINE
+#endif
+
+static std::size_t g_Allocations = 0;
+
+static void *CountedAllocate(std::size_t size) noexcept
+{
+    g_Allocations++;
+    return std::malloc(size != 0 ? size : 1);
+}
+
+BENCHMARK_NOINLINE static void CountedRelease(void *p) noexcept
+{
+    std::free(p);
+}
+
+void *operator new(std::size_t size)
+{
+    if (void *p = CountedAllocate(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    if (void *p = CountedAllocate(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    CountedRelease(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    CountedRelease(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    CountedRelease(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    CountedRelease(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    CountedRelease(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    CountedRelease(p);
+}
+
+struct Workload
+{
+    std::string Name;
+    std::vector<std::string> Expressions;
+    std::size_t Bytes = 0;
+};
+
+struct Measurement
+{
+    std::string Workload;
+    std::string Phase;
+    std::size_t Runs = 0;
+    double NsPerExpression = 0;
+    double AllocationsPerExpression = 0;
+    double MegabytesPerSecond = 0; //只对解析与词法分析有意义
+    double BytesPerCycle = 0;      //按时间戳计数器(TSC)计,不支持时为 0
+};
+
+static volatile double g_Sink = 0;
+
+//时间戳计数器按固定频率计数,与核心实际频率可能不同
+inline std::uint64_t ReadCycleCounter()
+{
+#if EXPRESSION_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+Workload MakeWorkload(const std::string &name, std::vector<std::string> expressions)
+{
+    Workload workload{name, std::move(expressions)};
+    for (const std::string &text : workload.Expressions)
+        workload.Bytes += text.size();
+    return workload;
+}
+
+//短表达式:3 到 8 个操作数,偶尔带括号与负号
+Workload ShortExpressions(std::mt19937 &random)
+{
+    const char ops[] = {'+', '-', '*', '/'};
+    std::vector<std::string> expressions;
+    for (int i = 0; i < 4096; i++)
+    {
+        std::string text;
+        int operands = 3 + random() % 6;
+        for (int k = 0; k < operands; k++)
+        {
+            if (k != 0)
+                text += ops[random() % 4];
+            if (random() % 5 == 0)
+                text += "(-" + std::to_string(random() % 100) + "+" + std::to_string(1 + random() % 9) + ")";
+            else
+                text += std::to_string(random() % 1000);
+        }
+        expressions.push_back(text);
+    }
+    return MakeWorkload("short", std::move(expressions));
+}
+
+Workload NestedParentheses()
+{
+    std::vector<std::string> expressions;
+    for (int depth : {16, 64, 256})
+    {
+        std::string text;
+        for (int i = 0; i < depth; i++)
+            text += "(1+";
+        text += "1";
+        text += std::string(depth, ')');
+        expressions.push_back(text);
+    }
+    return MakeWorkload("nested", std::move(expressions));
+}
+
+Workload FlatSums()
+{
+    std::vector<std::string> expressions;
+    for (int terms : {100, 1000, 4000})
+    {
+        std::string text = "1";
+        for (int i = 1; i < terms; i++)
+            text += i % 2 ? "+2" : "-1";
+        expressions.push_back(text);
+    }
+    return MakeWorkload("flat", std::move(expressions));
+}
+
+//以数值为主:多位整数与小数,运算符很少
+Workload NumberHeavy(std::mt19937 &random)
+{
+    std::vector<std::string> expressions;
+    for (int i = 0; i < 1024; i++)
+    {
+        std::string text;
+        for (int k = 0; k < 8; k++)
+        {
+            if (k != 0)
+                text += k % 2 ? "*" : "+";
+            text += std::to_string(random() % 100000000) + "." + std::to_string(random() % 1000000000);
+        }
+        expressions.push_back(text);
+    }
+    return MakeWorkload("numbers", std::move(expressions));
+}
+
+//令牌之间夹着 0 到 48 个空白的短表达式,模拟生成器输出的带缩进的表达式
+Workload PaddedExpressions(std::mt19937 &random)
+{
+    const char ops[] = {'+', '-', '*', '/'};
+    const char blanks[] = {' ', ' ', ' ', '\t', '\n'};
+    auto pad = [&](std::string &text) {
+        for (int i = random() % 49; i > 0; i--)
+            text += blanks[random() % 5];
+    };
+    std::vector<std::string> expressions;
+    for (int i = 0; i < 1024; i++)
+    {
+        std::string text;
+        for (int k = 0, operands = 3 + random() % 6; k < operands; k++)
+        {
+            if (k != 0)
+            {
+                text += ops[random() % 4];
+                pad(text);
+            }
+            text += std::to_string(random() % 1000);
+            pad(text);
+        }
+        expressions.push_back(text);
+    }
+    return MakeWorkload("padded", std::move(expressions));
+}
+
+//每个字符串是 length 个属于该类的字符加一个结束字符,用于单独测量 SkipWhitespace/SkipDigits
+Workload ScanRuns(const char *name, const char *alphabet, std::size_t length, std::mt19937 &random)
+{
+    std::size_t size = std::strlen(alphabet);
+    std::vector<std::string> texts;
+    for (std::size_t total = 0; total < (1 << 20); total += length + 1)
+    {
+        std::string text;
+        for (std::size_t i = 0; i < length; i++)
+            text += alphabet[random() % size];
+        texts.push_back(text + "x");
+    }
+    return MakeWorkload(std::string(name) + "-" + std::to_string(length), std::move(texts));
+}
+
+//反复运行 run(i),直到累计时间超过 minimum;返回每个表达式的平均耗时与分配次数
+template <typename Run>
+Measurement Measure(const Workload &workload, const char *phase, Run run, double minimum = 0.25)
+{
+    using Clock = std::chrono::steady_clock;
+    Measurement result{workload.Name, phase};
+    std::size_t allocations = g_Allocations;
+    std::size_t bytes = 0;
+    std::uint64_t cycles = ReadCycleCounter();
+    auto start = Clock::now();
+    double elapsed = 0;
+    do
+    {
+        for (std::size_t i = 0; i < workload.Expressions.size(); i++)
+            run(i);
+        result.Runs += workload.Expressions.size();
+        bytes += workload.Bytes;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < minimum);
+    cycles = ReadCycleCounter() - cycles;
+
+    result.NsPerExpression = elapsed * 1e9 / result.Runs;
+    result.AllocationsPerExpression = double(g_Allocations - allocations) / result.Runs;
+    result.MegabytesPerSecond = bytes / elapsed / (1024.0 * 1024.0);
+    result.BytesPerCycle = cycles == 0 ? 0 : double(bytes) / cycles;
+    return result;
+}
+
+void BenchmarkWorkload(const Workload &workload, std::vector<Measurement> &results)
+{
+    const auto &texts = workload.Expressions;
+    Parser parser;
+    ASTArena arena;
+
+    results.push_back(Measure(workload, "tokenize", [&](std::size_t i) {
+        g_Sink = g_Sink + parser.CountTokens(texts[i].data(), texts[i].size());
+    }));
+
+    results.push_back(Measure(workload, "parse", [&](std::size_t i) {
+        arena.Reset();
+        g_Sink = g_Sink + parser.Parse(texts[i].data(), texts[i].size(), arena);
+    }));
+
+    //词法分析预先完成,只计语法分析
+    std::vector<TokenBuffer> tokens(texts.size());
+    for (std::size_t i = 0; i < texts.size(); i++)
+        parser.Tokenize(texts[i].data(), texts[i].size(), tokens[i]);
+    results.push_back(Measure(workload, "parse-tokens", [&](std::size_t i) {
+        arena.Reset();
+        g_Sink = g_Sink + parser.Parse(tokens[i], arena);
+    }));
+    tokens = {};
+
+    results.push_back(Measure(workload, "parse-fresh-arena", [&](std::size_t i) {
+        ASTArena fresh;
+        g_Sink = g_Sink + parser.Parse(texts[i].data(), texts[i].size(), fresh);
+    }));
+
+    //运算阶段预先解析、编译好所有表达式;除 evaluate-optimized-bytecode 外都使用未经优化的语法树
+    std::vector<ASTArena> arenas(texts.size());
+    std::vector<NodeIndex> roots(texts.size());
+    std::vector<Bytecode> codes(texts.size());
+    std::vector<Bytecode> optimizedCodes(texts.size());
+    std::vector<JitExpression> jits;
+    std::vector<ExpressionDag> dags(texts.size());
+    std::vector<NodeIndex> dagRoots(texts.size());
+    for (std::size_t i = 0; i < texts.size(); i++)
+    {
+        roots[i] = parser.Parse(texts[i].c_str(), arenas[i]);
+        codes[i] = Compiler{}.Compile(arenas[i], roots[i]);
+        ASTArena optimized;
+        NodeIndex root = Optimizer{}.Optimize(arenas[i], roots[i], optimized);
+        optimizedCodes[i] = Compiler{}.Compile(optimized, root);
+        jits.emplace_back(arenas[i], roots[i]);
+        dagRoots[i] = dags[i].Add(arenas[i], roots[i]);
+    }
+
+    Evaluator evaluator;
+    VirtualMachine vm;
+    results.push_back(Measure(workload, "evaluate-tree", [&](std::size_t i) {
+        g_Sink = g_Sink + evaluator.Evalute(arenas[i], roots[i]);
+    }));
+    results.push_back(Measure(workload, "evaluate-bytecode", [&](std::size_t i) {
+        g_Sink = g_Sink + vm.Run(codes[i]);
+    }));
+    results.push_back(Measure(workload, "evaluate-optimized-bytecode", [&](std::size_t i) {
+        g_Sink = g_Sink + vm.Run(optimizedCodes[i]);
+    }));
+    DagEvaluator dagEvaluator;
+    results.push_back(Measure(workload, "evaluate-dag", [&](std::size_t i) {
+        g_Sink = g_Sink + dagEvaluator.Evaluate(dags[i], dagRoots[i]);
+    }));
+    results.push_back(Measure(workload, jits.empty() || jits[0].IsNative() ? "evaluate-jit" : "evaluate-jit-fallback", [&](std::size_t i) {
+        g_Sink = g_Sink + jits[i]();
+    }));
+}
+
+static constexpr auto g_StaticTree = ParseStatic("price * (1 - discount) + tax / 2");
+using StaticFormula = StaticExpression<g_StaticTree>;
+
+//编译期解析的固定公式:与运行时解析后运算相比,StaticFormula 没有解析开销,也不需要遍历语法树
+void BenchmarkStatic(std::vector<Measurement> &results)
+{
+    //重复同一公式,使计时开销分摊到多次运算上
+    Workload workload = MakeWorkload("static", std::vector<std::string>(1024, "price * (1 - discount) + tax / 2"));
+    const std::string &text = workload.Expressions[0];
+    static double values[] = {80, 0.25, 10};
+    Parser parser;
+    ASTArena arena;
+    VariableTable variables;
+    Evaluator evaluator;
+
+    results.push_back(Measure(workload, "parse+evaluate-tree", [&](std::size_t) {
+        arena.Reset();
+        variables.Reset();
+        NodeIndex root = parser.Parse(text.data(), text.size(), arena, variables);
+        g_Sink = g_Sink + evaluator.Evalute(arena, root, values);
+    }));
+
+    arena.Reset();
+    variables.Reset();
+    NodeIndex root = parser.Parse(text.data(), text.size(), arena, variables);
+    results.push_back(Measure(workload, "evaluate-tree", [&](std::size_t) {
+        g_Sink = g_Sink + evaluator.Evalute(arena, root, values);
+    }));
+
+    //防止编译器把整个调用当作常量提前算出
+    double *volatile input = values;
+    results.push_back(Measure(workload, "evaluate-static", [&](std::size_t) {
+        g_Sink = g_Sink + StaticFormula{}(input);
+    }));
+}
+
+//分别测量各指令集版本的扫描函数,每段字符的长度固定,便于比较每周期处理的字节数
+void BenchmarkScanners(std::mt19937 &random, std::vector<Measurement> &results)
+{
+    std::vector<ScanKernels> kernels = {SelectScanKernels(ScanIsaScalar)};
+    for (ScanIsa isa : {ScanIsaSSE2, ScanIsaAVX2})
+    {
+        ScanKernels selected = SelectScanKernels(isa);
+        if (selected.Isa == isa)
+            kernels.push_back(selected);
+    }
+
+    for (std::size_t length : {8, 64, 512})
+    {
+        for (bool digits : {false, true})
+        {
+            Workload workload = digits ? ScanRuns("digits", "0123456789", length, random)
+                                       : ScanRuns("spaces", " \t\n  ", length, random);
+            for (const ScanKernels &kernel : kernels)
+            {
+                SkipFunction skip = digits ? kernel.SkipDigits : kernel.SkipWhitespace;
+                std::string phase = std::string(digits ? "skip-digits-" : "skip-whitespace-") + kernel.Name;
+                results.push_back(Measure(workload, phase.c_str(), [&](std::size_t i) {
+                    const std::string &text = workload.Expressions[i];
+                    g_Sink = g_Sink + (skip(text.data(), text.data() + text.size()) - text.data());
+                }));
+            }
+        }
+    }
+}
+
+void PrintTable(const std::vector<Measurement> &results)
+{
+    std::printf("%-10s %-28s %14s %12s %10s %8s\n", "workload", "phase", "ns/expr", "allocs/expr", "MB/s", "B/cycle");
+    for (const Measurement &m : results)
+        std::printf("%-10s %-28s %14.1f %12.3f %10.2f %8.3f\n", m.Workload.c_str(), m.Phase.c_str(),
+                    m.NsPerExpression, m.AllocationsPerExpression, m.MegabytesPerSecond, m.BytesPerCycle);
+}
+
+void PrintJson(const std::vector<Measurement> &results)
+{
+    std::printf("{\n  \"benchmark\": \"expression\",\n  \"format\": 1,\n  \"results\": [\n");
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const Measurement &m = results[i];
+        std::printf("    {\"workload\": \"%s\", \"phase\": \"%s\", \"runs\": %zu, \"ns_per_expression\": %.3f, "
+                    "\"allocations_per_expression\": %.4f, \"mb_per_second\": %.3f, \"bytes_per_cycle\": %.4f}%s\n",
+                    m.Workload.c_str(), m.Phase.c_str(), m.Runs, m.NsPerExpression,
+                    m.AllocationsPerExpression, m.MegabytesPerSecond, m.BytesPerCycle, i + 1 == results.size() ? "" : ",");
+    }
+    std::printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool json = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--json") == 0)
+            json = true;
+        else
+        {
+            std::fprintf(stderr, "usage: exprBenchmark [--json]\n");
+            return 1;
+        }
+    }
+
+    std::mt19937 random(20201010);
+    std::vector<Workload> workloads;
+    workloads.push_back(ShortExpressions(random));
+    workloads.push_back(NestedParentheses());
+    workloads.push_back(FlatSums());
+    workloads.push_back(NumberHeavy(random));
+    workloads.push_back(PaddedExpressions(random));
+
+    std::vector<Measurement> results;
+    for (const Workload &workload : workloads)
+        BenchmarkWorkload(workload, results);
+    BenchmarkStatic(results);
+    BenchmarkScanners(random, results);
+
+    if (json)
+        PrintJson(results);
+    else
+        PrintTable(results);
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "parser.hpp"
+#include "evaluator.hpp"
+#include "mappedfile.hpp"
+
+//输出缓冲,写满后才调用一次 fwrite
+class OutputBuffer
+{
+    std::FILE *m_File;
+    std::vector<char> m_Buffer;
+    std::size_t m_Used = 0;
+
+    void Reserve(std::size_t size)
+    {
+        if (m_Used + size > m_Buffer.size())
+            Flush();
+    }
+
+public:
+    explicit OutputBuffer(std::FILE *file, std::size_t capacity = 1 << 20)
+        : m_File(file), m_Buffer(capacity)
+    {
+    }
+
+    ~OutputBuffer()
+    {
+        Flush();
+    }
+
+    void Write(const char *data, std::size_t size)
+    {
+        Reserve(size);
+        if (size > m_Buffer.size())
+        {
+            std::fwrite(data, 1, size, m_File);
+            return;
+        }
+        std::memcpy(m_Buffer.data() + m_Used, data, size);
+        m_Used += size;
+    }
+
+    void Put(char ch)
+    {
+        Reserve(1);
+        m_Buffer[m_Used++] = ch;
+    }
+
+    //最短的可往返表示
+    void WriteNumber(double value)
+    {
+        Reserve(32);
+        auto result = std::to_chars(m_Buffer.data() + m_Used, m_Buffer.data() + m_Buffer.size(), value);
+        m_Used = result.ptr - m_Buffer.data();
+    }
+
+    void Flush()
+    {
+        if (m_Used != 0)
+            std::fwrite(m_Buffer.data(), 1, m_Used, m_File);
+        m_Used = 0;
+    }
+};
+
+//逐行解析运算,每行输出结果或错误信息;行内容直接在输入缓冲上解析,不做拷贝
+class LineEvaluator
+{
+    Parser m_Parser;
+    ASTArena m_Arena;
+    Evaluator m_Evaluator;
+    OutputBuffer &m_Output;
+
+public:
+    std::size_t Lines = 0;
+    std::size_t Errors = 0;
+
+    explicit LineEvaluator(OutputBuffer &output)
+        : m_Output(output)
+    {
+    }
+
+    void Process(const char *line, std::size_t length)
+    {
+        if (length != 0 && line[length - 1] == '\r')
+            length--;
+        Lines++;
+        if (length != 0)
+        {
+            m_Arena.Reset();
+            //格式错误的行很常见,走不抛出异常的解析路径
+            ParseResult result = m_Parser.Parse(std::nothrow, line, length, m_Arena);
+            if (result)
+                m_Output.WriteNumber(m_Evaluator.Evalute(m_Arena, result.Root));
+            else
+            {
+                Errors++;
+                std::string message = result.Error.Message();
+                m_Output.Write("error: ", 7);
+                m_Output.Write(message.data(), message.size());
+            }
+        }
+        m_Output.Put('\n');
+    }
+
+    //处理 [data, data + size) 中的完整行,返回已处理的字节数;final 为 true 时最后一行可以没有换行符
+    std::size_t ProcessBlock(const char *data, std::size_t size, bool final)
+    {
+        const char *begin = data;
+        const char *end = data + size;
+        while (begin != end)
+        {
+            const char *newline = static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+            if (newline == nullptr)
+            {
+                if (!final)
+                    break;
+                newline = end;
+            }
+            Process(begin, newline - begin);
+            begin = newline == end ? end : newline + 1;
+        }
+        return begin - data;
+    }
+};
+
+//按大块读取标准输入,只把跨块的不完整行移动到缓冲区开头
+std::size_t ProcessStream(std::FILE *input, LineEvaluator &evaluator)
+{
+    std::vector<char> buffer(4 << 20);
+    std::size_t pending = 0;
+    std::size_t total = 0;
+    for (;;)
+    {
+        if (pending == buffer.size())
+            buffer.resize(buffer.size() * 2);
+        std::size_t count = std::fread(buffer.data() + pending, 1, buffer.size() - pending, input);
+        total += count;
+        bool final = count == 0;
+        std::size_t size = pending + count;
+        std::size_t processed = evaluator.ProcessBlock(buffer.data(), size, final);
+        pending = size - processed;
+        if (final)
+            break;
+        std::memmove(buffer.data(), buffer.data() + processed, pending);
+    }
+    return total;
+}
+
+void PrintUsage()
+{
+    std::fputs("usage: exprEval [input-file | -] [-o output-file] [--stats]\n"
+               "Evaluates one expression per line and writes one result per line.\n"
+               "--stats prints parse and evaluation counters (requires a build with EXPRESSION_STATS).\n",
+               stderr);
+}
+
+int main(int argc, char **argv)
+{
+    std::string input = "-";
+    std::string output;
+    bool stats = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (arg == "--stats")
+            stats = true;
+        else if (arg == "-h" || arg == "--help")
+        {
+            PrintUsage();
+            return 0;
+        }
+        else
+            input = arg;
+    }
+
+    std::FILE *out = stdout;
+    if (!output.empty() && (out = std::fopen(output.c_str(), "wb")) == nullptr)
+    {
+        std::fprintf(stderr, "Cannot open output file '%s'\n", output.c_str());
+        return 1;
+    }
+#if defined(_WIN32)
+    _setmode(_fileno(stdin), _O_BINARY);
+    if (out == stdout)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    auto start = std::chrono::steady_clock::now();
+    std::size_t bytes = 0;
+    std::size_t lines = 0;
+    std::size_t errors = 0;
+    try
+    {
+        OutputBuffer buffer(out);
+        LineEvaluator evaluator(buffer);
+        if (input == "-")
+        {
+            bytes = ProcessStream(stdin, evaluator);
+        }
+        else
+        {
+            MappedFile file(input);
+            bytes = file.Size();
+            evaluator.ProcessBlock(file.Data(), file.Size(), true);
+        }
+        lines = evaluator.Lines;
+        errors = evaluator.Errors;
+    }
+    catch (std::exception &ex)
+    {
+        std::fprintf(stderr, "%s\n", ex.what());
+        return 1;
+    }
+    if (out != stdout)
+        std::fclose(out);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (seconds <= 0)
+        seconds = 1e-9;
+    std::fprintf(stderr, "%zu lines (%zu errors), %zu bytes in %.3f s: %.0f lines/s, %.2f MB/s\n",
+                 lines, errors, bytes, seconds, lines / seconds, bytes / seconds / (1024.0 * 1024.0));
+    if (stats && EXPRESSION_STATS)
+        ThreadExpressionStats().Print(stderr);
+    else if (stats)
+        std::fputs("statistics are not compiled in, rebuild with -DEXPRESSION_STATS=ON\n", stderr);
+    return 0;
+}
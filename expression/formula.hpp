@@ -0,0 +1,352 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "parser.hpp"
+#include "evaluator.hpp"
+
+class FormulaException : public std::runtime_error
+{
+public:
+    FormulaException(const std::string &message) : std::runtime_error(message)
+    {
+    }
+};
+
+struct FormulaUpdateStats
+{
+    std::size_t Inputs = 0;     //值发生变化的输入
+    std::size_t Recomputed = 0; //重新运算的公式
+    std::size_t Changed = 0;    //重新运算后值发生变化的公式
+};
+
+//具名公式的依赖图:公式中出现的名字或是其它公式,或是输入;输入变化时只按拓扑顺序重新运算受影响的公式,
+//运算结果与原来逐位相同的公式不再向下传播.BeginUpdate/EndUpdate 之间的修改合并为一次传播
+class FormulaGraph
+{
+    using NodeId = std::uint32_t;
+
+    struct Node
+    {
+        std::string Name;
+        double Value = std::numeric_limits<double>::quiet_NaN(); //尚未赋值的输入为 NaN
+        bool IsFormula = false;
+        bool Queued = false;
+        std::uint32_t Level = 0;       //输入为 0,公式大于其所有依赖的 Level
+        std::uint32_t QueuedLevel = 0; //Queued 时最近一次入队的 Level
+        ASTArena Arena;
+        NodeIndex Root = InvalidNode;
+        std::vector<NodeId> Dependencies; //下标为公式中变量的槽位
+        std::vector<NodeId> Dependents;
+    };
+
+    struct QueueEntry
+    {
+        std::uint32_t Level;
+        NodeId Id;
+
+        bool operator>(const QueueEntry &other) const
+        {
+            return Level != other.Level ? Level > other.Level : Id > other.Id;
+        }
+    };
+
+    std::vector<Node> m_Nodes;
+    std::unordered_map<std::string, NodeId> m_Names;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> m_Queue;
+    Parser m_Parser;
+    Evaluator m_Evaluator;
+    std::vector<double> m_Arguments;
+    int m_UpdateDepth = 0;
+    FormulaUpdateStats m_Pending;
+    FormulaUpdateStats m_LastUpdate;
+    std::uint64_t m_TotalRecomputed = 0;
+
+    NodeId Intern(std::string_view name)
+    {
+        auto it = m_Names.find(std::string(name));
+        if (it != m_Names.end())
+            return it->second;
+        NodeId id = static_cast<NodeId>(m_Nodes.size());
+        m_Nodes.emplace_back();
+        m_Nodes.back().Name = std::string(name);
+        m_Names.emplace(m_Nodes.back().Name, id);
+        return id;
+    }
+
+    static constexpr NodeId NoNode = 0xFFFFFFFFu;
+
+    //不存在时返回 NoNode,不登记新的名字
+    NodeId Lookup(std::string_view name) const
+    {
+        auto it = m_Names.find(std::string(name));
+        return it == m_Names.end() ? NoNode : it->second;
+    }
+
+    NodeId Find(std::string_view name) const
+    {
+        NodeId id = Lookup(name);
+        if (id == NoNode)
+            throw FormulaException("Unknown name '" + std::string(name) + "'");
+        return id;
+    }
+
+    //已在队列中但 Level 升高了(RaiseLevels)时按新的 Level 再入队一次,旧的队列项出队时丢弃
+    void Enqueue(NodeId id)
+    {
+        Node &node = m_Nodes[id];
+        if (node.Queued && node.QueuedLevel == node.Level)
+            return;
+        node.Queued = true;
+        node.QueuedLevel = node.Level;
+        m_Queue.push({node.Level, id});
+    }
+
+    void EnqueueDependents(NodeId id)
+    {
+        for (NodeId dependent : m_Nodes[id].Dependents)
+            Enqueue(dependent);
+    }
+
+    //从 from 沿被依赖方向能否到达 target
+    bool Reaches(NodeId from, NodeId target) const
+    {
+        std::vector<bool> visited(m_Nodes.size(), false);
+        std::vector<NodeId> pending{from};
+        while (!pending.empty())
+        {
+            NodeId id = pending.back();
+            pending.pop_back();
+            if (id == target)
+                return true;
+            if (visited[id])
+                continue;
+            visited[id] = true;
+            for (NodeId dependent : m_Nodes[id].Dependents)
+                pending.push_back(dependent);
+        }
+        return false;
+    }
+
+    void Unlink(NodeId id)
+    {
+        Node &node = m_Nodes[id];
+        for (NodeId dependency : node.Dependencies)
+        {
+            auto &dependents = m_Nodes[dependency].Dependents;
+            dependents.erase(std::find(dependents.begin(), dependents.end(), id));
+        }
+        node.Dependencies.clear();
+        node.Arena.Reset();
+        node.Root = InvalidNode;
+        node.IsFormula = false;
+    }
+
+    //保持每条边上被依赖者的 Level 小于依赖者;Level 只会升高,偏高不影响拓扑顺序
+    void RaiseLevels(NodeId id)
+    {
+        std::vector<NodeId> pending{id};
+        while (!pending.empty())
+        {
+            NodeId current = pending.back();
+            pending.pop_back();
+            for (NodeId dependent : m_Nodes[current].Dependents)
+            {
+                if (m_Nodes[dependent].Level <= m_Nodes[current].Level)
+                {
+                    m_Nodes[dependent].Level = m_Nodes[current].Level + 1;
+                    if (m_Nodes[dependent].Queued)
+                        Enqueue(dependent);
+                    pending.push_back(dependent);
+                }
+            }
+        }
+    }
+
+    double Evaluate(const Node &node)
+    {
+        m_Arguments.resize(node.Dependencies.size());
+        for (std::size_t i = 0; i < node.Dependencies.size(); i++)
+            m_Arguments[i] = m_Nodes[node.Dependencies[i]].Value;
+        return m_Evaluator.Evalute(node.Arena, node.Root, m_Arguments.data());
+    }
+
+    static bool SameBits(double a, double b)
+    {
+        return std::memcmp(&a, &b, sizeof(double)) == 0;
+    }
+
+    //按 Level 从小到大处理队列,保证公式运算时它的依赖都已是最新值
+    void Propagate()
+    {
+        while (!m_Queue.empty())
+        {
+            QueueEntry entry = m_Queue.top();
+            m_Queue.pop();
+            Node &node = m_Nodes[entry.Id];
+            if (!node.Queued || entry.Level != node.Level)
+                continue;
+            NodeId id = entry.Id;
+            node.Queued = false;
+            if (node.IsFormula)
+            {
+                double value = Evaluate(node);
+                m_Pending.Recomputed++;
+                if (SameBits(value, node.Value))
+                    continue;
+                node.Value = value;
+                m_Pending.Changed++;
+            }
+            EnqueueDependents(id);
+        }
+    }
+
+    void Commit()
+    {
+        if (m_UpdateDepth != 0)
+            return;
+        Propagate();
+        m_LastUpdate = m_Pending;
+        m_TotalRecomputed += m_Pending.Recomputed;
+        m_Pending = FormulaUpdateStats{};
+    }
+
+public:
+    explicit FormulaGraph(OperatorTable operators = OperatorTable())
+        : m_Parser(std::move(operators))
+    {
+    }
+
+    //定义或替换公式;公式中出现的未知名字登记为输入.会形成循环依赖时抛出 FormulaException,原有定义不变
+    void Define(std::string_view name, std::string_view text)
+    {
+        ASTArena arena;
+        VariableTable variables;
+        NodeIndex root = m_Parser.Parse(text.data(), text.size(), arena, variables);
+
+        //先检查循环再登记名字,被拒绝的定义不留下新的输入;尚不存在的名字没有依赖者,只可能是自身引用
+        NodeId existing = Lookup(name);
+        for (const std::string &variable : variables.Names())
+        {
+            NodeId dependency = variable == name ? existing : Lookup(variable);
+            if (variable == name || (existing != NoNode && dependency != NoNode && Reaches(existing, dependency)))
+                throw FormulaException("Formula '" + std::string(name) + "' would create a dependency cycle through '" + variable + "'");
+        }
+
+        NodeId id = Intern(name);
+        std::vector<NodeId> dependencies;
+        for (const std::string &variable : variables.Names())
+            dependencies.push_back(Intern(variable));
+
+        Unlink(id);
+        Node &node = m_Nodes[id];
+        node.IsFormula = true;
+        node.Arena = std::move(arena);
+        node.Root = root;
+        node.Dependencies = std::move(dependencies);
+        for (NodeId dependency : node.Dependencies)
+        {
+            m_Nodes[dependency].Dependents.push_back(id);
+            m_Nodes[id].Level = std::max(m_Nodes[id].Level, m_Nodes[dependency].Level + 1);
+        }
+        RaiseLevels(id);
+        Enqueue(id);
+        Commit();
+    }
+
+    //设置输入的值;name 原先是公式时改为输入
+    void SetInput(std::string_view name, double value)
+    {
+        NodeId id = Intern(name);
+        Node &node = m_Nodes[id];
+        if (node.IsFormula)
+            Unlink(id);
+        else if (SameBits(node.Value, value))
+        {
+            Commit();
+            return;
+        }
+        node.Value = value;
+        m_Pending.Inputs++;
+        EnqueueDependents(id);
+        Commit();
+    }
+
+    //BeginUpdate 与 EndUpdate 之间的 SetInput、Define 只记录变化,最外层的 EndUpdate 一次性传播
+    void BeginUpdate() noexcept
+    {
+        m_UpdateDepth++;
+    }
+
+    void EndUpdate()
+    {
+        if (m_UpdateDepth > 0 && --m_UpdateDepth == 0)
+            Commit();
+    }
+
+    //更新进行中(BeginUpdate 之后)读到的可能是旧值
+    double Value(std::string_view name) const
+    {
+        return m_Nodes[Find(name)].Value;
+    }
+
+    bool Contains(std::string_view name) const
+    {
+        return m_Names.find(std::string(name)) != m_Names.end();
+    }
+
+    bool IsFormula(std::string_view name) const
+    {
+        return m_Nodes[Find(name)].IsFormula;
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Nodes.size();
+    }
+
+    //最近一次完成的传播(单个 SetInput/Define 或一组 BeginUpdate/EndUpdate)的统计
+    const FormulaUpdateStats &LastUpdate() const noexcept
+    {
+        return m_LastUpdate;
+    }
+
+    std::uint64_t TotalRecomputed() const noexcept
+    {
+        return m_TotalRecomputed;
+    }
+};
+
+//在作用域内合并对 FormulaGraph 的修改
+class FormulaUpdate
+{
+    FormulaGraph &m_Graph;
+
+public:
+    explicit FormulaUpdate(FormulaGraph &graph)
+        : m_Graph(graph)
+    {
+        m_Graph.BeginUpdate();
+    }
+
+    FormulaUpdate(const FormulaUpdate &) = delete;
+    FormulaUpdate &operator=(const FormulaUpdate &) = delete;
+
+    ~FormulaUpdate()
+    {
+        m_Graph.EndUpdate();
+    }
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "textscan.hpp"
+
+using UnaryFunction = double (*)(double);
+using BinaryFunction = double (*)(double, double);
+
+struct FunctionInfo
+{
+    std::string Name;
+    int Arity = 0; //1 或 2
+    UnaryFunction Unary = nullptr;
+    BinaryFunction Binary = nullptr;
+};
+
+//进程内共享的函数表:编号按注册顺序分配且不再改变,语法树中以编号引用函数,编译为字节码时换成函数指针.
+//已注册的函数必须是纯函数(优化时会对常量参数直接求值).容量固定,条目发布后不再修改:
+//注册时加锁,按编号或名称查找都不加锁,可以与其它线程的解析、运算并发
+class FunctionRegistry
+{
+public:
+    static constexpr std::uint32_t Capacity = 256;
+    static constexpr std::uint32_t NoFunction = 0xFFFFFFFFu;
+
+private:
+    static constexpr std::uint32_t IndexSize = Capacity * 2; //装载率不超过 1/2,查找总能遇到空位
+
+    FunctionInfo m_Functions[Capacity];
+    std::atomic<std::uint32_t> m_Index[IndexSize] = {}; //编号 + 1,0 为空位
+    std::atomic<std::uint32_t> m_Count{0};
+    std::mutex m_Mutex;
+
+    FunctionRegistry()
+    {
+        Add("abs", [](double x) { return std::fabs(x); });
+        Add("sqrt", [](double x) { return std::sqrt(x); });
+        Add("exp", [](double x) { return std::exp(x); });
+        Add("log", [](double x) { return std::log(x); });
+        Add("min", [](double x, double y) { return std::fmin(x, y); });
+        Add("max", [](double x, double y) { return std::fmax(x, y); });
+        Add("pow", [](double x, double y) { return std::pow(x, y); });
+    }
+
+    static bool IsValidName(std::string_view name)
+    {
+        if (name.empty() || !IsIdentifierStart(name[0]))
+            return false;
+        for (char ch : name)
+        {
+            if (!IsIdentifierCharacter(ch))
+                return false;
+        }
+        return true;
+    }
+
+    std::uint32_t Register(std::string_view name, int arity, UnaryFunction unary, BinaryFunction binary)
+    {
+        if (!IsValidName(name) || (unary == nullptr && binary == nullptr))
+            throw std::invalid_argument("Invalid function definition");
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        std::uint32_t id = Find(name);
+        if (id != NoFunction)
+        {
+            const FunctionInfo &existing = m_Functions[id];
+            if (existing.Arity == arity && existing.Unary == unary && existing.Binary == binary)
+                return id;
+            throw std::invalid_argument("Function '" + std::string(name) + "' is already registered");
+        }
+        id = m_Count.load(std::memory_order_relaxed);
+        if (id == Capacity)
+            throw std::length_error("Too many functions registered!");
+
+        m_Functions[id] = FunctionInfo{std::string(name), arity, unary, binary};
+        std::uint32_t i = std::hash<std::string_view>{}(name) % IndexSize;
+        while (m_Index[i].load(std::memory_order_relaxed) != 0)
+            i = (i + 1) % IndexSize;
+        //先写好条目再发布编号,读者看到编号时条目已经完整
+        m_Index[i].store(id + 1, std::memory_order_release);
+        m_Count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+public:
+    FunctionRegistry(const FunctionRegistry &) = delete;
+    FunctionRegistry &operator=(const FunctionRegistry &) = delete;
+
+    static FunctionRegistry &Instance()
+    {
+        static FunctionRegistry registry;
+        return registry;
+    }
+
+    //注册函数并返回编号;同名同定义的重复注册返回原编号,同名不同定义时抛出 std::invalid_argument
+    std::uint32_t Add(std::string_view name, UnaryFunction function)
+    {
+        return Register(name, 1, function, nullptr);
+    }
+
+    std::uint32_t Add(std::string_view name, BinaryFunction function)
+    {
+        return Register(name, 2, nullptr, function);
+    }
+
+    //不存在时返回 NoFunction
+    std::uint32_t Find(std::string_view name) const noexcept
+    {
+        for (std::uint32_t i = std::hash<std::string_view>{}(name) % IndexSize;; i = (i + 1) % IndexSize)
+        {
+            std::uint32_t id = m_Index[i].load(std::memory_order_acquire);
+            if (id == 0)
+                return NoFunction;
+            if (m_Functions[id - 1].Name == name)
+                return id - 1;
+        }
+    }
+
+    const FunctionInfo &operator[](std::uint32_t id) const
+    {
+        return m_Functions[id];
+    }
+
+    std::uint32_t Size() const noexcept
+    {
+        return m_Count.load(std::memory_order_acquire);
+    }
+};
+
+inline FunctionRegistry &Functions()
+{
+    return FunctionRegistry::Instance();
+}
@@ -0,0 +1,552 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "parser.hpp"
+#include "bytecode.hpp"
+#include "mappedfile.hpp"
+
+//编译结果的二进制映像,按小端存储,所有位置都是相对映像起始的偏移,内存映射后不需要反序列化即可运行:
+//    ImageHeader                              各版本通用
+//    源文本区 Count x {u32 名字长度, u32 文本长度, 名字, 文本}   各版本通用,版本不符时据此重新解析
+//    数据区(版本 1,8 字节对齐):
+//        ImageEntry[Count]                    按添加顺序
+//        u32[Count]                           按名字排序的条目下标,用于二分查找
+//        ImageString[]                        各条目的变量名
+//        字符串与指令流
+//校验和(ImageChecksum)覆盖 ImageHeader 之后的全部字节
+enum ImageStatus
+{
+    ImageOk,
+    ImageTruncated,
+    ImageBadMagic,
+    ImageChecksumMismatch,
+    ImageVersionMismatch,
+    ImageCorrupt
+};
+
+inline const char *ImageStatusName(ImageStatus status)
+{
+    switch (status)
+    {
+    case ImageOk:
+        return "ok";
+    case ImageTruncated:
+        return "truncated image";
+    case ImageBadMagic:
+        return "not an expression image";
+    case ImageChecksumMismatch:
+        return "checksum mismatch";
+    case ImageVersionMismatch:
+        return "version mismatch";
+    case ImageCorrupt:
+        return "corrupt image";
+    }
+    return "unknown";
+}
+
+class ImageException : public std::runtime_error
+{
+    ImageStatus m_Status;
+
+public:
+    ImageException(ImageStatus status, const std::string &message)
+        : std::runtime_error(message), m_Status(status)
+    {
+    }
+
+    ImageStatus Status() const noexcept
+    {
+        return m_Status;
+    }
+};
+
+inline constexpr char ImageMagic[8] = {'E', 'X', 'P', 'R', 'I', 'M', 'G', '\0'};
+inline constexpr std::uint32_t ImageVersion = 1;
+
+struct ImageHeader
+{
+    char Magic[8];
+    std::uint32_t Version;
+    std::uint32_t Count;
+    std::uint64_t Checksum;
+    std::uint64_t Size;         //整个映像的字节数
+    std::uint64_t SourceOffset; //源文本区
+    std::uint64_t DataOffset;   //数据区,格式随版本变化
+};
+
+struct ImageString
+{
+    std::uint32_t Offset;
+    std::uint32_t Size;
+};
+
+struct ImageEntry
+{
+    ImageString Name;
+    ImageString Text;
+    ImageString Code;
+    std::uint32_t VariablesOffset; //VariableCount 个 ImageString
+    std::uint32_t VariableCount;
+    std::uint32_t MaxStackDepth;
+    std::uint32_t Reserved;
+};
+
+static_assert(sizeof(ImageHeader) == 48 && sizeof(ImageString) == 8 && sizeof(ImageEntry) == 40,
+              "image layout must not depend on the compiler");
+
+//按 8 字节字分四路做 FNV-1a 式的异或乘法,各路互不依赖,比逐字节快得多;末尾不足 32 字节的部分逐字节处理
+inline std::uint64_t ImageChecksum(const char *data, std::size_t size)
+{
+    const std::uint64_t prime = 0x100000001B3ull;
+    std::uint64_t lanes[4] = {0xCBF29CE484222325ull, 0x84222325CBF29CE4ull, 0x9E3779B97F4A7C15ull, 0x7F4A7C159E3779B9ull};
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, data + i + lane * 8, sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * prime;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+    std::uint64_t hash = lanes[0] ^ (lanes[1] * 3) ^ (lanes[2] * 5) ^ (lanes[3] * 7);
+    for (; i < size; i++)
+        hash = (hash ^ static_cast<std::uint8_t>(data[i])) * prime;
+    return hash ^ size;
+}
+
+//映像的只读视图,不拷贝任何数据;视图有效期间 data 必须保持有效
+class ExpressionImage
+{
+    const char *m_Data = nullptr;
+    ImageHeader m_Header{};
+
+    template <typename T>
+    T Read(std::uint64_t offset) const
+    {
+        T value;
+        std::memcpy(&value, m_Data + offset, sizeof(T));
+        return value;
+    }
+
+    ImageEntry Entry(std::size_t index) const
+    {
+        return Read<ImageEntry>(m_Header.DataOffset + index * sizeof(ImageEntry));
+    }
+
+    std::string_view String(ImageString string) const
+    {
+        return std::string_view(m_Data + string.Offset, string.Size);
+    }
+
+    bool Fits(std::uint64_t offset, std::uint64_t size) const
+    {
+        return offset <= m_Header.Size && size <= m_Header.Size - offset;
+    }
+
+    bool Fits(ImageString string) const
+    {
+        return Fits(string.Offset, string.Size);
+    }
+
+    //检查数据区中所有的偏移都在映像之内,指令流都能安全运行
+    bool Validate() const
+    {
+        std::uint64_t count = m_Header.Count;
+        if (m_Header.DataOffset % 8 != 0 || !Fits(m_Header.DataOffset, count * (sizeof(ImageEntry) + sizeof(std::uint32_t))))
+            return false;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            ImageEntry entry = Entry(i);
+            if (!Fits(entry.Name) || !Fits(entry.Text) || !Fits(entry.Code) ||
+                !Fits(entry.VariablesOffset, std::uint64_t(entry.VariableCount) * sizeof(ImageString)))
+                return false;
+            for (std::uint32_t slot = 0; slot < entry.VariableCount; slot++)
+            {
+                if (!Fits(Read<ImageString>(entry.VariablesOffset + slot * sizeof(ImageString))))
+                    return false;
+            }
+            if (!VerifyBytecode(Code(entry)))
+                return false;
+            if (Read<std::uint32_t>(m_Header.DataOffset + count * sizeof(ImageEntry) + i * sizeof(std::uint32_t)) >= count)
+                return false;
+        }
+        return true;
+    }
+
+    BytecodeView Code(const ImageEntry &entry) const
+    {
+        return BytecodeView(reinterpret_cast<const std::uint8_t *>(m_Data + entry.Code.Offset), entry.Code.Size,
+                            entry.MaxStackDepth, entry.VariableCount);
+    }
+
+    //只检查各版本通用的部分:文件头与校验和
+    static ImageStatus ReadHeader(const char *data, std::size_t size, ImageHeader &header)
+    {
+        if (size < sizeof(ImageHeader))
+            return ImageTruncated;
+        std::memcpy(&header, data, sizeof(ImageHeader));
+        if (std::memcmp(header.Magic, ImageMagic, sizeof(ImageMagic)) != 0)
+            return ImageBadMagic;
+        if (header.Size != size)
+            return ImageTruncated;
+        if (ImageChecksum(data + sizeof(ImageHeader), size - sizeof(ImageHeader)) != header.Checksum)
+            return ImageChecksumMismatch;
+        return ImageOk;
+    }
+
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    //检查文件头、校验和与版本,版本相符时再检查数据区;返回 ImageOk 以外的值时视图为空
+    ImageStatus Open(const char *data, std::size_t size)
+    {
+        m_Data = nullptr;
+        m_Header = ImageHeader{};
+        ImageHeader header;
+        ImageStatus status = ReadHeader(data, size, header);
+        if (status != ImageOk)
+            return status;
+        if (header.Version != ImageVersion)
+            return ImageVersionMismatch;
+        m_Data = data;
+        m_Header = header;
+        if (!Validate())
+        {
+            m_Data = nullptr;
+            m_Header = ImageHeader{};
+            return ImageCorrupt;
+        }
+        return ImageOk;
+    }
+
+    //逐条读出源文本区,不依赖数据区的格式;用于版本不符时重新解析
+    template <typename Visit>
+    static ImageStatus ReadSources(const char *data, std::size_t size, Visit visit)
+    {
+        ImageHeader header;
+        ImageStatus status = ReadHeader(data, size, header);
+        if (status != ImageOk)
+            return status;
+        std::uint64_t offset = header.SourceOffset;
+        for (std::uint32_t i = 0; i < header.Count; i++)
+        {
+            std::uint32_t sizes[2];
+            if (offset > size || size - offset < sizeof(sizes))
+                return ImageCorrupt;
+            std::memcpy(sizes, data + offset, sizeof(sizes));
+            offset += sizeof(sizes);
+            if (size - offset < std::uint64_t(sizes[0]) + sizes[1])
+                return ImageCorrupt;
+            visit(std::string_view(data + offset, sizes[0]), std::string_view(data + offset + sizes[0], sizes[1]));
+            offset += std::uint64_t(sizes[0]) + sizes[1];
+        }
+        return ImageOk;
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Header.Count;
+    }
+
+    std::string_view Name(std::size_t index) const
+    {
+        return String(Entry(index).Name);
+    }
+
+    std::string_view Text(std::size_t index) const
+    {
+        return String(Entry(index).Text);
+    }
+
+    BytecodeView Code(std::size_t index) const
+    {
+        return Code(Entry(index));
+    }
+
+    std::size_t VariableCount(std::size_t index) const
+    {
+        return Entry(index).VariableCount;
+    }
+
+    std::string_view Variable(std::size_t index, std::uint32_t slot) const
+    {
+        return String(Read<ImageString>(Entry(index).VariablesOffset + slot * sizeof(ImageString)));
+    }
+
+    //按名字二分查找,找不到时返回 npos
+    std::size_t Find(std::string_view name) const
+    {
+        std::uint64_t sorted = m_Header.DataOffset + std::uint64_t(m_Header.Count) * sizeof(ImageEntry);
+        std::size_t low = 0;
+        std::size_t high = m_Header.Count;
+        while (low < high)
+        {
+            std::size_t middle = low + (high - low) / 2;
+            std::uint32_t index = Read<std::uint32_t>(sorted + middle * sizeof(std::uint32_t));
+            int order = Name(index).compare(name);
+            if (order == 0)
+                return index;
+            if (order < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return npos;
+    }
+};
+
+//解析、编译具名表达式并生成映像;名字应当唯一,重复时 Find 返回其中任意一个
+class ExpressionImageWriter
+{
+    struct Item
+    {
+        std::string Name;
+        std::string Text;
+        Bytecode Code;
+        std::vector<std::string> Variables;
+    };
+
+    std::vector<Item> m_Items;
+    Parser m_Parser;
+    Compiler m_Compiler;
+    ASTArena m_Arena;
+    VariableTable m_Variables;
+
+    static void Append(std::vector<char> &image, const void *data, std::size_t size)
+    {
+        image.insert(image.end(), static_cast<const char *>(data), static_cast<const char *>(data) + size);
+    }
+
+    static ImageString Place(std::vector<char> &image, std::string_view text)
+    {
+        ImageString string{static_cast<std::uint32_t>(image.size()), static_cast<std::uint32_t>(text.size())};
+        Append(image, text.data(), text.size());
+        return string;
+    }
+
+    template <typename T>
+    static void Store(std::vector<char> &image, std::size_t offset, const T &value)
+    {
+        std::memcpy(image.data() + offset, &value, sizeof(T));
+    }
+
+public:
+    explicit ExpressionImageWriter(OperatorTable operators = OperatorTable())
+        : m_Parser(std::move(operators))
+    {
+    }
+
+    //语法错误时抛出 ParserException,不添加该条目;
+    //字节码中的函数调用是本进程内的函数指针,不能写入映像,含函数调用的表达式抛出 CompilerException
+    void Add(std::string_view name, std::string_view text)
+    {
+        m_Arena.Reset();
+        m_Variables.Reset();
+        NodeIndex root = m_Parser.Parse(text.data(), text.size(), m_Arena, m_Variables);
+        for (std::size_t i = 0; i < m_Arena.Size(); i++)
+        {
+            if (m_Arena[NodeIndex(i)].Type == FunctionCall)
+                throw CompilerException("Function calls cannot be stored in an expression image");
+        }
+        Item item{std::string(name), std::string(text), m_Compiler.Compile(m_Arena, root), m_Variables.Names()};
+        m_Items.push_back(std::move(item));
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Items.size();
+    }
+
+    std::vector<char> Build() const
+    {
+        std::vector<char> image(sizeof(ImageHeader));
+        ImageHeader header{};
+        std::memcpy(header.Magic, ImageMagic, sizeof(ImageMagic));
+        header.Version = ImageVersion;
+        header.Count = static_cast<std::uint32_t>(m_Items.size());
+
+        std::vector<ImageEntry> entries(m_Items.size());
+        header.SourceOffset = image.size();
+        for (std::size_t i = 0; i < m_Items.size(); i++)
+        {
+            const Item &item = m_Items[i];
+            std::uint32_t sizes[2] = {static_cast<std::uint32_t>(item.Name.size()), static_cast<std::uint32_t>(item.Text.size())};
+            Append(image, sizes, sizeof(sizes));
+            entries[i].Name = Place(image, item.Name);
+            entries[i].Text = Place(image, item.Text);
+        }
+
+        image.resize((image.size() + 7) & ~std::size_t(7));
+        header.DataOffset = image.size();
+        std::size_t entriesOffset = image.size();
+        image.resize(image.size() + entries.size() * sizeof(ImageEntry));
+
+        std::vector<std::uint32_t> sorted(m_Items.size());
+        for (std::size_t i = 0; i < sorted.size(); i++)
+            sorted[i] = static_cast<std::uint32_t>(i);
+        std::stable_sort(sorted.begin(), sorted.end(), [&](std::uint32_t a, std::uint32_t b) {
+            return m_Items[a].Name < m_Items[b].Name;
+        });
+        Append(image, sorted.data(), sorted.size() * sizeof(std::uint32_t));
+
+        for (std::size_t i = 0; i < m_Items.size(); i++)
+        {
+            const Item &item = m_Items[i];
+            ImageEntry &entry = entries[i];
+            entry.VariablesOffset = static_cast<std::uint32_t>(image.size());
+            entry.VariableCount = static_cast<std::uint32_t>(item.Variables.size());
+            entry.MaxStackDepth = item.Code.MaxStackDepth;
+            image.resize(image.size() + item.Variables.size() * sizeof(ImageString));
+            for (std::size_t slot = 0; slot < item.Variables.size(); slot++)
+                Store(image, entry.VariablesOffset + slot * sizeof(ImageString), Place(image, item.Variables[slot]));
+            entry.Code = Place(image, std::string_view(reinterpret_cast<const char *>(item.Code.Code.data()), item.Code.Code.size()));
+        }
+        if (image.size() > UINT32_MAX)
+            throw ImageException(ImageCorrupt, "Expression image exceeds 4 GB");
+
+        for (std::size_t i = 0; i < entries.size(); i++)
+            Store(image, entriesOffset + i * sizeof(ImageEntry), entries[i]);
+        header.Size = image.size();
+        header.Checksum = ImageChecksum(image.data() + sizeof(ImageHeader), image.size() - sizeof(ImageHeader));
+        Store(image, 0, header);
+        return image;
+    }
+
+    //失败时抛出 std::runtime_error
+    void Write(const std::string &path) const
+    {
+        std::vector<char> image = Build();
+        std::FILE *file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+            throw std::runtime_error("Cannot open file '" + path + "'");
+        bool ok = std::fwrite(image.data(), 1, image.size(), file) == image.size();
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok)
+            throw std::runtime_error("Cannot write file '" + path + "'");
+    }
+};
+
+//从映像加载表达式:版本相符时直接在映射的文件上运行;版本不符时按源文本区重新解析编译.
+//重新解析使用构造时的运算符表,应与写入映像时相同
+class ExpressionLibrary
+{
+    MappedFile m_File;
+    ExpressionImage m_Image;
+    bool m_Reparsed = false;
+    Parser m_Parser;
+
+    //重新解析得到的条目
+    struct Item
+    {
+        std::string_view Name;
+        std::string_view Text;
+        Bytecode Code;
+        std::vector<std::string> Variables;
+    };
+    std::vector<Item> m_Items;
+    std::unordered_map<std::string_view, std::size_t> m_Index;
+
+    //源文本无法解析时抛出 ParserException;全部条目都成功之后才替换 m_Items 并置 m_Reparsed
+    ImageStatus Reparse()
+    {
+        ASTArena arena;
+        VariableTable variables;
+        Compiler compiler;
+        std::vector<Item> items;
+        std::unordered_map<std::string_view, std::size_t> index;
+        ImageStatus status = ExpressionImage::ReadSources(m_File.Data(), m_File.Size(), [&](std::string_view name, std::string_view text) {
+            arena.Reset();
+            variables.Reset();
+            NodeIndex root = m_Parser.Parse(text.data(), text.size(), arena, variables);
+            items.push_back(Item{name, text, compiler.Compile(arena, root), variables.Names()});
+            index.emplace(name, items.size() - 1);
+        });
+        if (status == ImageOk)
+        {
+            m_Items = std::move(items);
+            m_Index = std::move(index);
+            m_Reparsed = true;
+        }
+        return status;
+    }
+
+public:
+    static constexpr std::size_t npos = ExpressionImage::npos;
+
+    explicit ExpressionLibrary(OperatorTable operators = OperatorTable())
+        : m_Parser(std::move(operators))
+    {
+    }
+
+    //映像损坏时抛出 ImageException,文件无法打开时抛出 std::runtime_error,重新解析失败时抛出 ParserException
+    void Load(const std::string &path)
+    {
+        m_Items.clear();
+        m_Index.clear();
+        m_Reparsed = false;
+        m_File.Open(path);
+        ImageStatus status = m_Image.Open(m_File.Data(), m_File.Size());
+        if (status == ImageVersionMismatch)
+            status = Reparse();
+        if (status != ImageOk)
+            throw ImageException(status, "Cannot load '" + path + "': " + ImageStatusName(status));
+    }
+
+    //最近一次 Load 是否因版本不符而重新解析
+    bool Reparsed() const noexcept
+    {
+        return m_Reparsed;
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Reparsed ? m_Items.size() : m_Image.Size();
+    }
+
+    std::string_view Name(std::size_t index) const
+    {
+        return m_Reparsed ? m_Items[index].Name : m_Image.Name(index);
+    }
+
+    std::string_view Text(std::size_t index) const
+    {
+        return m_Reparsed ? m_Items[index].Text : m_Image.Text(index);
+    }
+
+    BytecodeView Code(std::size_t index) const
+    {
+        return m_Reparsed ? BytecodeView(m_Items[index].Code) : m_Image.Code(index);
+    }
+
+    std::size_t VariableCount(std::size_t index) const
+    {
+        return m_Reparsed ? m_Items[index].Variables.size() : m_Image.VariableCount(index);
+    }
+
+    std::string_view Variable(std::size_t index, std::uint32_t slot) const
+    {
+        return m_Reparsed ? std::string_view(m_Items[index].Variables[slot]) : m_Image.Variable(index, slot);
+    }
+
+    std::size_t Find(std::string_view name) const
+    {
+        if (!m_Reparsed)
+            return m_Image.Find(name);
+        auto it = m_Index.find(name);
+        return it == m_Index.end() ? npos : it->second;
+    }
+};
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "evaluator.hpp"
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(_WIN32) || defined(__linux__) || defined(__APPLE__) || defined(__unix__))
+#define EXPRESSION_JIT 1
+#else
+#define EXPRESSION_JIT 0
+#endif
+
+#if EXPRESSION_JIT
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+using JitFunction = double (*)(const double *variables);
+
+//只读可执行的内存页,写入代码后即不可修改
+class ExecutableMemory
+{
+    void *m_Data = nullptr;
+    std::size_t m_Size = 0;
+
+    void Release() noexcept
+    {
+#if EXPRESSION_JIT
+        if (m_Data == nullptr)
+            return;
+#if defined(_WIN32)
+        VirtualFree(m_Data, 0, MEM_RELEASE);
+#else
+        munmap(m_Data, m_Size);
+#endif
+#endif
+        m_Data = nullptr;
+        m_Size = 0;
+    }
+
+public:
+    ExecutableMemory() = default;
+    ExecutableMemory(const ExecutableMemory &) = delete;
+    ExecutableMemory &operator=(const ExecutableMemory &) = delete;
+
+    ExecutableMemory(ExecutableMemory &&other) noexcept
+        : m_Data(std::exchange(other.m_Data, nullptr)),
+          m_Size(std::exchange(other.m_Size, 0))
+    {
+    }
+
+    ExecutableMemory &operator=(ExecutableMemory &&other) noexcept
+    {
+        if (this != &other)
+        {
+            Release();
+            m_Data = std::exchange(other.m_Data, nullptr);
+            m_Size = std::exchange(other.m_Size, 0);
+        }
+        return *this;
+    }
+
+    ~ExecutableMemory()
+    {
+        Release();
+    }
+
+    //失败(平台不支持或系统禁止可执行内存)时返回 false
+    bool Assign(const std::uint8_t *code, std::size_t size)
+    {
+        Release();
+#if EXPRESSION_JIT
+#if defined(_WIN32)
+        void *data = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (data == nullptr)
+            return false;
+        std::memcpy(data, code, size);
+        DWORD previous = 0;
+        if (!VirtualProtect(data, size, PAGE_EXECUTE_READ, &previous))
+        {
+            VirtualFree(data, 0, MEM_RELEASE);
+            return false;
+        }
+        FlushInstructionCache(GetCurrentProcess(), data, size);
+#else
+        void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+            return false;
+        std::memcpy(data, code, size);
+        if (mprotect(data, size, PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(data, size);
+            return false;
+        }
+#endif
+        m_Data = data;
+        m_Size = size;
+        return true;
+#else
+        (void)code;
+        (void)size;
+        return false;
+#endif
+    }
+
+    const void *Data() const noexcept
+    {
+        return m_Data;
+    }
+};
+
+//将抽象语法树编译为 x86-64 SSE2 机器码:子树结果放在 xmm0,
+//右子树不是叶子节点时左子树的结果暂存在栈上
+class JitCompiler
+{
+    std::vector<std::uint8_t> m_Code;
+    const ASTArena *m_Arena = nullptr;
+    std::vector<NodeIndex> m_Spine; //正在处理的左链上的节点
+
+    //右子树的最大嵌套层数,每层在生成的代码中占用 8 字节栈空间
+    static constexpr std::size_t MaxDepth = 4096;
+
+#if defined(_WIN32)
+    static constexpr std::uint8_t VariablesRegister = 1; //rcx
+#else
+    static constexpr std::uint8_t VariablesRegister = 7; //rdi
+#endif
+
+    void Emit(std::initializer_list<std::uint8_t> bytes)
+    {
+        m_Code.insert(m_Code.end(), bytes);
+    }
+
+    template <typename T>
+    void EmitImmediate(T value)
+    {
+        std::uint8_t bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        m_Code.insert(m_Code.end(), bytes, bytes + sizeof(T));
+    }
+
+    //movabs rax, imm64; movq xmm, rax
+    void EmitLoadConstant(std::uint8_t xmm, double value)
+    {
+        Emit({0x48, 0xB8});
+        EmitImmediate(value);
+        Emit({0x66, 0x48, 0x0F, 0x6E, static_cast<std::uint8_t>(0xC0 | (xmm << 3))});
+    }
+
+    //movsd xmm, [variables + slot * 8]
+    void EmitLoadVariable(std::uint8_t xmm, std::uint32_t slot)
+    {
+        if (slot >= (1u << 28))
+            throw CompilerException("Too many variables for JIT!");
+        Emit({0xF2, 0x0F, 0x10, static_cast<std::uint8_t>(0x80 | (xmm << 3) | VariablesRegister)});
+        EmitImmediate(static_cast<std::int32_t>(slot * sizeof(double)));
+    }
+
+    bool IsLeaf(const ASTNode &node) const
+    {
+        return node.Type == NumberValue || node.Type == VariableValue;
+    }
+
+    void EmitLeaf(std::uint8_t xmm, const ASTNode &node)
+    {
+        if (node.Type == NumberValue)
+            EmitLoadConstant(xmm, node.Value);
+        else
+            EmitLoadVariable(xmm, node.Slot);
+    }
+
+    const ASTNode &Node(NodeIndex index) const
+    {
+        if (!m_Arena->Contains(index))
+            throw CompilerException("Incorrect syntax tree!");
+        return (*m_Arena)[index];
+    }
+
+    static std::uint8_t SseOpcode(ASTNodeType type)
+    {
+        switch (type)
+        {
+        case OperatorPlus:
+            return 0x58;
+        case OperatorMinus:
+            return 0x5C;
+        case OperatorMul:
+            return 0x59;
+        case OperatorDiv:
+            return 0x5E;
+        default:
+            return 0;
+        }
+    }
+
+    //沿左子树下行时不递归,很长的左结合链(例如 1+2+...+n)不会加深调用栈,只有右子树递归;
+    //遇到不支持的运算(乘方、取模、比较、函数调用)或右子树嵌套过深时返回 false,由调用者退回到 Evaluator
+    bool CompileSubtree(NodeIndex index, std::size_t depth)
+    {
+        if (depth > MaxDepth)
+            return false;
+
+        std::size_t spine = m_Spine.size();
+        const ASTNode *node = &Node(index);
+        while (!IsLeaf(*node))
+        {
+            if (node->Type != UnaryMinus && SseOpcode(node->Type) == 0)
+            {
+                if (IsBinaryOperator(node->Type) || node->Type == FunctionCall)
+                    return false;
+                throw CompilerException("Incorrect syntax tree!");
+            }
+            m_Spine.push_back(index);
+            index = node->Left;
+            node = &Node(index);
+        }
+        EmitLeaf(0, *node);
+
+        for (std::size_t i = m_Spine.size(); i-- > spine;)
+        {
+            const ASTNode &ast = Node(m_Spine[i]);
+            if (ast.Type == UnaryMinus)
+            {
+                EmitLoadConstant(1, -0.0);
+                Emit({0x66, 0x0F, 0x57, 0xC1}); //xorpd xmm0, xmm1
+                continue;
+            }
+
+            const ASTNode &right = Node(ast.Right);
+            if (IsLeaf(right))
+            {
+                EmitLeaf(1, right);
+            }
+            else
+            {
+                Emit({0x48, 0x83, 0xEC, 0x08});       //sub rsp, 8
+                Emit({0xF2, 0x0F, 0x11, 0x04, 0x24}); //movsd [rsp], xmm0
+                if (!CompileSubtree(ast.Right, depth + 1))
+                    return false;
+                Emit({0x66, 0x0F, 0x28, 0xC8});       //movapd xmm1, xmm0
+                Emit({0xF2, 0x0F, 0x10, 0x04, 0x24}); //movsd xmm0, [rsp]
+                Emit({0x48, 0x83, 0xC4, 0x08});       //add rsp, 8
+            }
+            Emit({0xF2, 0x0F, SseOpcode(ast.Type), 0xC1}); //op xmm0, xmm1
+        }
+        m_Spine.resize(spine);
+        return true;
+    }
+
+public:
+    static constexpr bool Available() noexcept
+    {
+        return EXPRESSION_JIT != 0;
+    }
+
+    //生成失败时返回 false,memory 保持为空
+    bool Compile(const ASTArena &arena, NodeIndex root, ExecutableMemory &memory)
+    {
+        if (!Available())
+            return false;
+        if (!arena.Contains(root))
+            throw CompilerException("Incorrect abstract syntax tree");
+
+        m_Arena = &arena;
+        m_Code.clear();
+        m_Spine.clear();
+        if (!CompileSubtree(root, 0))
+            return false;
+        Emit({0xC3}); //ret
+        return memory.Assign(m_Code.data(), m_Code.size());
+    }
+
+    std::size_t CodeSize() const noexcept
+    {
+        return m_Code.size();
+    }
+};
+
+//优先使用 JIT 生成的机器码,不可用时退回到 Evaluator
+class JitExpression
+{
+    ASTArena m_Arena;
+    NodeIndex m_Root = InvalidNode;
+    ExecutableMemory m_Memory;
+    JitFunction m_Function = nullptr;
+    bool m_HasVariables = false;
+
+public:
+    JitExpression(const ASTArena &arena, NodeIndex root)
+    {
+        m_Root = CopySubtree(arena, root, m_Arena);
+        if (m_Root == InvalidNode)
+            throw CompilerException("Incorrect abstract syntax tree");
+        //m_Arena 中只有 root 可达的节点
+        for (NodeIndex i = 0; i < m_Arena.Size(); i++)
+            m_HasVariables = m_HasVariables || m_Arena[i].Type == VariableValue;
+
+        JitCompiler compiler;
+        if (compiler.Compile(m_Arena, m_Root, m_Memory))
+            m_Function = reinterpret_cast<JitFunction>(const_cast<void *>(m_Memory.Data()));
+    }
+
+    bool IsNative() const noexcept
+    {
+        return m_Function != nullptr;
+    }
+
+    //JIT 不可用时为 nullptr
+    JitFunction Function() const noexcept
+    {
+        return m_Function;
+    }
+
+    //含变量而 variables 为 nullptr 时与 Evaluator 一样抛出 EvaluatorException,机器码不做检查
+    double operator()(const double *variables = nullptr) const
+    {
+        if (m_HasVariables && variables == nullptr)
+            throw EvaluatorException("Variable values not provided!");
+        if (m_Function != nullptr)
+            return m_Function(variables);
+        return Evaluator{}.Evalute(m_Arena, m_Root, variables);
+    }
+};
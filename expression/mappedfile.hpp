@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//以只读方式将整个文件映射到内存,空文件时 Data() 为 nullptr
+class MappedFile
+{
+    const char *m_Data = nullptr;
+    std::size_t m_Size = 0;
+#if defined(_WIN32)
+    HANDLE m_File = INVALID_HANDLE_VALUE;
+    HANDLE m_Mapping = nullptr;
+#endif
+
+    void Close() noexcept
+    {
+#if defined(_WIN32)
+        if (m_Data != nullptr)
+            UnmapViewOfFile(m_Data);
+        if (m_Mapping != nullptr)
+            CloseHandle(m_Mapping);
+        if (m_File != INVALID_HANDLE_VALUE)
+            CloseHandle(m_File);
+        m_Mapping = nullptr;
+        m_File = INVALID_HANDLE_VALUE;
+#else
+        if (m_Data != nullptr)
+            munmap(const_cast<char *>(m_Data), m_Size);
+#endif
+        m_Data = nullptr;
+        m_Size = 0;
+    }
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    explicit MappedFile(const std::string &path)
+    {
+        Open(path);
+    }
+
+    MappedFile(MappedFile &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    MappedFile &operator=(MappedFile &&other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            m_Data = std::exchange(other.m_Data, nullptr);
+            m_Size = std::exchange(other.m_Size, 0);
+#if defined(_WIN32)
+            m_File = std::exchange(other.m_File, INVALID_HANDLE_VALUE);
+            m_Mapping = std::exchange(other.m_Mapping, nullptr);
+#endif
+        }
+        return *this;
+    }
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    //失败时抛出 std::runtime_error
+    void Open(const std::string &path)
+    {
+        Close();
+#if defined(_WIN32)
+        m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_File == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Cannot open file '" + path + "'");
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_File, &size))
+        {
+            Close();
+            throw std::runtime_error("Cannot get size of file '" + path + "'");
+        }
+        if (size.QuadPart == 0)
+            return;
+        m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const void *data = m_Mapping ? MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (data == nullptr)
+        {
+            Close();
+            throw std::runtime_error("Cannot map file '" + path + "'");
+        }
+        m_Data = static_cast<const char *>(data);
+        m_Size = static_cast<std::size_t>(size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open file '" + path + "'");
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Cannot get size of file '" + path + "'");
+        }
+        std::size_t size = static_cast<std::size_t>(info.st_size);
+        if (size == 0)
+        {
+            ::close(fd);
+            return;
+        }
+        void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Cannot map file '" + path + "'");
+        madvise(data, size, MADV_SEQUENTIAL);
+        m_Data = static_cast<const char *>(data);
+        m_Size = size;
+#endif
+    }
+
+    const char *Data() const noexcept
+    {
+        return m_Data;
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Size;
+    }
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <system_error>
+
+#include "textscan.hpp"
+
+//数值字面量的扫描结果;Ok 为 false 时 End 等于起始位置
+struct NumberScanResult
+{
+    const char *End = nullptr;
+    double Value = 0;
+    bool Ok = false;
+};
+
+inline bool IsDecimalDigit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+inline int HexDigitValue(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F')
+        return ch - 'A' + 10;
+    return -1;
+}
+
+//可以精确表示为 double 的 10 的幂
+inline constexpr double ExactPowersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                             1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+//把 8 个 ASCII 数字转换为整数(SWAR):相邻数位两两合并为 2 位、4 位,最后合并为 8 位;按字节组装,与主机字节序无关
+inline std::uint32_t ParseEightDigits(const char *p)
+{
+    std::uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value |= std::uint64_t(static_cast<unsigned char>(p[i])) << (8 * i);
+    value -= 0x3030303030303030ull;
+    value = value * 10 + (value >> 8);
+    value = ((value & 0x000000FF000000FFull) * (100 + (1000000ull << 32)) +
+             ((value >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32))) >> 32;
+    return static_cast<std::uint32_t>(value);
+}
+
+//把 [p, p + count) 中的数字依次累积到 mantissa 上,调用者保证结果不溢出
+inline std::uint64_t AccumulateDigits(std::uint64_t mantissa, const char *p, std::size_t count)
+{
+    for (; count >= 8; count -= 8, p += 8)
+        mantissa = mantissa * 100000000 + ParseEightDigits(p);
+    for (; count != 0; count--, p++)
+        mantissa = mantissa * 10 + (*p - '0');
+    return mantissa;
+}
+
+//p 指向 e 或 p,解析其后 [+-]digits 形式的指数,没有数字时不消耗任何字符;
+//绝对值过大时截断,结果仍然溢出为无穷或下溢为 0
+inline const char *ScanExponent(const char *p, const char *end, int &exponent)
+{
+    const char *q = p + 1;
+    bool negative = false;
+    if (q != end && (*q == '+' || *q == '-'))
+        negative = *q++ == '-';
+    if (q == end || !IsDecimalDigit(*q))
+        return p;
+    int value = 0;
+    for (; q != end && IsDecimalDigit(*q); q++)
+    {
+        if (value < 100000)
+            value = value * 10 + (*q - '0');
+    }
+    exponent = negative ? -value : value;
+    return q;
+}
+
+//0x 之后的十六进制浮点数:hexdigits [. hexdigits] [p [+-] digits]
+inline NumberScanResult ScanHexNumber(const char *begin, const char *digits, const char *end)
+{
+    std::uint64_t mantissa = 0;
+    int significant = 0;
+    const char *p = digits;
+    for (; p != end && HexDigitValue(*p) >= 0; p++)
+    {
+        if (mantissa != 0 || *p != '0')
+        {
+            mantissa = (mantissa << 4) | HexDigitValue(*p);
+            significant++;
+        }
+    }
+    bool any = p != digits;
+    int fraction = 0;
+    if (p != end && *p == '.')
+    {
+        const char *q = p + 1;
+        for (; q != end && HexDigitValue(*q) >= 0; q++)
+        {
+            if (mantissa != 0 || *q != '0')
+            {
+                mantissa = (mantissa << 4) | HexDigitValue(*q);
+                significant++;
+            }
+            fraction++;
+        }
+        if (any || q != p + 1)
+        {
+            any = true;
+            p = q;
+        }
+    }
+    //0x 后没有数字时与 strtod 一致,只取前面的 0
+    if (!any)
+        return NumberScanResult{begin + 1, 0, true};
+
+    int exponent = 0;
+    if (p != end && (*p == 'p' || *p == 'P'))
+        p = ScanExponent(p, end, exponent);
+
+    NumberScanResult result{p, 0, true};
+    int scale = exponent - 4 * fraction;
+    //13 位以内的十六进制尾数不超过 52 位,可以精确转换,ldexp 只舍入一次
+    if (significant <= 13)
+    {
+        result.Value = std::ldexp(double(mantissa), scale);
+        return result;
+    }
+    if (std::from_chars(digits, p, result.Value, std::chars_format::hex).ec == std::errc::result_out_of_range)
+        result.Value = 4 * significant + scale > 0 ? std::numeric_limits<double>::infinity() : 0.0;
+    return result;
+}
+
+//在 [begin, end) 上原地扫描一个非负数值字面量,不拷贝、不受 locale 影响,结果正确舍入:
+//    digits [. digits] [(e|E) [+-] digits]
+//    (0x|0X) hexdigits [. hexdigits] [(p|P) [+-] digits]
+//与 strtod 一致,指数部分没有数字时不属于该字面量;不以数字开头时返回 Ok 为 false
+inline NumberScanResult ScanNumber(const char *begin, const char *end)
+{
+    const char *p = begin;
+    if (p == end || !(IsDecimalDigit(*p) || (*p == '.' && p + 1 != end && IsDecimalDigit(p[1]))))
+        return NumberScanResult{begin, 0, false};
+
+    if (*p == '0' && p + 1 != end && (p[1] == 'x' || p[1] == 'X'))
+        return ScanHexNumber(begin, p + 2, end);
+
+    //先找出整段数字,再一次累积最多 19 位有效数字,超出部分只计数
+    std::uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    const char *digitsEnd = SkipDigits(p, end);
+    while (p != digitsEnd && *p == '0')
+        p++;
+    std::size_t count = digitsEnd - p;
+    std::size_t taken = count < 19 ? count : 19;
+    mantissa = AccumulateDigits(mantissa, p, taken);
+    significant = static_cast<int>(count);
+    exponent = static_cast<int>(count - taken);
+    p = digitsEnd;
+    if (p != end && *p == '.')
+    {
+        digitsEnd = SkipDigits(++p, end);
+        if (mantissa == 0)
+        {
+            const char *first = p;
+            while (p != digitsEnd && *p == '0')
+                p++;
+            exponent -= static_cast<int>(p - first);
+        }
+        count = digitsEnd - p;
+        taken = significant >= 19 ? 0 : (count < std::size_t(19 - significant) ? count : 19 - significant);
+        mantissa = AccumulateDigits(mantissa, p, taken);
+        exponent -= static_cast<int>(taken);
+        significant += static_cast<int>(count);
+        p = digitsEnd;
+    }
+
+    int explicitExponent = 0;
+    if (p != end && (*p == 'e' || *p == 'E'))
+        p = ScanExponent(p, end, explicitExponent);
+    exponent += explicitExponent;
+
+    NumberScanResult result{p, 0, true};
+    if (mantissa == 0)
+        return result;
+
+    //Clinger 快速路径:尾数不超过 2^53 且 10 的幂可以精确表示时,一次乘除即为正确舍入的结果
+    if (significant <= 19 && mantissa <= (std::uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+    {
+        double value = double(mantissa);
+        result.Value = exponent < 0 ? value / ExactPowersOf10[-exponent] : value * ExactPowersOf10[exponent];
+        return result;
+    }
+
+    //其余情况交给正确舍入的 std::from_chars;溢出与下溢时按数量级给出无穷或 0,与 strtod 一致
+    if (std::from_chars(begin, p, result.Value).ec == std::errc::result_out_of_range)
+    {
+        int magnitude = (significant < 19 ? significant : 19) + exponent;
+        result.Value = magnitude > 0 ? std::numeric_limits<double>::infinity() : 0.0;
+    }
+    return result;
+}
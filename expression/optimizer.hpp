@@ -0,0 +1,326 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+
+struct OptimizerOptions
+{
+    //为 true 时只做与未优化结果逐位一致的变换(-0.0、NaN、无穷的行为不变);
+    //为 false 时允许 x+0 => x、0-x => -x、x*0 => 0 等忽略这些特殊值的化简
+    bool StrictIEEE = true;
+};
+
+//Nodes 为可达的不同节点数,Steps 为逐节点运算时需要访问的节点次数
+struct TreeMeasure
+{
+    std::size_t Nodes = 0;
+    std::size_t Steps = 0;
+};
+
+struct OptimizerStats
+{
+    TreeMeasure Before;
+    TreeMeasure After;
+    std::size_t Folded = 0;     //折叠的常量子树
+    std::size_t Simplified = 0; //消除的单位元及其它代数化简
+};
+
+inline TreeMeasure MeasureTree(const ASTArena &arena, NodeIndex root)
+{
+    TreeMeasure result;
+    std::vector<bool> visited(arena.Size(), false);
+    std::vector<NodeIndex> pending;
+    if (arena.Contains(root))
+        pending.push_back(root);
+    while (!pending.empty())
+    {
+        NodeIndex index = pending.back();
+        pending.pop_back();
+        result.Steps++;
+        if (!visited[index])
+        {
+            visited[index] = true;
+            result.Nodes++;
+        }
+        const ASTNode &node = arena[index];
+        if (arena.Contains(node.Left))
+            pending.push_back(node.Left);
+        if (arena.Contains(node.Right))
+            pending.push_back(node.Right);
+    }
+    return result;
+}
+
+class Optimizer
+{
+    OptimizerOptions m_Options;
+    OptimizerStats m_Stats;
+    const ASTArena *m_Source = nullptr;
+    ASTArena *m_Target = nullptr;
+    ASTArena m_Scratch; //化简过程中被丢弃的节点留在这里,最后只把可达部分复制到目标
+
+    struct Frame
+    {
+        NodeIndex Index;
+        bool Expanded;
+    };
+    std::vector<Frame> m_Pending;
+    std::vector<NodeIndex> m_Results;
+
+    const ASTNode &Node(NodeIndex index) const
+    {
+        return (*m_Target)[index];
+    }
+
+    bool IsNumber(NodeIndex index) const
+    {
+        return Node(index).Type == NumberValue;
+    }
+
+    bool IsNumber(NodeIndex index, double value) const
+    {
+        return IsNumber(index) && Node(index).Value == value &&
+               std::signbit(Node(index).Value) == std::signbit(value);
+    }
+
+    bool IsPositiveZero(NodeIndex index) const
+    {
+        return IsNumber(index, 0.0);
+    }
+
+    bool IsNegativeZero(NodeIndex index) const
+    {
+        return IsNumber(index, -0.0);
+    }
+
+    bool IsZeroMinus(NodeIndex index) const
+    {
+        return Node(index).Type == OperatorMinus && IsPositiveZero(Node(index).Left);
+    }
+
+    //2 的整数次幂且倒数可精确表示时 x / c 与 x * (1 / c) 逐位相同
+    bool HasExactReciprocal(NodeIndex index) const
+    {
+        if (!IsNumber(index))
+            return false;
+        int exponent = 0;
+        double mantissa = std::frexp(Node(index).Value, &exponent);
+        return std::fabs(mantissa) == 0.5 && exponent > -1021 && exponent < 1023;
+    }
+
+    //保守判断子树结果是否可能为 -0.0;只向下检查有限的层数,超出时视为可能
+    bool MayBeNegativeZero(NodeIndex index, int depth = 32) const
+    {
+        const ASTNode &node = Node(index);
+        if (depth == 0)
+            return node.Type != NumberValue || (node.Value == 0 && std::signbit(node.Value));
+        switch (node.Type)
+        {
+        case NumberValue:
+            return node.Value == 0 && std::signbit(node.Value);
+        case OperatorPlus:
+            //round-to-nearest 下只有 -0 + -0 的结果为 -0
+            return MayBeNegativeZero(node.Left, depth - 1) && MayBeNegativeZero(node.Right, depth - 1);
+        case OperatorMinus:
+            return MayBeNegativeZero(node.Left, depth - 1);
+        default:
+            return true;
+        }
+    }
+
+    NodeIndex Number(double value)
+    {
+        return m_Target->Create(NumberValue, InvalidNode, InvalidNode, value);
+    }
+
+    NodeIndex Negate(NodeIndex operand)
+    {
+        const ASTNode &node = Node(operand);
+        if (node.Type == NumberValue)
+        {
+            m_Stats.Folded++;
+            return Number(-node.Value);
+        }
+        if (node.Type == UnaryMinus)
+        {
+            m_Stats.Simplified++;
+            return node.Left;
+        }
+        return m_Target->Create(UnaryMinus, operand, InvalidNode);
+    }
+
+    NodeIndex Simplified(NodeIndex result)
+    {
+        m_Stats.Simplified++;
+        return result;
+    }
+
+    NodeIndex Binary(ASTNodeType type, NodeIndex left, NodeIndex right)
+    {
+        const bool strict = m_Options.StrictIEEE;
+        if (IsNumber(left) && IsNumber(right))
+        {
+            double v1 = Node(left).Value;
+            double v2 = Node(right).Value;
+            m_Stats.Folded++;
+            return Number(ApplyBinaryOperator(type, v1, v2));
+        }
+
+        switch (type)
+        {
+        case OperatorPlus:
+            //x + -0 => x 对所有 x 成立;x + 0 => x 只在 x 不为 -0 时成立
+            if (IsNegativeZero(right) || (IsPositiveZero(right) && (!strict || !MayBeNegativeZero(left))))
+                return Simplified(left);
+            if (IsNegativeZero(left) || (IsPositiveZero(left) && (!strict || !MayBeNegativeZero(right))))
+                return Simplified(right);
+            if (Node(right).Type == UnaryMinus)
+                return Simplified(m_Target->Create(OperatorMinus, left, Node(right).Left));
+            if (Node(left).Type == UnaryMinus)
+                return Simplified(m_Target->Create(OperatorMinus, right, Node(left).Left));
+            //x + (0 - y) 与 x - y 只在 x 为 -0、y 为 +0 时不同
+            if (IsZeroMinus(right) && (!strict || !MayBeNegativeZero(left)))
+                return Simplified(m_Target->Create(OperatorMinus, left, Node(right).Right));
+            if (IsZeroMinus(left) && (!strict || !MayBeNegativeZero(right)))
+                return Simplified(m_Target->Create(OperatorMinus, right, Node(left).Right));
+            break;
+        case OperatorMinus:
+            if (IsPositiveZero(right) || (IsNegativeZero(right) && (!strict || !MayBeNegativeZero(left))))
+                return Simplified(left);
+            if (!strict && IsPositiveZero(left))
+                return Simplified(Negate(right));
+            if (Node(right).Type == UnaryMinus)
+                return Simplified(m_Target->Create(OperatorPlus, left, Node(right).Left));
+            break;
+        case OperatorMul:
+            if (IsNumber(right, 1.0))
+                return Simplified(left);
+            if (IsNumber(left, 1.0))
+                return Simplified(right);
+            if (IsNumber(right, -1.0))
+                return Simplified(Negate(left));
+            if (IsNumber(left, -1.0))
+                return Simplified(Negate(right));
+            if (!strict && (IsPositiveZero(left) || IsPositiveZero(right)))
+                return Simplified(Number(0));
+            if (Node(left).Type == UnaryMinus && Node(right).Type == UnaryMinus)
+                return Simplified(m_Target->Create(OperatorMul, Node(left).Left, Node(right).Left));
+            break;
+        case OperatorDiv:
+            if (IsNumber(right, 1.0))
+                return Simplified(left);
+            if (IsNumber(right, -1.0))
+                return Simplified(Negate(left));
+            if (HasExactReciprocal(right))
+                return Simplified(m_Target->Create(OperatorMul, left, Number(1.0 / Node(right).Value)));
+            if (Node(left).Type == UnaryMinus && Node(right).Type == UnaryMinus)
+                return Simplified(m_Target->Create(OperatorDiv, Node(left).Left, Node(right).Left));
+            break;
+        default:
+            break;
+        }
+        return m_Target->Create(type, left, right);
+    }
+
+    //已注册的函数都是纯函数,参数全为常量时直接求值
+    NodeIndex Call(const ASTNode &node, NodeIndex left, NodeIndex right)
+    {
+        if (IsNumber(left) && (right == InvalidNode || IsNumber(right)))
+        {
+            m_Stats.Folded++;
+            if (right == InvalidNode)
+                return Number(ApplyUnaryNode(node, Node(left).Value));
+            return Number(ApplyBinaryNode(node, Node(left).Value, Node(right).Value));
+        }
+        return m_Target->Create(FunctionCall, left, right, 0, node.Slot);
+    }
+
+    //后序遍历 source,子树的化简结果放在 m_Results 中;使用显式栈,不受调用栈深度限制
+    NodeIndex Rewrite(NodeIndex root)
+    {
+        m_Pending.clear();
+        m_Results.clear();
+        m_Pending.push_back({root, false});
+        while (!m_Pending.empty())
+        {
+            Frame &frame = m_Pending.back();
+            if (!m_Source->Contains(frame.Index))
+                throw CompilerException("Incorrect syntax tree!");
+
+            const ASTNode &node = (*m_Source)[frame.Index];
+            if (node.Type == NumberValue)
+            {
+                m_Pending.pop_back();
+                m_Results.push_back(Number(node.Value));
+            }
+            else if (node.Type == VariableValue)
+            {
+                m_Pending.pop_back();
+                m_Results.push_back(m_Target->Create(VariableValue, InvalidNode, InvalidNode, 0, node.Slot));
+            }
+            else if (!IsInnerNode(node))
+            {
+                throw CompilerException("Incorrect syntax tree!");
+            }
+            else if (!frame.Expanded)
+            {
+                frame.Expanded = true;
+                if (!IsUnaryNode(node))
+                    m_Pending.push_back({node.Right, false});
+                m_Pending.push_back({node.Left, false});
+            }
+            else if (node.Type == UnaryMinus)
+            {
+                m_Pending.pop_back();
+                m_Results.back() = Negate(m_Results.back());
+            }
+            else if (node.Type == FunctionCall)
+            {
+                m_Pending.pop_back();
+                NodeIndex right = InvalidNode;
+                if (node.Right != InvalidNode)
+                {
+                    right = m_Results.back();
+                    m_Results.pop_back();
+                }
+                m_Results.back() = Call(node, m_Results.back(), right);
+            }
+            else
+            {
+                m_Pending.pop_back();
+                NodeIndex right = m_Results.back();
+                m_Results.pop_back();
+                m_Results.back() = Binary(node.Type, m_Results.back(), right);
+            }
+        }
+        return m_Results.back();
+    }
+
+public:
+    explicit Optimizer(OptimizerOptions options = {})
+        : m_Options(options)
+    {
+    }
+
+    //将 source 中以 root 为根的树优化后追加到 target,返回新的根节点
+    NodeIndex Optimize(const ASTArena &source, NodeIndex root, ASTArena &target)
+    {
+        m_Stats = OptimizerStats{};
+        m_Stats.Before = MeasureTree(source, root);
+        m_Source = &source;
+        m_Target = &m_Scratch;
+        m_Scratch.Reset();
+        NodeIndex result = CopySubtree(m_Scratch, Rewrite(root), target);
+        m_Stats.After = MeasureTree(target, result);
+        return result;
+    }
+
+    const OptimizerStats &Stats() const noexcept
+    {
+        return m_Stats;
+    }
+};
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "parser.hpp"
+#include "evaluator.hpp"
+#include "threadpool.hpp"
+
+struct EvaluationResult
+{
+    bool Ok = false;
+    double Value = 0;
+    std::string Error; //Ok 为 false 时的错误信息
+};
+
+//在线程池上并行解析并运算一组表达式,每个工作线程使用自己的 Parser 与 ASTArena;
+//结果与输入一一对应,单个表达式出错不影响其它表达式
+inline std::vector<EvaluationResult> EvaluateExpressions(const std::vector<std::string> &expressions, WorkStealingPool &pool)
+{
+    struct WorkerState
+    {
+        Parser parser;
+        ASTArena arena;
+        Evaluator evaluator;
+    };
+
+    std::vector<EvaluationResult> results(expressions.size());
+    std::vector<WorkerState> states(pool.Size());
+    pool.ParallelFor(expressions.size(), 64, [&](std::size_t worker, std::size_t begin, std::size_t end) {
+        WorkerState &state = states[worker];
+        for (std::size_t i = begin; i < end; i++)
+        {
+            EvaluationResult &result = results[i];
+            state.arena.Reset();
+            const std::string &text = expressions[i];
+            ParseResult parsed = state.parser.Parse(std::nothrow, text.data(), text.size(), state.arena);
+            if (!parsed)
+            {
+                result.Error = parsed.Error.Message();
+                continue;
+            }
+            result.Value = state.evaluator.Evalute(state.arena, parsed.Root);
+            result.Ok = true;
+        }
+    });
+    return results;
+}
+
+inline std::vector<EvaluationResult> EvaluateExpressions(const std::vector<std::string> &expressions, std::size_t threads = 0)
+{
+    WorkStealingPool pool(threads);
+    return EvaluateExpressions(expressions, pool);
+}
+
+//在线程池上并行解析一个很长的表达式:先按块并行扫描括号深度,找出括号外优先级最低(记为 P)的左结合二元运算符,
+//在其中前后有空白的位置切分;各段并行解析,第一段之外的每段从切分处的运算符开始,左操作数是一个占位节点;
+//最后并行地把各段的节点复制到目标 arena,每段的占位节点换成前一段的根,变量槽位换成按首次出现顺序的编号.
+//语法树的结构、变量槽位与顺序解析完全相同(节点在 arena 中的排列不同,另有每段一个不可达的占位节点).
+//无法安全切分的输入(P 级有右结合运算符、一元负号结合得比 P 松、含 NUL)或解析出错时,退回到顺序解析,错误信息与 Parser 相同
+class ParallelParser
+{
+    //字符分类:括号与可能属于运算符的字符
+    enum CharClass : std::uint8_t
+    {
+        CharOther,
+        CharOpen,
+        CharClose,
+        CharOperator,
+        CharNul
+    };
+
+    //一块文本的扫描结果
+    struct Block
+    {
+        std::size_t Begin = 0;
+        std::size_t End = 0;
+        long Depth = 0;    //块开头的括号深度
+        long Change = 0;   //块内深度的变化
+        bool Bad = false;  //深度为负或含 NUL
+        int MinPrecedence = INT_MAX;
+        std::vector<std::pair<int, std::size_t>> Splits; //每个优先级第一个可切分的运算符位置
+    };
+
+    struct Segment
+    {
+        std::size_t Begin = 0;
+        std::size_t End = 0;
+        ASTArena Arena;
+        VariableTable Variables;
+        ParseResult Result;
+        NodeIndex Graft = InvalidNode; //左子节点为占位节点的节点
+        std::vector<std::uint32_t> Slots; //局部槽位到全局槽位
+        NodeIndex Offset = 0;             //在目标 arena 中的起始位置
+    };
+
+    WorkStealingPool &m_Pool;
+    std::vector<Parser> m_Parsers; //每个工作线程一个
+    std::size_t m_SegmentBytes;
+    CharClass m_Classes[256];
+    std::vector<Block> m_Blocks;
+    std::vector<Segment> m_Segments;
+    std::size_t m_LastSegments = 0;
+
+    const OperatorTable &Table() const
+    {
+        return m_Parsers[0].m_Table;
+    }
+
+    //第一遍:块内括号深度的变化
+    void Measure(const char *text, Block &block) const
+    {
+        long change = 0;
+        for (std::size_t i = block.Begin; i < block.End; i++)
+        {
+            CharClass type = m_Classes[static_cast<unsigned char>(text[i])];
+            change += type == CharOpen;
+            change -= type == CharClose;
+            block.Bad |= type == CharNul;
+        }
+        block.Change = change;
+    }
+
+    //第二遍:已知块开头的深度,找出括号外的运算符;前面是空白、再往前是操作数结尾的运算符一定是二元运算符,可以切分
+    void Scan(const char *text, std::size_t length, Block &block) const
+    {
+        const OperatorTable &table = Table();
+        long depth = block.Depth;
+        for (std::size_t i = block.Begin; i < block.End; i++)
+        {
+            CharClass type = m_Classes[static_cast<unsigned char>(text[i])];
+            if (type == CharOpen)
+            {
+                depth++;
+            }
+            else if (type == CharClose)
+            {
+                if (--depth < 0)
+                    block.Bad = true;
+            }
+            else if (type == CharOperator && depth == 0)
+            {
+                std::uint32_t op;
+                if (!table.Match(text + i, text + length, op))
+                    continue;
+                int precedence = table[op].Precedence;
+                block.MinPrecedence = std::min(block.MinPrecedence, precedence);
+                if (i == 0 || !IsAsciiSpace(text[i - 1]))
+                    continue;
+                std::size_t prev = i - 1;
+                while (prev > 0 && IsAsciiSpace(text[prev]))
+                    prev--;
+                char last = text[prev];
+                bool operand = IsIdentifierCharacter(last) || last == '.' || last == ')';
+                bool known = false;
+                for (const auto &split : block.Splits)
+                    known |= split.first == precedence;
+                if (operand && !known)
+                    block.Splits.push_back({precedence, i});
+            }
+        }
+    }
+
+    //第一段直接解析;其它段从运算符开始,先放入占位的左操作数,与顺序解析到此处时的状态相同
+    void ParseSegment(Parser &parser, const char *text, Segment &segment, bool first, bool variables)
+    {
+        segment.Arena.Reset();
+        segment.Variables.Reset();
+        VariableTable *table = variables ? &segment.Variables : nullptr;
+        if (first)
+        {
+            segment.Result = parser.Parse(text + segment.Begin, segment.End - segment.Begin, segment.Arena, table);
+            return;
+        }
+
+        parser.Begin(segment.Arena, table);
+        parser.m_Buffer.Tokenize(text + segment.Begin, segment.End - segment.Begin, parser.m_Table, segment.Begin, TokenizeAll);
+        parser.m_Tokens = &parser.m_Buffer;
+        parser.m_Cursor = 0;
+        parser.m_Operands.push_back(parser.CreateNodeNumber(0));
+        parser.m_ExpectOperand = false;
+        segment.Result.Root = parser.Expression();
+        segment.Result.Error = parser.m_Error;
+        if (!segment.Result)
+            return;
+
+        //占位节点是第一个节点,沿左子节点下行可以找到它的父节点
+        NodeIndex index = segment.Result.Root;
+        while (segment.Arena[index].Left != 0)
+            index = segment.Arena[index].Left;
+        segment.Graft = index;
+    }
+
+    //切分点,不能并行时返回空
+    std::vector<std::size_t> FindSplits(const char *text, std::size_t length)
+    {
+        std::size_t blocks = length / m_SegmentBytes;
+        if (blocks < 2)
+            return {};
+        m_Blocks.assign(blocks, Block{});
+        for (std::size_t i = 0; i < blocks; i++)
+        {
+            m_Blocks[i].Begin = length * i / blocks;
+            m_Blocks[i].End = length * (i + 1) / blocks;
+        }
+        m_Pool.ParallelFor(blocks, 1, [&](std::size_t, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; i++)
+                Measure(text, m_Blocks[i]);
+        });
+        long depth = 0;
+        for (Block &block : m_Blocks)
+        {
+            block.Depth = depth;
+            depth += block.Change;
+        }
+        if (depth != 0)
+            return {};
+        m_Pool.ParallelFor(blocks, 1, [&](std::size_t, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; i++)
+                Scan(text, length, m_Blocks[i]);
+        });
+
+        int precedence = INT_MAX;
+        for (const Block &block : m_Blocks)
+        {
+            if (block.Bad)
+                return {};
+            precedence = std::min(precedence, block.MinPrecedence);
+        }
+        //P 级的运算符都须是左结合的,一元负号不能比 P 结合得更松,否则切分处不是顺序解析时的归约边界
+        const OperatorTable &table = Table();
+        if (precedence == INT_MAX || table.UnaryPrecedence() < precedence)
+            return {};
+        for (std::size_t i = 0; i < table.Size(); i++)
+        {
+            if (table[i].Precedence == precedence && table[i].Assoc != LeftAssociative)
+                return {};
+        }
+
+        std::vector<std::size_t> splits;
+        for (std::size_t i = 1; i < blocks; i++)
+        {
+            for (const auto &split : m_Blocks[i].Splits)
+            {
+                if (split.first == precedence)
+                    splits.push_back(split.second);
+            }
+        }
+        return splits;
+    }
+
+    ParseResult Parse(const char *text, std::size_t length, ASTArena &arena, VariableTable *variables)
+    {
+        std::vector<std::size_t> splits = FindSplits(text, length);
+        m_LastSegments = 1;
+        if (splits.empty())
+            return m_Parsers[0].Parse(text, length, arena, variables);
+
+        m_Segments.resize(splits.size() + 1);
+        for (std::size_t i = 0; i < m_Segments.size(); i++)
+        {
+            m_Segments[i].Begin = i == 0 ? 0 : splits[i - 1];
+            m_Segments[i].End = i == splits.size() ? length : splits[i];
+        }
+        m_Pool.ParallelFor(m_Segments.size(), 1, [&](std::size_t worker, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; i++)
+                ParseSegment(m_Parsers[worker], text, m_Segments[i], i == 0, variables != nullptr);
+        });
+
+        //任何一段出错时顺序解析整个输入,得到与 Parser 完全相同的错误
+        std::size_t total = 0;
+        for (Segment &segment : m_Segments)
+        {
+            if (!segment.Result)
+                return m_Parsers[0].Parse(text, length, arena, variables);
+            total += segment.Arena.Size();
+        }
+
+        //按段的顺序登记变量名,编号与顺序解析时的首次出现顺序一致
+        NodeIndex offset = arena.Extend(total);
+        for (Segment &segment : m_Segments)
+        {
+            segment.Offset = offset;
+            offset += static_cast<NodeIndex>(segment.Arena.Size());
+            segment.Slots.clear();
+            for (const std::string &name : segment.Variables.Names())
+                segment.Slots.push_back(variables->Resolve(name));
+        }
+        m_Pool.ParallelFor(m_Segments.size(), 1, [&](std::size_t, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; i++)
+            {
+                const Segment &segment = m_Segments[i];
+                for (NodeIndex j = 0; j < segment.Arena.Size(); j++)
+                {
+                    ASTNode node = segment.Arena[j];
+                    if (node.Left != InvalidNode)
+                        node.Left += segment.Offset;
+                    if (node.Right != InvalidNode)
+                        node.Right += segment.Offset;
+                    if (node.Type == VariableValue)
+                        node.Slot = segment.Slots[node.Slot];
+                    if (j == segment.Graft)
+                        node.Left = m_Segments[i - 1].Offset + m_Segments[i - 1].Result.Root;
+                    arena[segment.Offset + j] = node;
+                }
+            }
+        });
+
+        m_LastSegments = m_Segments.size();
+        const Segment &last = m_Segments.back();
+        ParseResult result;
+        result.Root = last.Offset + last.Result.Root;
+        EXPRESSION_STATS_MAX(PeakArenaNodes, arena.Size());
+        return result;
+    }
+
+    NodeIndex ParseOrThrow(const char *text, std::size_t length, ASTArena &arena, VariableTable *variables)
+    {
+        ParseResult result = Parse(text, length, arena, variables);
+        if (!result)
+            throw ParserException(result.Error);
+        return result.Root;
+    }
+
+public:
+    static constexpr std::size_t DefaultSegmentBytes = 1 << 20;
+
+    //segmentBytes 为每段的目标长度,短于两段的输入直接顺序解析;其余参数与 Parser 相同
+    explicit ParallelParser(WorkStealingPool &pool, OperatorTable table = OperatorTable(),
+                            std::size_t maxDepth = Parser::DefaultMaxDepth, std::size_t segmentBytes = DefaultSegmentBytes)
+        : m_Pool(pool), m_Parsers(pool.Size(), Parser(std::move(table), maxDepth)), m_SegmentBytes(std::max<std::size_t>(1, segmentBytes))
+    {
+        for (int ch = 0; ch < 256; ch++)
+            m_Classes[ch] = IsOperatorCharacter(char(ch)) ? CharOperator : CharOther;
+        m_Classes[static_cast<unsigned char>('(')] = CharOpen;
+        m_Classes[static_cast<unsigned char>(')')] = CharClose;
+        m_Classes[0] = CharNul;
+    }
+
+    NodeIndex Parse(const char *text, std::size_t length, ASTArena &arena)
+    {
+        return ParseOrThrow(text, length, arena, nullptr);
+    }
+
+    NodeIndex Parse(const char *text, std::size_t length, ASTArena &arena, VariableTable &variables)
+    {
+        return ParseOrThrow(text, length, arena, &variables);
+    }
+
+    ParseResult Parse(std::nothrow_t, const char *text, std::size_t length, ASTArena &arena)
+    {
+        return Parse(text, length, arena, nullptr);
+    }
+
+    ParseResult Parse(std::nothrow_t, const char *text, std::size_t length, ASTArena &arena, VariableTable &variables)
+    {
+        return Parse(text, length, arena, &variables);
+    }
+
+    //最近一次解析切分的段数,1 表示顺序解析
+    std::size_t LastSegments() const noexcept
+    {
+        return m_LastSegments;
+    }
+};
@@ -1,364 +1,1366 @@
-
-#include <exception>
-#include <string>
-#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "parser.hpp"
+#include "numberscan.hpp"
+#include "evaluator.hpp"
+#include "bytecode.hpp"
+#include "batch.hpp"
+#include "optimizer.hpp"
+#include "jit.hpp"
+#include "cache.hpp"
+#include "parallel.hpp"
+#include "formula.hpp"
+#include "dag.hpp"
+#include "staticexpr.hpp"
+#include "image.hpp"
+#include "pushparser.hpp"
+#include "compact.hpp"
+#include "registry.hpp"
 
-enum ASTNodeType
+void Test(const char *text, ASTArena &arena)
 {
-    Undefined,
-    OperatorPlus,
-    OperatorMinus,
-    OperatorMul,
-    OperatorDiv,
-    UnaryMinus,
-    NumberValue
-};
-
-struct ASTNode
+    Parser parser;
+    arena.Reset();
+    try
+    {
+        auto result = parser.Parse(text, arena);
+        std::cout << "\"" << text << "\"\t OK\n";
+
+        try
+        {
+            Evaluator eval;
+            double val = eval.Evalute(arena, result);
+            std::cout << text << " = " << val << std::endl;
+
+            Compiler compiler;
+            VirtualMachine vm;
+            Bytecode code = compiler.Compile(arena, result);
+            std::cout << text << " = " << vm.Run(code) << "\t(bytecode " << code.Code.size() << " bytes)" << std::endl;
+        }
+        catch (EvaluatorException &ex)
+        {
+            std::cout << text << " \t " << ex.what() << std::endl;
+        }
+        catch (CompilerException &ex)
+        {
+            std::cout << text << " \t " << ex.what() << std::endl;
+        }
+    }
+    catch (ParserException &ex)
+    {
+        std::cout << "\"" << text << "\"\t " << ex.what() << "\n";
+    }
+}
+//按列批量运算,并与逐行运算的结果比对
+void TestBatch(const char *text, std::size_t rows)
 {
-    ASTNodeType Type = Undefined;
-    double Value = 0;
-    ASTNode *Left = nullptr;
-    ASTNode *Right = nullptr;
+    try
+    {
+        ASTArena arena;
+        VariableTable variables;
+        Parser parser;
+        auto result = parser.Parse(text, arena, variables);
+        Bytecode code = Compiler{}.Compile(arena, result);
+
+        std::vector<std::vector<double>> data(variables.Size(), std::vector<double>(rows));
+        std::vector<const double *> columns;
+        for (std::size_t slot = 0; slot < data.size(); slot++)
+        {
+            for (std::size_t row = 0; row < rows; row++)
+                data[slot][row] = (slot + 1) * 0.25 + row * 0.5;
+            columns.push_back(data[slot].data());
+        }
 
-    ~ASTNode()
+        std::vector<double> out(rows);
+        BatchEvaluator batch;
+        batch.Evaluate(code, columns.data(), out.data(), rows);
+
+        VirtualMachine vm;
+        std::vector<double> values(variables.Size());
+        std::size_t mismatches = 0;
+        for (std::size_t row = 0; row < rows; row++)
+        {
+            for (std::size_t slot = 0; slot < values.size(); slot++)
+                values[slot] = columns[slot][row];
+            double expected = vm.Run(code, values.data());
+            if (std::memcmp(&expected, &out[row], sizeof(double)) != 0)
+                mismatches++;
+        }
+        std::cout << text << "\t" << rows << " rows (" << batch.IsaName() << "), "
+                  << mismatches << " mismatches" << std::endl;
+    }
+    catch (std::exception &ex)
     {
-        delete Left;
-        delete Right;
+        std::cout << "\"" << text << "\"\t " << ex.what() << "\n";
     }
-};
+}
 
-enum TokenType
-{
-    Error,
-    Plus,
-    Minus,
-    Mul,
-    Div,
-    EndOfText,
-    OpenParenthesis,
-    CloseParenthesis,
-    Number
-};
-
-struct Token
+//优化前后的节点数、运算步数以及结果
+void TestOptimize(const char *text, bool strict)
 {
-    TokenType type = TokenType::Error;
-    double value = 0.0;
-    char symbol = 0;
-};
+    try
+    {
+        ASTArena arena;
+        ASTArena optimized;
+        VariableTable variables;
+        Parser parser;
+        auto result = parser.Parse(text, arena, variables);
 
-class ParserException : public std::exception
-{
-    int m_Pos;
+        OptimizerOptions options;
+        options.StrictIEEE = strict;
+        Optimizer optimizer(options);
+        auto root = optimizer.Optimize(arena, result, optimized);
 
-public:
-    ParserException(const std::string &message, int pos)
-        : std::exception(message.c_str()),
-          m_Pos{pos} {};
-};
+        std::vector<double> values(variables.Size(), 1.5);
+        Evaluator eval;
+        const OptimizerStats &stats = optimizer.Stats();
+        std::cout << text << (strict ? "\t[strict] " : "\t[fast] ")
+                  << "nodes " << stats.Before.Nodes << " -> " << stats.After.Nodes
+                  << ", steps " << stats.Before.Steps << " -> " << stats.After.Steps
+                  << ", value " << eval.Evalute(arena, result, values.data())
+                  << " -> " << eval.Evalute(optimized, root, values.data()) << std::endl;
+    }
+    catch (std::exception &ex)
+    {
+        std::cout << "\"" << text << "\"\t " << ex.what() << "\n";
+    }
+}
 
-class Parser
+//JIT 的结果必须与树运算逐位一致(包括 -0.0、无穷和非规格化数)
+void TestJit(const char *text)
 {
-    Token m_crtToken;
-    const char *m_Text;
-    size_t m_Index;
+    try
+    {
+        ASTArena arena;
+        VariableTable variables;
+        Parser parser;
+        auto result = parser.Parse(text, arena, variables);
+        JitExpression jit(arena, result);
 
-private:
-    ASTNode *CreateNode(ASTNodeType type, ASTNode *left, ASTNode *right)
+        const double samples[] = {0.0, -0.0, 1.0, -2.5, 3.0e-310, 1.0e308, INFINITY, -INFINITY, NAN};
+        const std::size_t count = sizeof(samples) / sizeof(samples[0]);
+        std::vector<double> values(variables.Size());
+        std::size_t mismatches = 0;
+        std::size_t runs = 0;
+        for (std::size_t i = 0; i < count * count; i++)
+        {
+            for (std::size_t slot = 0; slot < values.size(); slot++)
+                values[slot] = samples[(i / (slot == 0 ? 1 : count) + slot) % count];
+            double expected = Evaluator{}.Evalute(arena, result, values.data());
+            double actual = jit(values.data());
+            //NaN 的符号与载荷取决于编译器为 Evaluator 选择的操作数顺序,只要求同为 NaN
+            if (std::isnan(expected) ? !std::isnan(actual) : std::memcmp(&expected, &actual, sizeof(double)) != 0)
+                mismatches++;
+            runs++;
+        }
+        //与 Evaluator 一样拒绝缺少变量值的调用,而不是在机器码中解引用空指针
+        bool rejected = false;
+        try
+        {
+            jit();
+        }
+        catch (EvaluatorException &)
+        {
+            rejected = true;
+        }
+        std::cout << text << "\t" << (jit.IsNative() ? "native" : "fallback") << ", "
+                  << runs << " runs, " << mismatches << " mismatches"
+                  << (variables.Size() == 0 ? "" : rejected ? ", null variables rejected" : ", null variables NOT rejected")
+                  << std::endl;
+    }
+    catch (std::exception &ex)
     {
-        ASTNode *node = new ASTNode;
-        node->Type = type;
-        node->Left = left;
-        node->Right = right;
-        return node;
+        std::cout << "\"" << text << "\"\t " << ex.what() << "\n";
     }
-    ASTNode *CreateUnaryNode(ASTNode *left)
+}
+
+void TestCache()
+{
+    ExpressionCache cache(4096, 4);
+    const char *texts[] = {"price * (1 - discount)", "price*(1-discount)", "  price *(1 -  discount) ",
+                           "1+2*3", "(a+b)*(a-b)", "1+2*3"};
+    for (const char *text : texts)
     {
-        ASTNode *node = new ASTNode;
-        node->Type = UnaryMinus;
-        node->Left = left;
-        node->Right = nullptr;
-        return node;
+        auto compiled = cache.Get(text);
+        std::vector<double> values(compiled->Variables.size(), 2.0);
+        std::cout << "\"" << text << "\"\t = " << VirtualMachine{}.Run(compiled->Code, values.data()) << "\n";
     }
+    for (int i = 0; i < 100; i++)
+        cache.Get(std::to_string(i) + "+x");
 
-    ASTNode *CreateNodeNumber(double value)
+    ExpressionCacheStats stats = cache.Stats();
+    std::cout << "cache: " << stats.Hits << " hits, " << stats.Misses << " misses, " << stats.Evictions << " evictions, "
+              << stats.Entries << " entries, " << stats.Bytes << " bytes" << std::endl;
+
+    //规范化不能让错误的输入变成合法的:经过缓存与直接编译的结论、结果与错误信息须相同;合法的写法先放入缓存
+    const char *probes[] = {"2e-5", "2e -5", "2e- 5", "2e - 5", "0x1p-3", "0x1p -3", "0x1p- 3", "1 2", "12", "2 e-5",
+                            "rate - 1", "rate -1", "abs (-x)", "abs(-x)", "1.5e+3 * x", "1.5e + 3 * x", "(1 +", "x + &"};
+    ExpressionCache fresh;
+    std::size_t disagreements = 0;
+    for (const char *text : probes)
     {
-        ASTNode *node = new ASTNode;
-        node->Type = NumberValue;
-        node->Value = value;
-        return node;
+        std::string direct, cached;
+        for (int path = 0; path < 2; path++)
+        {
+            std::string &outcome = path == 0 ? direct : cached;
+            try
+            {
+                auto compiled = path == 0 ? std::make_shared<const CompiledExpression>(CompileExpression(text)) : fresh.Get(text);
+                std::vector<double> values(compiled->Variables.size(), 2.0);
+                outcome = std::to_string(VirtualMachine{}.Run(compiled->Code, values.data()));
+            }
+            catch (ParserException &ex)
+            {
+                outcome = ex.what();
+            }
+        }
+        if (direct != cached && disagreements++ < 5)
+            std::cout << "\"" << text << "\"\t direct: " << direct << ", cached: " << cached << "\n";
     }
+    std::cout << "cache normalization: " << sizeof(probes) / sizeof(probes[0]) << " probes, " << disagreements
+              << " disagreements with direct compilation" << std::endl;
+}
 
-    ASTNode *Expression()
+//不抛出异常的解析:打印错误码、偏移与期望的令牌,并与抛出异常的版本比较拒绝错误输入的耗时
+void TestParseErrors()
+{
+    const char *texts[] = {"1+", "(1+2", "1+2)", "1 & 2", "2*(3+x)", "", "2*1e"};
+    Parser parser;
+    ASTArena arena;
+    for (const char *text : texts)
     {
-        ASTNode *tnode = Term();
-        ASTNode *e1node = Expression1();
-        return CreateNode(OperatorPlus, tnode, e1node);
+        arena.Reset();
+        ParseResult result = parser.Parse(std::nothrow, text, std::strlen(text), arena);
+        if (result)
+            std::cout << "\"" << text << "\"\t OK\n";
+        else
+            std::cout << "\"" << text << "\"\t code " << result.Error.Code << ", offset " << result.Error.Offset
+                      << ", expected 0x" << std::hex << result.Error.Expected << std::dec << ": "
+                      << result.Error.Message() << "\n";
     }
 
-    ASTNode *Expression1()
+    const char *bad = "(1 + 2) * 3 - (4 / 5 &";
+    const int runs = 100000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++)
     {
-        ASTNode *tnode;
-        ASTNode *e1node;
-        switch (m_crtToken.type)
+        arena.Reset();
+        try
+        {
+            parser.Parse(bad, arena);
+        }
+        catch (ParserException &)
         {
-        case Plus:
-            GetNextToken();
-            tnode = Term();
-            e1node = Expression1();
-            return CreateNode(OperatorPlus, e1node, tnode);
-        case Minus:
-            GetNextToken();
-            tnode = Term();
-            e1node = Expression1();
-            return CreateNode(OperatorMinus, e1node, tnode);
         }
-        return CreateNodeNumber(0);
     }
-
-    ASTNode *Term()
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++)
     {
-        ASTNode *fnode = Factor();
-        ASTNode *t1node = Term1();
-        return CreateNode(OperatorMul, fnode, t1node);
+        arena.Reset();
+        if (parser.Parse(std::nothrow, bad, std::strlen(bad), arena).Ok())
+            break;
     }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "rejecting malformed input: " << std::chrono::duration<double, std::nano>(middle - start).count() / runs
+              << " ns with exceptions, " << std::chrono::duration<double, std::nano>(end - middle).count() / runs
+              << " ns without" << std::endl;
+}
 
-    ASTNode *Term1()
+//先做一次词法分析,再从同一个 TokenBuffer 多次解析:结果与错误信息须与直接解析文本一致
+void TestTokenBuffer()
+{
+    const char *texts[] = {"price * (1 - discount)", "2 ^ 3", "(1+2", "1 & 2", "x y"};
+    Parser parser;
+    TokenBuffer tokens;
+    for (const char *text : texts)
     {
-        ASTNode *fnode;
-        ASTNode *t1node;
-        switch (m_crtToken.type)
+        parser.Tokenize(text, std::strlen(text), tokens);
+        std::cout << "\"" << text << "\"\t" << tokens.Size() << " tokens:";
+        for (std::size_t i = 0; i < tokens.Size(); i++)
+            std::cout << " " << TokenName(tokens.Type(i)) << "@" << tokens.Offset(i);
+
+        bool same = true;
+        for (int run = 0; run < 2; run++)
         {
-        case Mul:
-            GetNextToken();
-            fnode = Factor();
-            t1node = Term1();
-            return CreateNode(OperatorMul, t1node, fnode);
-        case Div:
-            GetNextToken();
-            fnode = Factor();
-            t1node = Term1();
-            return CreateNode(OperatorDiv, t1node, fnode);
+            ASTArena fromTokens, fromText;
+            VariableTable variables, textVariables;
+            ParseResult a = parser.Parse(std::nothrow, tokens, fromTokens, variables);
+            ParseResult b = parser.Parse(std::nothrow, text, std::strlen(text), fromText, textVariables);
+            same = same && a.Ok() == b.Ok() && a.Error.Message() == b.Error.Message() &&
+                   (!a || Evaluator{}.Evalute(fromTokens, a.Root, std::vector<double>(variables.Size(), 2).data()) ==
+                              Evaluator{}.Evalute(fromText, b.Root, std::vector<double>(textVariables.Size(), 2).data()));
         }
-        return CreateNodeNumber(1);
+        std::cout << (same ? "\tsame as text\n" : "\tDIFFERENT\n");
     }
 
-    ASTNode *Factor()
+    //同一段文本解析多次时只需词法分析一次
+    std::string text = "(1 + 2.5) * 3 - 4 / (5 - 0.125) + 6 * 7 - 8";
+    const int runs = 100000;
+    ASTArena arena;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++)
     {
-        ASTNode *node;
-        switch (m_crtToken.type)
-        {
-        case OpenParenthesis:
-            GetNextToken();
-            node = Expression();
-            Match(')');
-            return node;
-        case Minus:
-            GetNextToken();
-            node = Factor();
-            return CreateUnaryNode(node);
-        case Number:
+        arena.Reset();
+        parser.Parse(text.data(), text.size(), arena);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    parser.Tokenize(text.data(), text.size(), tokens);
+    for (int i = 0; i < runs; i++)
+    {
+        arena.Reset();
+        parser.Parse(tokens, arena);
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "parse from text " << std::chrono::duration<double, std::nano>(middle - start).count() / runs
+              << " ns, from tokens " << std::chrono::duration<double, std::nano>(end - middle).count() / runs << " ns"
+              << std::endl;
+}
+
+//分块送入 PushParser:任意切分(包括逐字节)时语法树、错误码与错误位置都须与一次解析完整文本相同
+void TestPushParser(std::size_t count)
+{
+    const char *atoms[] = {"1", "42", "2.5", "3.", "1e3", "7.5E-2", "0x1F", "0x1.8p+1", "x", "rate", "_y2"};
+    const char *ops[] = {"+", "-", "*", "/", "^", "%", "<", "<=", ">=", "==", "!=", " + ", " <= "};
+    const char noise[] = "+-*/<=>!()x0e. &";
+    std::mt19937 random(21);
+    Parser parser(OperatorTable::Extended());
+    PushParser pushParser(OperatorTable::Extended());
+    std::size_t failures = 0;
+    std::size_t mismatches = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::string text;
+        int open = 0;
+        for (int k = 0, terms = 1 + random() % 6; k < terms; k++)
         {
-            double value = m_crtToken.value;
-            GetNextToken();
-            return CreateNodeNumber(value);
+            if (k != 0)
+                text += ops[random() % 13];
+            while (random() % 4 == 0)
+            {
+                text += random() % 2 ? "(" : "-";
+                open += text.back() == '(';
+            }
+            text += atoms[random() % 11];
+            for (; open > 0 && random() % 3 == 0; open--)
+                text += ")";
         }
+        text.append(open, ')');
+        if (random() % 3 == 0)
+            text[random() % text.size()] = noise[random() % (sizeof(noise) - 1)];
 
-        break;
-        default:
+        ASTArena arena, pushArena;
+        VariableTable variables, pushVariables;
+        ParseResult expected = parser.Parse(std::nothrow, text.data(), text.size(), arena, variables);
+        pushParser.Begin(pushArena, pushVariables);
+        //块长在 1 到 8 字节之间,每块都复制到单独的缓冲中,确保不会引用之前的块
+        for (std::size_t begin = 0; begin < text.size();)
         {
-            std::stringstream sstr;
-            sstr << "Unexpected token '" << m_crtToken.symbol << "' at position " << m_Index;
-            throw ParserException(sstr.str(), m_Index);
+            std::size_t size = std::min<std::size_t>(1 + random() % 8, text.size() - begin);
+            std::string chunk = text.substr(begin, size);
+            pushParser.Feed(chunk);
+            begin += size;
         }
+        ParseResult result = pushParser.Finish(std::nothrow);
+
+        failures += !expected;
+        bool same = expected.Ok() == result.Ok() && expected.Error.Message() == result.Error.Message() &&
+                    variables.Names() == pushVariables.Names();
+        if (same && expected)
+        {
+            std::vector<double> values(variables.Size(), 1.5);
+            double a = Evaluator{}.Evalute(arena, expected.Root, values.data());
+            double b = Evaluator{}.Evalute(pushArena, result.Root, values.data());
+            same = a == b || (a != a && b != b);
         }
+        if (!same && mismatches++ < 5)
+            std::cout << "\"" << text << "\"\t" << expected.Error.Message() << " | " << result.Error.Message() << "\n";
     }
+    std::cout << count << " expressions fed in chunks (" << failures << " malformed), " << mismatches
+              << " mismatches with whole-text parsing" << std::endl;
+
+    //一个很长的表达式按 4 KB 分块到达:直接分块解析,与先拼接成完整文本再解析比较
+    std::vector<std::string> chunks;
+    std::string whole;
+    for (std::size_t i = 0; whole.size() < (8 << 20); i++)
+        whole += (i == 0 ? "" : i % 3 ? " + " : " * ") + std::to_string(i % 1000) + "." + std::to_string(i % 7);
+    for (std::size_t begin = 0; begin < whole.size(); begin += 4096)
+        chunks.push_back(whole.substr(begin, 4096));
+
+    ASTArena arena;
+    auto start = std::chrono::steady_clock::now();
+    pushParser.Begin(arena);
+    for (const std::string &chunk : chunks)
+        pushParser.Feed(chunk);
+    double pushed = Evaluator{}.Evalute(arena, pushParser.Finish());
+    auto middle = std::chrono::steady_clock::now();
+    std::string joined;
+    for (const std::string &chunk : chunks)
+        joined += chunk;
+    arena.Reset();
+    double parsed = Evaluator{}.Evalute(arena, parser.Parse(joined.data(), joined.size(), arena));
+    auto end = std::chrono::steady_clock::now();
+    std::cout << whole.size() / 1024 << " KB in " << chunks.size() << " chunks: push parser "
+              << std::chrono::duration<double, std::milli>(middle - start).count() << " ms, concatenate + parse "
+              << std::chrono::duration<double, std::milli>(end - middle).count() << " ms, "
+              << (pushed == parsed ? "same result" : "DIFFERENT RESULT") << std::endl;
+}
+
 
-    void Match(char expected)
+//函数调用:名称在解析时换成编号,编译时换成函数指针;各种运算方式的结果须与 Evaluator 一致
+void TestFunctions()
+{
+    Functions().Add("clamp01", [](double x) { return x < 0 ? 0.0 : x > 1 ? 1.0 : x; });
+    Functions().Add("hypot", [](double x, double y) { return std::hypot(x, y); });
+
+    const char *texts[] = {"sqrt(x*x + y*y)", "max(min(a, b), 0) - abs(-a)", "pow(2, 10) + x", "hypot (x, y) * clamp01(a - b)",
+                           "-sqrt(exp(log(x)))"};
+    Parser parser;
+    for (const char *text : texts)
     {
-        if (m_Text[m_Index - 1] == expected)
+        ASTArena arena, optimized;
+        VariableTable variables;
+        NodeIndex root = parser.Parse(text, arena, variables);
+        NodeIndex optimizedRoot = Optimizer{}.Optimize(arena, root, optimized);
+        Bytecode code = Compiler{}.Compile(arena, root);
+        ExpressionDag dag;
+        NodeIndex dagRoot = dag.Add(arena, root, variables);
+        JitExpression jit(arena, root);
+
+        const std::size_t rows = 300;
+        std::vector<std::vector<double>> data(variables.Size(), std::vector<double>(rows));
+        std::vector<const double *> columns;
+        for (std::size_t slot = 0; slot < data.size(); slot++)
         {
-            GetNextToken();
+            for (std::size_t row = 0; row < rows; row++)
+                data[slot][row] = (slot + 1) * 0.25 + row * 0.5;
+            columns.push_back(data[slot].data());
         }
-        else
+        std::vector<double> out(rows);
+        BatchEvaluator{}.Evaluate(code, columns.data(), out.data(), rows);
+
+        Evaluator eval;
+        VirtualMachine vm;
+        DagEvaluator dagEval;
+        std::vector<double> values(variables.Size());
+        std::size_t mismatches = 0;
+        for (std::size_t row = 0; row < rows; row++)
         {
-            std::stringstream sstr;
-            sstr << "Expected token '" << expected << "' at position " << m_Index;
-            throw ParserException(sstr.str(), m_Index);
+            for (std::size_t slot = 0; slot < values.size(); slot++)
+                values[slot] = columns[slot][row];
+            double expected = eval.Evalute(arena, root, values.data());
+            double actual[] = {vm.Run(code, values.data()), eval.Evalute(optimized, optimizedRoot, values.data()),
+                               dagEval.Evaluate(dag, dagRoot, values.data()), jit(values.data()), out[row]};
+            for (double value : actual)
+                mismatches += std::memcmp(&expected, &value, sizeof(double)) != 0;
         }
+        values.assign(values.size(), 2);
+        std::cout << text << " = " << eval.Evalute(arena, root, values.data()) << "\t" << rows << " rows, "
+                  << mismatches << " mismatches" << std::endl;
     }
 
-    void SkipWhitespaces()
+    const char *bad[] = {"foo(1)", "sqrt(1, 2)", "min(1)", "1, 2", "sqrt()", "(1, 2)", "max(1, (2, 3))"};
+    for (const char *text : bad)
     {
-        while (std::isspace(m_Text[m_Index]))
-            m_Index++;
+        ASTArena arena;
+        ParseResult result = parser.Parse(std::nothrow, text, std::strlen(text), arena);
+        std::cout << "\"" << text << "\"\t " << (result ? "OK" : result.Error.Message()) << "\n";
     }
-
-    void GetNextToken()
+    try
     {
-        SkipWhitespaces();
-
-        m_crtToken.value = 0;
-        m_crtToken.symbol = 0;
+        ExpressionImageWriter writer;
+        writer.Add("distance", "sqrt(x*x + y*y)");
+    }
+    catch (CompilerException &ex)
+    {
+        std::cout << "image: " << ex.what() << std::endl;
+    }
 
-        //check is eof
-        if (m_Text[m_Index] == 0)
+    //逐个切分点分块送入,函数名与 '(' 之间可能被切开;再逐字节送入一次,名称之后的空白分散在多块中
+    const char *chunked[] = {"max (rate, 2) * hypot(x,y)", "pow(  2 ,3)", "sqrtx + 1", "sqrt  x", "(rate   ",
+                             "rate   ) + 1", "max   (1,", "a +  b  ", "hypot \t (x, y)  + pow  "};
+    PushParser pushParser;
+    std::size_t mismatches = 0;
+    for (const char *text : chunked)
+    {
+        std::size_t length = std::strlen(text);
+        ASTArena arena;
+        VariableTable variables;
+        ParseResult expected = parser.Parse(std::nothrow, text, length, arena, variables);
+        for (std::size_t split = 0; split <= length; split++)
         {
-            m_crtToken.type = EndOfText;
-            return;
+            ASTArena pushArena;
+            VariableTable pushVariables;
+            pushParser.Begin(pushArena, pushVariables);
+            pushParser.Feed(std::string(text, split));
+            pushParser.Feed(std::string(text + split, length - split));
+            ParseResult result = pushParser.Finish(std::nothrow);
+            bool same = expected.Error.Message() == result.Error.Message() && variables.Names() == pushVariables.Names();
+            if (same && expected)
+            {
+                std::vector<double> values(variables.Size(), 1.5);
+                same = Evaluator{}.Evalute(arena, expected.Root, values.data()) ==
+                       Evaluator{}.Evalute(pushArena, result.Root, values.data());
+            }
+            mismatches += !same;
         }
 
-        if (std::isdigit(m_Text[m_Index]))
-        {
-            m_crtToken.type = Number;
-            m_crtToken.value = GetNumber();
-            return;
-        }
+        ASTArena pushArena;
+        VariableTable pushVariables;
+        pushParser.Begin(pushArena, pushVariables);
+        for (std::size_t i = 0; i < length; i++)
+            pushParser.Feed(text + i, 1);
+        ParseResult result = pushParser.Finish(std::nothrow);
+        mismatches += expected.Error.Message() != result.Error.Message() || variables.Names() != pushVariables.Names();
+    }
+    std::cout << "function calls fed in two chunks and byte by byte: " << mismatches << " mismatches" << std::endl;
+
+    //名称之后 1 MB 的空白按 4 KB 分块到达:只记下空白的字节数,不复制,也不在每块到达时重新扫描
+    std::string gap = "max" + std::string(1 << 20, ' ') + "(2, 3) + rate" + std::string(1 << 20, ' ');
+    ASTArena gapArena;
+    VariableTable gapVariables;
+    auto gapStart = std::chrono::steady_clock::now();
+    pushParser.Begin(gapArena, gapVariables);
+    for (std::size_t begin = 0; begin < gap.size(); begin += 4096)
+        pushParser.Feed(gap.data() + begin, std::min<std::size_t>(4096, gap.size() - begin));
+    NodeIndex gapRoot = pushParser.Finish();
+    auto gapEnd = std::chrono::steady_clock::now();
+    double gapValues[] = {0.5};
+    std::cout << "2 MB of spaces after names: " << std::chrono::duration<double, std::milli>(gapEnd - gapStart).count()
+              << " ms, max(2, 3) + rate = " << Evaluator{}.Evalute(gapArena, gapRoot, gapValues) << std::endl;
 
-        m_crtToken.type = Error;
-        switch (m_Text[m_Index])
+    //变量名只在解析时查找一次,之后按槽位写入平坦数组即可反复运算
+    ASTArena arena;
+    VariableTable variables;
+    NodeIndex root = Parser(OperatorTable::Extended()).Parse("hypot(x - cx, y - cy) < r", arena, variables);
+    Bytecode code = Compiler{}.Compile(arena, root);
+    std::vector<double> values(variables.Size());
+    values[variables.Find("cx")] = 0.5;
+    values[variables.Find("cy")] = 0.5;
+    values[variables.Find("r")] = 0.5;
+    const std::uint32_t x = variables.Find("x"), y = variables.Find("y");
+    VirtualMachine vm;
+    const int grid = 1000;
+    double inside = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < grid; i++)
+    {
+        values[x] = (i + 0.5) / grid;
+        for (int j = 0; j < grid; j++)
         {
-        case '+':
-            m_crtToken.type = Plus;
-            break;
-        case '-':
-            m_crtToken.type = Minus;
-            break;
-        case '*':
-            m_crtToken.type = Mul;
-            break;
-        case '/':
-            m_crtToken.type = Div;
-            break;
-        case '(':
-            m_crtToken.type = OpenParenthesis;
-            break;
-        case ')':
-            m_crtToken.type = CloseParenthesis;
-            break;
+            values[y] = (j + 0.5) / grid;
+            inside += vm.Run(code, values.data());
         }
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "pi ~ " << 4 * inside / (double(grid) * grid) << " (slot 'unknown' = "
+              << (variables.Find("unknown") == VariableTable::NoSlot ? "none" : "?") << "), "
+              << std::chrono::duration<double, std::nano>(end - start).count() / (double(grid) * grid)
+              << " ns per evaluation" << std::endl;
+}
+//扩展运算符:各种运算方式的结果须一致,JIT 遇到不支持的运算时退回到 Evaluator
+void TestOperators()
+{
+    Parser parser(OperatorTable::Extended());
+    const char *texts[] = {"2^3^2", "-2^2", "2^-1", "7 % 3 * 2", "1 < 2 == 2 > 1", "x * 2 >= 6", "(x != 3) + x % 2 ^ 2"};
+    for (const char *text : texts)
+    {
+        ASTArena arena;
+        VariableTable variables;
+        NodeIndex root = parser.Parse(text, arena, variables);
+        double x = 3;
+        double value = Evaluator{}.Evalute(arena, root, &x);
+        double bytecode = VirtualMachine{}.Run(Compiler{}.Compile(arena, root), &x);
+        ASTArena optimized;
+        double folded = Evaluator{}.Evalute(optimized, Optimizer{}.Optimize(arena, root, optimized), &x);
+        JitExpression jit(arena, root);
+        std::cout << text << " = " << value << "\t(bytecode " << bytecode << ", optimized " << folded << ", "
+                  << (jit.IsNative() ? "native " : "fallback ") << jit(&x) << ")" << std::endl;
+    }
+}
 
-        if (m_crtToken.type != Error)
+//很长的表达式:解析时间应与长度成正比,嵌套过深时报告错误而不是栈溢出
+void TestLongExpressions()
+{
+    Parser parser;
+    ASTArena arena;
+    for (std::size_t terms : {250000, 1000000})
+    {
+        std::string text = "1";
+        for (std::size_t i = 1; i < terms; i++)
+            text += i % 2 ? "+2" : "-1";
+
+        arena.Reset();
+        auto start = std::chrono::steady_clock::now();
+        NodeIndex root = parser.Parse(text.data(), text.size(), arena);
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << text.size() / 1024 << " KB, " << terms << " terms: parsed in " << elapsed << " ms ("
+                  << elapsed * 1e6 / text.size() << " ns/byte), value " << Evaluator{}.Evalute(arena, root)
+                  << ", jit " << JitExpression(arena, root)() << std::endl;
+    }
+
+    std::string nested = std::string(Parser::DefaultMaxDepth + 1, '(') + "1" + std::string(Parser::DefaultMaxDepth + 1, ')');
+    ParseResult result = parser.Parse(std::nothrow, nested.data(), nested.size(), arena);
+    std::cout << "nesting " << Parser::DefaultMaxDepth + 1 << ": " << result.Error.Message() << std::endl;
+}
+
+//公式依赖图:增量更新的结果须与全部重新运算一致,且只运算受影响的公式
+void TestFormulaGraph(std::size_t count)
+{
+    FormulaGraph graph;
+    std::vector<std::string> texts(count);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        //按 i % 10 形成 10 条依赖链,每 50 个公式额外引用一次相邻的链
+        std::string input = "x" + std::to_string(i % 10);
+        texts[i] = i < 10 ? input + " * 2" : "f" + std::to_string(i - 10) + " + " + input;
+        if (i >= 10 && i % 50 == 0)
+            texts[i] += " - f" + std::to_string(i - 1) + " / 4";
+        graph.Define("f" + std::to_string(i), texts[i]);
+    }
+    for (int k = 0; k < 10; k++)
+        graph.SetInput("x" + std::to_string(k), k);
+
+    //按需先算依赖:重新定义后公式可能引用编号更大的公式
+    auto check = [&]() {
+        std::vector<double> values(count);
+        std::vector<bool> done(count, false);
+        std::function<double(std::size_t)> compute = [&](std::size_t i) {
+            if (done[i])
+                return values[i];
+            ASTArena arena;
+            VariableTable variables;
+            NodeIndex root = Parser{}.Parse(texts[i].c_str(), arena, variables);
+            std::vector<double> arguments;
+            for (const std::string &name : variables.Names())
+                arguments.push_back(name[0] == 'x' ? graph.Value(name) : compute(std::stoul(name.substr(1))));
+            values[i] = Evaluator{}.Evalute(arena, root, arguments.data());
+            done[i] = true;
+            return values[i];
+        };
+        std::size_t mismatches = 0;
+        for (std::size_t i = 0; i < count; i++)
+            mismatches += compute(i) == graph.Value("f" + std::to_string(i)) ? 0 : 1;
+        return mismatches;
+    };
+
+    graph.SetInput("x9", 100);
+    FormulaUpdateStats single = graph.LastUpdate();
+    std::size_t mismatches = check();
+
+    {
+        FormulaUpdate update(graph);
+        graph.SetInput("x9", 1);
+        graph.SetInput("x9", 2);
+        graph.SetInput("x8", 3);
+    }
+    FormulaUpdateStats batch = graph.LastUpdate();
+    mismatches += check();
+
+    graph.SetInput("x0", 0); //值未变,不传播
+    FormulaUpdateStats unchanged = graph.LastUpdate();
+
+    std::cout << count << " formulas: single update recomputed " << single.Recomputed << ", batch of "
+              << batch.Inputs << " inputs recomputed " << batch.Recomputed << ", unchanged input recomputed "
+              << unchanged.Recomputed << ", " << mismatches << " mismatches" << std::endl;
+
+    //f11 依赖 f1,自身引用同样是循环;被拒绝的定义不改变原有定义,也不登记新的名字
+    double before = graph.Value("f1");
+    std::size_t size = graph.Size();
+    const char *cycles[][2] = {{"f1", "f11 + 1"}, {"f1", "f1 + 1"}, {"a", "a + 1"}, {"f1", "y + f21"}};
+    for (const auto &cycle : cycles)
+    {
+        try
         {
-            m_crtToken.symbol = m_Text[m_Index];
-            m_Index++;
+            graph.Define(cycle[0], cycle[1]);
+            std::cout << cycle[0] << " = " << cycle[1] << ": cycle NOT detected" << std::endl;
         }
-        else
+        catch (FormulaException &ex)
         {
-            std::stringstream sstr;
-            sstr << "Unexpected token '" << m_Text[m_Index] << "' at position " << m_Index;
-            throw ParserException(sstr.str(), m_Index);
+            std::cout << ex.what() << std::endl;
         }
     }
+    bool intact = graph.Value("f1") == before && graph.IsFormula("f1") && graph.Size() == size && !graph.Contains("a") &&
+                  !graph.Contains("y") && check() == 0;
+    std::cout << "after rejected cycles: " << (intact ? "unchanged" : "CHANGED") << std::endl;
 
-    double GetNumber()
+    //同一批修改中 f0 先因 x0 入队,再被重新定义为依赖更深的 f31(x1 同时改变):
+    //x1 与 x0 的两条链上每个公式都只能运算一次,f0 必须等 f31 算完
     {
-        SkipWhitespaces();
-        int index = m_Index;
-        while (std::isdigit(m_Text[m_Index]))
-            m_Index++;
-        if (m_Text[m_Index] == '.')
-            m_Index++;
-        while (std::isdigit(m_Text[m_Index]))
-            m_Index++;
-        if (m_Index - index == 0)
-            throw ParserException("Number expected but not found!", m_Index);
+        FormulaUpdate update(graph);
+        graph.SetInput("x0", 5);
+        graph.SetInput("x1", 7);
+        graph.Define("f0", "x0 * 2 + f31");
+    }
+    texts[0] = "x0 * 2 + f31";
+    FormulaUpdateStats deeper = graph.LastUpdate();
+    std::cout << "redefined onto a deeper formula: recomputed " << deeper.Recomputed << " (expected " << count / 5
+              << "), " << check() << " mismatches" << std::endl;
+}
 
-        char buffer[32] = {0};
-        std::memcpy(buffer, &m_Text[index], m_Index - index);
-        return std::atof(buffer);
+//重复子项很多的表达式:去重后的图与原来的树运算结果须逐位一致
+void TestDag(int depth)
+{
+    std::string text = "(a+b)";
+    for (int i = 0; i < depth; i++)
+        text = "(" + text + "*" + text + "/(" + text + "-c))";
+
+    ASTArena arena;
+    VariableTable variables;
+    NodeIndex root = Parser{}.Parse(text.c_str(), arena, variables);
+    ExpressionDag dag;
+    NodeIndex dagRoot = dag.Add(arena, root, variables);
+    std::size_t dagMemory = dag.MemoryUsage();
+    dag.ReleaseIndex();
+
+    const double values[] = {1.5, -0.25, 3};
+    const int runs = 200;
+    double tree = 0;
+    double shared = 0;
+    Evaluator evaluator;
+    DagEvaluator dagEvaluator;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++)
+        tree = evaluator.Evalute(arena, root, values);
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++)
+        shared = dagEvaluator.Evaluate(dag, dagRoot, values);
+    auto end = std::chrono::steady_clock::now();
+
+    const DagStats &stats = dag.Stats();
+    std::cout << text.size() / 1024 << " KB: " << stats.TreeNodes << " tree nodes -> " << stats.DagNodes << " dag nodes (ratio "
+              << stats.Ratio() << "), memory " << arena.Size() * sizeof(ASTNode) << " -> " << dagMemory << " bytes, "
+              << "evaluate " << std::chrono::duration<double, std::micro>(middle - start).count() / runs << " us -> "
+              << std::chrono::duration<double, std::micro>(end - middle).count() / runs << " us, "
+              << (std::memcmp(&tree, &shared, sizeof(double)) == 0 ? "same" : "DIFFERENT") << " result" << std::endl;
+}
+
+//同一个图中的多棵树:变量按名称而不是槽位共享,运算一棵树时只运算它可达的节点
+void TestDagForest()
+{
+    const char *texts[] = {"(a + b) * (a + b) - c", "(x + b) * 2 - (a + b)", "(1 + 2) * 3 - 0.5"};
+    const double named[] = {1.5, -0.25, 3, 7}; //a, b, c, x
+    ExpressionDag dag;
+    std::vector<ASTArena> arenas(3);
+    std::vector<VariableTable> tables(3);
+    std::vector<NodeIndex> roots, dagRoots;
+    for (int i = 0; i < 3; i++)
+    {
+        roots.push_back(Parser{}.Parse(texts[i], arenas[i], tables[i]));
+        dagRoots.push_back(tables[i].Size() == 0 ? dag.Add(arenas[i], roots[i]) : dag.Add(arenas[i], roots[i], tables[i]));
     }
 
-public:
-    ASTNode *Parse(const char *text)
+    auto lookup = [&](const VariableTable &table) {
+        std::vector<double> values;
+        for (const std::string &name : table.Names())
+            values.push_back(named[name == "x" ? 3 : name[0] - 'a']);
+        return values;
+    };
+    std::vector<double> dagValues = lookup(dag.Variables());
+    std::size_t mismatches = 0;
+    DagEvaluator evaluator;
+    for (int i = 0; i < 3; i++)
     {
-        m_Text = text;
-        m_Index = 0;
-        GetNextToken();
-        return Expression();
+        std::vector<double> values = lookup(tables[i]);
+        double expected = Evaluator{}.Evalute(arenas[i], roots[i], values.empty() ? nullptr : values.data());
+        double actual = evaluator.Evaluate(dag, dagRoots[i], i == 2 ? nullptr : dagValues.data());
+        mismatches += std::memcmp(&expected, &actual, sizeof(double)) != 0;
     }
-};
+    std::cout << "dag forest: " << dag.Stats().TreeNodes << " tree nodes -> " << dag.Stats().DagNodes << " dag nodes, "
+              << dag.Variables().Size() << " variables, " << mismatches << " mismatches" << std::endl;
+}
+
+//编译期解析与运算,结果在编译时检查
+static_assert(EvaluateStatic("1+2*3") == 7);
+static_assert(EvaluateStatic("1-2-3-4") == -8);
+static_assert(EvaluateStatic("(1+2)*(3+4)") == 21);
+static_assert(EvaluateStatic("-1+(-2.0)") == -3);
+static_assert(EvaluateStatic("1/2/4") == 0.125);
+static_assert(EvaluateStatic("--2.5e1 * 4") == 100);
+static_assert(EvaluateStatic("0.1 + 0.2") == 0.1 + 0.2);
+//标识符的字符分类与 locale 无关:0x80 以上的字节(如 Latin-1 的 'é')在任何 locale 下都不是字母
+static_assert(IsIdentifierStart('_') && IsIdentifierStart('Z') && !IsIdentifierStart('7') && !IsIdentifierStart('\xE9'));
+static_assert(IsIdentifierCharacter('7') && !IsIdentifierCharacter('\xE9') && !IsIdentifierCharacter('\xAA') && !IsAsciiAlnum('_'));
+//快速路径之外同样正确舍入,与编译器(以及运行时的 ScanNumber)逐位一致
+static_assert(EvaluateStatic("1e23") == 1e23);
+static_assert(EvaluateStatic("8.589973e9") == 8.589973e9);
+static_assert(EvaluateStatic("9007199254740993") == 9007199254740992.0);
+static_assert(EvaluateStatic("123456789012345678901234567890") == 123456789012345678901234567890.0);
+static_assert(EvaluateStatic("1.7976931348623157e308") == 1.7976931348623157e308);
+static_assert(EvaluateStatic("2.2250738585072011e-308") == 2.2250738585072011e-308);
+static_assert(EvaluateStatic("4.9e-324") == 4.9e-324);
+static_assert(EvaluateStatic("2.4703282292062328e-324") == 4.9e-324);
+static_assert(EvaluateStatic("2.4703282292062327e-324") == 0);
+static_assert(EvaluateStatic("1e400") == std::numeric_limits<double>::infinity());
 
-class EvaluatorException : public std::exception
+static constexpr auto g_PriceTree = ParseStatic("price * (1 - discount) + tax / 2");
+using PriceFormula = StaticExpression<g_PriceTree>;
+static constexpr double g_PriceValues[] = {80, 0.25, 10};
+static_assert(PriceFormula::VariableCount == 3);
+static_assert(PriceFormula::Slot("discount") == 1 && PriceFormula::Slot("unknown") == 3);
+static_assert(PriceFormula{}(g_PriceValues) == 65);
+
+static constexpr auto g_ChainTree = ParseStatic("-(a + b) / (c - a * 2) * (b - (c / a - 1))");
+using ChainFormula = StaticExpression<g_ChainTree>;
+
+//编译期的树与运行时 Parser 得到的结果逐位相同
+template <typename Formula, std::size_t N>
+void TestStatic(const char *text, const StaticTree<N> &tree)
 {
-public:
-    EvaluatorException(const std::string &message) : std::exception(message.c_str())
+    ASTArena arena;
+    VariableTable variables;
+    NodeIndex root = Parser{}.Parse(text, arena, variables);
+    std::vector<double> values(variables.Size());
+    std::mt19937 random(7);
+    std::uniform_real_distribution<double> distribution(-10, 10);
+    int mismatches = 0;
+    for (int run = 0; run < 1000; run++)
     {
+        //按名字对应两边的槽位
+        std::vector<double> staticValues(Formula::VariableCount);
+        for (std::size_t i = 0; i < values.size(); i++)
+        {
+            values[i] = distribution(random);
+            staticValues[Formula::Slot(variables.Name(i))] = values[i];
+        }
+        double expected = Evaluator{}.Evalute(arena, root, values.data());
+        double functor = Formula{}(staticValues.data());
+        double linear = EvaluateStatic(tree, staticValues.data());
+        if (std::memcmp(&expected, &functor, sizeof(double)) != 0 || std::memcmp(&expected, &linear, sizeof(double)) != 0)
+            mismatches++;
     }
-};
-class Evaluator
+    std::cout << text << ": " << tree.Count << " nodes, " << Formula::VariableCount << " variables, "
+              << mismatches << " mismatches" << std::endl;
+}
+
+//写入映像后加载运行,结果应与解析后直接运算逐位相同;版本不符时重新解析,内容损坏时报错
+void TestImage(std::size_t count)
 {
-    double EvaluateSubtree(ASTNode *ast)
+    const char ops[] = {'+', '-', '*', '/'};
+    const char *names[] = {"a", "b", "c", "rate"};
+    std::mt19937 random(11);
+    std::vector<std::string> texts;
+    for (std::size_t i = 0; i < count; i++)
     {
-        if (ast == nullptr)
-            throw EvaluatorException("Incorrect syntax tree!");
-
-        if (ast->Type == NumberValue)
+        std::string text = names[random() % 4];
+        for (int k = 0, terms = 4 + random() % 12; k < terms; k++)
         {
-            return ast->Value;
+            text += ops[random() % 4];
+            text += random() % 2 ? std::string(names[random() % 4]) : std::to_string(random() % 1000) + ".5";
         }
-        else if (ast->Type == UnaryMinus)
+        texts.push_back(text);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ExpressionImageWriter writer;
+    for (std::size_t i = 0; i < count; i++)
+        writer.Add("f" + std::to_string(i), texts[i]);
+    auto compiled = std::chrono::steady_clock::now();
+    const char *path = "parseAsAST.img";
+    writer.Write(path);
+
+    ExpressionLibrary library;
+    auto loading = std::chrono::steady_clock::now();
+    library.Load(path);
+    auto loaded = std::chrono::steady_clock::now();
+
+    //按各表达式自己的变量名取值,与直接解析运算的结果比较
+    auto check = [&](const ExpressionLibrary &library) {
+        std::size_t mismatches = 0;
+        VirtualMachine vm;
+        Evaluator evaluator;
+        for (std::size_t i = 0; i < count; i++)
         {
-            return -EvaluateSubtree(ast->Left);
+            std::size_t index = library.Find("f" + std::to_string(i));
+            double values[4];
+            for (std::uint32_t slot = 0; slot < library.VariableCount(index); slot++)
+                values[slot] = double(library.Variable(index, slot).size()) + 0.25 * library.Variable(index, slot)[0];
+            ASTArena arena;
+            VariableTable variables;
+            NodeIndex root = Parser{}.Parse(texts[i].c_str(), arena, variables);
+            double expected = evaluator.Evalute(arena, root, values);
+            double actual = vm.Run(library.Code(index), values);
+            if (index == ExpressionLibrary::npos || library.Text(index) != texts[i] || std::memcmp(&expected, &actual, sizeof(double)) != 0)
+                mismatches++;
         }
-        else
+        return mismatches;
+    };
+
+    std::size_t mismatches = check(library);
+    std::vector<char> image = writer.Build();
+    std::cout << count << " formulas, image " << image.size() / 1024 << " KB: parse+compile "
+              << std::chrono::duration<double, std::milli>(compiled - start).count() << " ms, load "
+              << std::chrono::duration<double, std::milli>(loaded - loading).count() << " ms, "
+              << mismatches << " mismatches" << std::endl;
+
+    //修改映像后重新计算校验和再写回,只留下需要 Validate 或重新解析才能发现的问题
+    auto rewrite = [&](std::vector<char> bytes, auto &&change) {
+        ImageHeader header;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        ImageEntry entry;
+        std::memcpy(&entry, bytes.data() + header.DataOffset, sizeof(entry));
+        change(bytes, header, entry);
+        std::memcpy(bytes.data() + header.DataOffset, &entry, sizeof(entry));
+        header.Checksum = ImageChecksum(bytes.data() + sizeof(header), bytes.size() - sizeof(header));
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        std::FILE *file = std::fopen(path, "wb");
+        std::fwrite(bytes.data(), 1, bytes.size(), file);
+        std::fclose(file);
+    };
+
+    //声明的栈深度大于实际所需:VirtualMachine 按它分配栈,须当作损坏拒绝
+    rewrite(image, [](std::vector<char> &, ImageHeader &, ImageEntry &entry) { entry.MaxStackDepth = 0x40000000; });
+    try
+    {
+        library.Load(path);
+        std::cout << "inflated stack depth: NOT detected" << std::endl;
+    }
+    catch (const ImageException &ex)
+    {
+        std::cout << "inflated stack depth: " << ex.what() << std::endl;
+    }
+
+    //伪造一个新版本号的映像:校验和仍然正确,只能按源文本重新解析
+    rewrite(image, [](std::vector<char> &, ImageHeader &header, ImageEntry &) { header.Version = ImageVersion + 1; });
+    library.Load(path);
+    std::cout << "version mismatch: " << (library.Reparsed() ? "reparsed" : "NOT reparsed") << ", " << check(library)
+              << " mismatches" << std::endl;
+
+    //再把第一条源文本改坏:重新解析中途失败,不能留下 Reparsed() 为真而条目不全的状态
+    rewrite(image, [](std::vector<char> &bytes, ImageHeader &header, ImageEntry &entry) {
+        header.Version = ImageVersion + 1;
+        bytes[entry.Text.Offset] = ')';
+    });
+    try
+    {
+        library.Load(path);
+        std::cout << "bad source: NOT detected" << std::endl;
+    }
+    catch (const ParserException &ex)
+    {
+        std::cout << "bad source: " << ex.what() << ", " << (library.Reparsed() ? "still reparsed" : "not reparsed")
+                  << ", " << library.Size() << " formulas" << std::endl;
+    }
+
+    image[image.size() / 2] ^= 1;
+    std::FILE *file = std::fopen(path, "wb");
+    std::fwrite(image.data(), 1, image.size(), file);
+    std::fclose(file);
+    try
+    {
+        library.Load(path);
+        std::cout << "corrupt image: NOT detected" << std::endl;
+    }
+    catch (const ImageException &ex)
+    {
+        std::cout << "corrupt image: " << ex.what() << std::endl;
+    }
+    std::remove(path);
+}
+
+//与 strtod 做差分测试:结果须逐位一致,扫描结束的位置也须一致
+void TestNumberScan(std::size_t count)
+{
+    std::mt19937_64 random(12345);
+    std::vector<std::string> texts = {"0", "0.0", "007", "1.", "1e", "1e+", "2.5e2", "0x", "0x.p1", "0x1.8p1", "0X1P-1074",
+                                      "1e308", "1.7976931348623157e308", "1.7976931348623159e308", "1e400",
+                                      "2.2250738585072011e-308", "4.9e-324", "2.4703282292062327e-324", "1e-400",
+                                      "9007199254740993", "123456789012345678901234567890", "0.1e23", "1e22", "1e23",
+                                      "0x1.fffffffffffff8p1023", "0x123456789abcdef0123p-10"};
+    char buffer[64];
+    while (texts.size() < count)
+    {
+        std::uint64_t bits = random() & 0x7FFFFFFFFFFFFFFFull;
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        if (!std::isfinite(value))
+            continue;
+        switch (random() % 4)
         {
-            double v1 = EvaluateSubtree(ast->Left);
-            double v2 = EvaluateSubtree(ast->Right);
-            switch (ast->Type)
-            {
-            case OperatorPlus:
-                return v1 + v2;
-            case OperatorMinus:
-                return v1 - v2;
-            case OperatorMul:
-                return v1 * v2;
-            case OperatorDiv:
-                return v1 / v2;
-            }
+        case 0:
+            std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+            break;
+        case 1:
+            std::snprintf(buffer, sizeof(buffer), "%.*g", int(1 + random() % 17), value);
+            break;
+        case 2:
+            std::snprintf(buffer, sizeof(buffer), "%a", value);
+            break;
+        default:
+        {
+            //随机的数字串,长度与指数都覆盖快速路径的边界
+            std::string digits = std::to_string(1 + random() % 9);
+            for (std::size_t i = random() % 30; i > 0; i--)
+                digits += char('0' + random() % 10);
+            if (random() % 2)
+                digits.insert(1 + random() % digits.size(), ".");
+            if (random() % 2)
+                digits += "e" + std::to_string(int(random() % 700) - 350);
+            std::snprintf(buffer, sizeof(buffer), "%s", digits.c_str());
         }
-
-        throw EvaluatorException("Incorrect syntax tree!");
+        }
+        texts.push_back(buffer);
     }
 
-public:
-    double Evalute(ASTNode *ast)
+    std::size_t mismatches = 0;
+    std::size_t literals = 0;
+    std::size_t staticMismatches = 0;
+    for (const std::string &text : texts)
     {
-        if (ast == nullptr)
-            throw EvaluatorException("Incorrect abstract syntax tree");
-        return EvaluateSubtree(ast);
+        char *end;
+        double expected = std::strtod(text.c_str(), &end);
+        NumberScanResult result = ScanNumber(text.data(), text.data() + text.size());
+        if (std::memcmp(&expected, &result.Value, sizeof(double)) != 0 || result.End != end)
+        {
+            if (mismatches++ < 5)
+                std::cout << "\"" << text << "\"\t strtod " << expected << ", scanned " << result.Value << "\n";
+        }
+
+        //编译期解析器在运行时调用,只比较它接受的十进制字面量
+        if (result.End != text.data() + text.size() || text.find_first_of("xX") != std::string::npos)
+            continue;
+        StaticTree<64> tree = StaticParser<64>(text).Parse();
+        literals++;
+        if (std::memcmp(&tree.Nodes[tree.Root].Value, &result.Value, sizeof(double)) != 0 && staticMismatches++ < 5)
+            std::cout << "\"" << text << "\"\t scanned " << result.Value << ", static " << tree.Nodes[tree.Root].Value << "\n";
     }
-};
+    std::cout << texts.size() << " numbers scanned, " << mismatches << " mismatches with strtod; " << literals
+              << " decimal literals, " << staticMismatches << " mismatches with the compile-time parser" << std::endl;
+}
 
-void Test(const char *text)
+//并行运算的结果必须与逐个运算的结果一致且保持输入顺序
+void TestParallel(std::size_t count)
 {
-    Parser parser;
-    try
+    std::vector<std::string> expressions;
+    for (std::size_t i = 0; i < count; i++)
     {
-        auto result = parser.Parse(text);
-        std::cout << "\"" << text << "\"\t OK\n";
+        std::string text = std::to_string(i) + " * (" + std::to_string(i % 7) + " - 2.5) / 3";
+        expressions.push_back(i % 97 == 0 ? text + " &" : text);
+    }
 
+    auto start = std::chrono::steady_clock::now();
+    auto results = EvaluateExpressions(expressions);
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::size_t failed = 0;
+    std::size_t mismatches = 0;
+    ASTArena arena;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        failed += results[i].Ok ? 0 : 1;
+        arena.Reset();
         try
         {
-            Evaluator eval;
-            double val = eval.Evalute(result);
-            std::cout << text << " = " << val << std::endl;
+            double expected = Evaluator{}.Evalute(arena, Parser{}.Parse(expressions[i].c_str(), arena));
+            mismatches += (results[i].Ok && results[i].Value == expected) ? 0 : 1;
         }
-        catch (EvaluatorException &ex)
+        catch (ParserException &)
         {
-            std::cout << text << " \t " << ex.what() << std::endl;
+            mismatches += results[i].Ok ? 1 : 0;
         }
-        delete result;
     }
-    catch (ParserException &ex)
+    std::cout << count << " expressions in " << elapsed << " ms (" << std::thread::hardware_concurrency() << " threads), "
+              << failed << " failed, " << mismatches << " mismatches" << std::endl;
+}
+
+//随机的合法表达式,含常量、变量、一元负号、扩展运算符与函数调用
+std::string RandomExpression(std::mt19937 &random, int depth)
+{
+    const char *atoms[] = {"1", "2", "2.5", "0.1", "1e3", "3.14159", "x", "y", "rate", "-0.0"};
+    const char *ops[] = {" + ", " - ", " * ", " / ", "^", " < "};
+    switch (depth <= 0 ? 0 : random() % 6)
     {
-        std::cout << "\"" << text << "\"\t " << ex.what() << "\n";
+    case 0:
+    case 1:
+        return atoms[random() % 10];
+    case 2:
+        return "-(" + RandomExpression(random, depth - 1) + ")";
+    case 3:
+        return (random() % 2 ? "sqrt(" : "abs(") + RandomExpression(random, depth - 1) + ")";
+    case 4:
+        return "max(" + RandomExpression(random, depth - 1) + ", " + RandomExpression(random, depth - 1) + ")";
+    default:
+        return "(" + RandomExpression(random, depth - 1) + ops[random() % 6] + RandomExpression(random, depth - 1) + ")";
     }
 }
-int main()
+
+//大量常驻表达式:语法树节点与 8 字节紧凑节点的内存、结果与运算耗时比较
+void TestCompact(std::size_t count)
 {
-    Test("1+2*3");
+    std::mt19937 random(23);
+    Parser parser(OperatorTable::Extended());
+    ASTArena arena;
+    VariableTable variables;
+    std::vector<NodeIndex> roots;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::string text = RandomExpression(random, 1 + random() % 6);
+        roots.push_back(parser.Parse(text.data(), text.size(), arena, variables));
+    }
+
+    CompactArena compact;
+    std::vector<CompactExpression> expressions;
+    for (NodeIndex root : roots)
+        expressions.push_back(compact.Add(arena, root));
+    compact.ReleaseIndex();
+
+    CompactArena optimized;
+    CompactOptimizer optimizer;
+    std::vector<CompactExpression> folded;
+    for (const CompactExpression &expression : expressions)
+        folded.push_back(optimizer.Optimize(compact, expression, optimized));
+    optimized.ReleaseIndex();
+
+    std::vector<double> values(variables.Size());
+    for (std::size_t slot = 0; slot < values.size(); slot++)
+        values[slot] = 0.75 + slot;
+    Evaluator eval;
+    CompactEvaluator compactEval;
+    std::size_t mismatches = 0;
+    auto same = [](double a, double b) { return std::isnan(a) ? std::isnan(b) : std::memcmp(&a, &b, sizeof(double)) == 0; };
+    for (std::size_t i = 0; i < count; i++)
+    {
+        double expected = eval.Evalute(arena, roots[i], values.data());
+        ASTArena decoded;
+        NodeIndex root = compact.Decode(expressions[i], decoded);
+        mismatches += !same(expected, compactEval.Evaluate(compact, expressions[i], values.data()));
+        mismatches += !same(expected, compactEval.Evaluate(optimized, folded[i], values.data()));
+        mismatches += !same(expected, eval.Evalute(decoded, root, values.data()));
+    }
+
+    double sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+        sum += eval.Evalute(arena, roots[i], values.data());
+    auto middle = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++)
+        sum -= compactEval.Evaluate(compact, expressions[i], values.data());
+    auto end = std::chrono::steady_clock::now();
+
+    std::size_t treeBytes = arena.Size() * sizeof(ASTNode);
+    std::cout << count << " expressions, " << arena.Size() << " nodes: syntax tree " << treeBytes / 1024 << " KB, compact "
+              << compact.MemoryUsage() / 1024 << " KB (" << compact.ConstantCount() << " pooled constants, "
+              << double(treeBytes) / compact.MemoryUsage() << "x smaller), folded " << optimized.Size() << " nodes "
+              << optimized.MemoryUsage() / 1024 << " KB, " << mismatches << " mismatches" << std::endl;
+    std::cout << "evaluate all: syntax tree " << std::chrono::duration<double, std::milli>(middle - start).count()
+              << " ms, compact " << std::chrono::duration<double, std::milli>(end - middle).count() << " ms"
+              << (sum == 0 || sum != sum ? "" : " (DIFFERENT)") << std::endl;
+}
+
+//两棵树的结构、节点类型、数值(按位)与槽位都相同
+bool SameTree(const ASTArena &a, NodeIndex rootA, const ASTArena &b, NodeIndex rootB)
+{
+    std::vector<std::pair<NodeIndex, NodeIndex>> pending{{rootA, rootB}};
+    while (!pending.empty())
+    {
+        auto [x, y] = pending.back();
+        pending.pop_back();
+        if ((x == InvalidNode) != (y == InvalidNode))
+            return false;
+        if (x == InvalidNode)
+            continue;
+        const ASTNode &p = a[x];
+        const ASTNode &q = b[y];
+        if (p.Type != q.Type || p.Slot != q.Slot || std::memcmp(&p.Value, &q.Value, sizeof(double)) != 0)
+            return false;
+        pending.push_back({p.Left, q.Left});
+        pending.push_back({p.Right, q.Right});
+    }
+    return true;
+}
+
+//切分后并行解析:语法树、变量槽位与错误信息须与顺序解析相同;很长的表达式比较耗时
+void TestParallelParse(std::size_t count)
+{
+    std::mt19937 random(24);
+    WorkStealingPool pool;
+    Parser parser(OperatorTable::Extended());
+    //段很短,几乎每个表达式都会被切开
+    ParallelParser tiny(pool, OperatorTable::Extended(), Parser::DefaultMaxDepth, 8);
+    const char *joins[] = {" + ", " - ", " * ", " < ", " == ", "+", " ^ "};
+    const char noise[] = "+-*/<=()x0e ,&";
+    std::size_t split = 0;
+    std::size_t failures = 0;
+    std::size_t mismatches = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::string text = RandomExpression(random, 3);
+        for (int k = 0, terms = random() % 8; k < terms; k++)
+            text += joins[random() % 7] + RandomExpression(random, 3);
+        if (random() % 4 == 0)
+            text[random() % text.size()] = noise[random() % (sizeof(noise) - 1)];
+
+        ASTArena arena, parallelArena;
+        VariableTable variables, parallelVariables;
+        ParseResult expected = parser.Parse(std::nothrow, text.data(), text.size(), arena, variables);
+        ParseResult result = tiny.Parse(std::nothrow, text.data(), text.size(), parallelArena, parallelVariables);
+        split += tiny.LastSegments() > 1;
+        failures += !expected;
+        bool same = expected.Error.Message() == result.Error.Message() && variables.Names() == parallelVariables.Names() &&
+                    (!expected || SameTree(arena, expected.Root, parallelArena, result.Root));
+        if (!same && mismatches++ < 5)
+            std::cout << "\"" << text << "\"\t" << expected.Error.Message() << " | " << result.Error.Message() << "\n";
+    }
+    std::cout << count << " expressions (" << split << " split, " << failures << " malformed), " << mismatches
+              << " mismatches with sequential parsing" << std::endl;
+
+    //模型导出的长表达式:许多项的和,项内有括号、函数调用与变量
+    std::string text;
+    for (std::size_t i = 0; text.size() < (64 << 20); i++)
+    {
+        std::string k = std::to_string(i % 997);
+        text += (i == 0 ? "" : " + ") + ("w" + k) + " * max(x" + std::to_string(i % 13) + " - " + k + ".5, 0) / (1 + exp(-b" +
+                std::to_string(i % 31) + "))";
+    }
+    ASTArena arena, parallelArena;
+    VariableTable variables, parallelVariables;
+    ParallelParser parallel(pool);
+    auto start = std::chrono::steady_clock::now();
+    NodeIndex root = Parser{}.Parse(text.data(), text.size(), arena, variables);
+    auto middle = std::chrono::steady_clock::now();
+    NodeIndex parallelRoot = parallel.Parse(text.data(), text.size(), parallelArena, parallelVariables);
+    auto end = std::chrono::steady_clock::now();
+    bool same = SameTree(arena, root, parallelArena, parallelRoot) && variables.Names() == parallelVariables.Names();
+    std::cout << text.size() / (1 << 20) << " MB expression: sequential " << std::chrono::duration<double, std::milli>(middle - start).count()
+              << " ms, parallel " << std::chrono::duration<double, std::milli>(end - middle).count() << " ms ("
+              << parallel.LastSegments() << " segments, " << pool.Size() << " threads), "
+              << (same ? "same tree" : "DIFFERENT TREE") << std::endl;
+    //单核上只能说明切分本身不比顺序解析慢,多核上的加速需要在多核机器上另行测量
+    if (std::thread::hardware_concurrency() < 2)
+        std::cout << "parallel-capable, speedup unmeasured: only one hardware thread" << std::endl;
+}
+
+//读者在多个线程中不停地运算具名公式,写者同时不断发布新版本;每个版本的结果由版本号决定,
+//读到已释放或不完整的版本时结果就会对不上
+void TestRegistry(std::size_t names, std::size_t updates)
+{
+    ExpressionRegistry registry(names);
+    auto formula = [](std::size_t i, std::uint64_t version) {
+        return std::to_string(i) + " + x * " + std::to_string(version);
+    };
+    std::vector<std::uint32_t> ids;
+    for (std::size_t i = 0; i < names; i++)
+        ids.push_back(registry.Publish("f" + std::to_string(i), formula(i, 1).c_str()));
+
+    std::atomic<bool> stop{false};
+    std::atomic<std::uint64_t> reads{0};
+    std::atomic<std::uint64_t> mismatches{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++)
+    {
+        readers.emplace_back([&, t] {
+            ExpressionRegistry::Reader reader(registry);
+            std::mt19937 random(t);
+            VirtualMachine vm;
+            const double x = 2;
+            std::uint64_t count = 0;
+            std::uint64_t wrong = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                ExpressionRegistry::ReadGuard guard(reader);
+                for (int k = 0; k < 64; k++)
+                {
+                    std::size_t i = random() % names;
+                    const PublishedExpression *published = guard.Get(ids[i]);
+                    double value = vm.Run(published->Expression.Code, &x);
+                    wrong += value == static_cast<double>(i) + x * published->Version ? 0 : 1;
+                    count++;
+                }
+            }
+            reads += count;
+            mismatches += wrong;
+        });
+    }
+
+    std::mt19937 random(25);
+    std::vector<std::uint64_t> versions(names, 1);
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t u = 0; u < updates; u++)
+    {
+        std::size_t i = random() % names;
+        registry.Publish(registry.Name(ids[i]), formula(i, ++versions[i]).c_str());
+    }
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stop = true;
+    for (std::thread &reader : readers)
+        reader.join();
+    registry.Reclaim();
+
+    ExpressionRegistryStats stats = registry.Stats();
+    std::cout << "registry: " << stats.Names << " names, " << updates << " updates in " << elapsed << " ms, " << reads
+              << " reads (3 threads), " << stats.Reclaimed << " versions reclaimed, " << stats.Pending << " pending, "
+              << mismatches << " mismatches" << std::endl;
+}
+
+void PrintStats(const ExpressionStats &stats)
+{
+    if (!EXPRESSION_STATS)
+    {
+        std::fputs("statistics are not compiled in, rebuild with -DEXPRESSION_STATS=ON\n", stderr);
+        return;
+    }
+    stats.Print(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    bool stats = argc > 1 && std::strcmp(argv[1], "--stats") == 0;
+    ASTArena arena;
+    Test("1+2*3", arena);
+    Test("1-2-3-4", arena);
+    Test("1/2/3/4", arena);
+    Test("(1+2)*(3+4)", arena);
+    Test("1+(2*3)/4+5", arena);
+    Test("-1+(-2.0)", arena);
+
+    TestBatch("price * (1 - discount)", 1000);
+    TestBatch("-(a + b) / (c - a * 2)", 1027);
+    TestBatch("42", 3);
+
+    TestOptimize("1+2*3", true);
+    TestOptimize("price * (1 - discount)", true);
+    TestOptimize("price * (1 - discount)", false);
+    TestOptimize("-(-x) / 4 + y * -1", true);
+
+    TestJit("1+2*3");
+    TestJit("price * (1 - discount)");
+    TestJit("-(a + b) / (c - a * 2) * (b - (c / a - 1))");
+
+    TestOperators();
+    TestLongExpressions();
+    TestDag(3);
+    TestDag(7);
+    TestDagForest();
+
+    TestCache();
+    TestFormulaGraph(2000);
+
+    TestParseErrors();
+    TestTokenBuffer();
+    TestPushParser(100000);
+    TestFunctions();
+    TestStatic<PriceFormula>("price * (1 - discount) + tax / 2", g_PriceTree);
+    TestStatic<ChainFormula>("-(a + b) / (c - a * 2) * (b - (c / a - 1))", g_ChainTree);
+    TestNumberScan(200000);
+
+    TestImage(20000);
+    TestCompact(200000);
+    //只统计主线程,不含 TestParallel 中的工作线程
+    if (stats)
+        PrintStats(ThreadExpressionStats());
+    TestParallel(100000);
+    TestParallelParse(100000);
+    TestRegistry(2000, 50000);
     return 0;
 }
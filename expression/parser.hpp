@@ -0,0 +1,988 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <string_view>
+#include <vector>
+
+#include "ast.hpp"
+#include "numberscan.hpp"
+#include "textscan.hpp"
+
+enum TokenType
+{
+    Error,
+    Plus,
+    Minus,
+    Mul,
+    Div,
+    EndOfText,
+    OpenParenthesis,
+    CloseParenthesis,
+    Number,
+    Identifier,
+    Operator,     //OperatorTable 中 + - * / 以外的运算符
+    FunctionName, //后面(可隔着空白)紧跟 '(' 的标识符,令牌包含这个 '('
+    Comma
+};
+
+//令牌类型的集合,第 n 位对应 TokenType n
+using TokenSet = std::uint32_t;
+
+constexpr TokenSet TokenBit(TokenType type)
+{
+    return TokenSet(1) << type;
+}
+
+constexpr TokenSet OperandTokens = TokenBit(OpenParenthesis) | TokenBit(Minus) | TokenBit(Number) | TokenBit(FunctionName);
+
+inline const char *TokenName(TokenType type)
+{
+    switch (type)
+    {
+    case Plus:
+        return "'+'";
+    case Minus:
+        return "'-'";
+    case Mul:
+        return "'*'";
+    case Div:
+        return "'/'";
+    case EndOfText:
+        return "end of text";
+    case OpenParenthesis:
+        return "'('";
+    case CloseParenthesis:
+        return "')'";
+    case Number:
+        return "number";
+    case Identifier:
+        return "identifier";
+    case Operator:
+        return "operator";
+    case FunctionName:
+        return "function";
+    case Comma:
+        return "','";
+    default:
+        return "invalid token";
+    }
+}
+
+enum ParseErrorCode
+{
+    ParseOk,
+    ParseUnexpectedToken,     //令牌合法但不该出现在此处
+    ParseUnexpectedCharacter, //无法识别的字符
+    ParseMissingParenthesis,  //缺少 ')'
+    ParseTooDeep,             //括号、一元负号或右结合运算符嵌套超过 Parser 的深度限制
+    ParseUnknownFunction,     //FunctionRegistry 中没有这个函数
+    ParseArgumentCount        //参数个数与函数不一致
+};
+
+//解析错误的结构化描述;消息文本只在调用 Message() 时才生成
+struct ParseError
+{
+    ParseErrorCode Code = ParseOk;
+    size_t Offset = 0;       //出错令牌的字节偏移
+    TokenType Found = Error; //出错位置实际遇到的令牌
+    char Symbol = 0;         //出错位置的字符
+    TokenSet Expected = 0;   //此处允许出现的令牌
+
+    std::string Message() const
+    {
+        std::string message;
+        switch (Code)
+        {
+        case ParseOk:
+            return "No error";
+        case ParseUnexpectedToken:
+            if (Found == EndOfText)
+                message = "Unexpected end of text";
+            else
+                message = std::string("Unexpected token '") + Symbol + "'";
+            break;
+        case ParseUnexpectedCharacter:
+            message = std::string("Unexpected character '") + Symbol + "'";
+            break;
+        case ParseMissingParenthesis:
+            message = "Expected token ')'";
+            break;
+        case ParseTooDeep:
+            message = "Expression nested too deeply";
+            break;
+        case ParseUnknownFunction:
+            message = "Unknown function";
+            break;
+        case ParseArgumentCount:
+            message = "Wrong number of arguments";
+            break;
+        }
+        message += " at position " + std::to_string(Offset);
+
+        const char *separator = ", expected ";
+        for (int type = Plus; type <= Comma; type++)
+        {
+            if (Expected & TokenBit(TokenType(type)))
+            {
+                message += separator;
+                message += TokenName(TokenType(type));
+                separator = " or ";
+            }
+        }
+        return message;
+    }
+};
+
+//不抛出异常的 Parse 的返回值:成功时 Root 为根节点,失败时 Error 描述错误
+struct ParseResult
+{
+    NodeIndex Root = InvalidNode;
+    ParseError Error;
+
+    bool Ok() const noexcept
+    {
+        return Error.Code == ParseOk;
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return Ok();
+    }
+};
+
+enum Associativity
+{
+    LeftAssociative,
+    RightAssociative
+};
+
+struct OperatorInfo
+{
+    std::string Symbol;
+    int Precedence; //越大结合越紧
+    Associativity Assoc;
+    ASTNodeType Node;
+    TokenType Token; //+ - * / 为各自的令牌类型,其它运算符为 Operator
+};
+
+//二元运算符表,解析器按表中的优先级与结合性构造语法树;默认只有 + - * /,可以用 Add 扩展
+class OperatorTable
+{
+    std::vector<OperatorInfo> m_Operators;
+    int m_UnaryPrecedence = 25; //一元负号:高于 * /,低于 ^,即 -2^2 为 -(2^2)
+    TokenSet m_Tokens = 0;
+    std::size_t m_LongestSymbol = 0;
+
+public:
+    OperatorTable()
+    {
+        Add("+", 10, LeftAssociative, OperatorPlus);
+        Add("-", 10, LeftAssociative, OperatorMinus);
+        Add("*", 20, LeftAssociative, OperatorMul);
+        Add("/", 20, LeftAssociative, OperatorDiv);
+    }
+
+    //在默认运算符之外加入 ^(右结合)、% 与比较运算符
+    static OperatorTable Extended()
+    {
+        OperatorTable table;
+        table.Add("%", 20, LeftAssociative, OperatorMod);
+        table.Add("^", 30, RightAssociative, OperatorPow);
+        table.Add("<", 5, LeftAssociative, OperatorLess);
+        table.Add("<=", 5, LeftAssociative, OperatorLessEqual);
+        table.Add(">", 5, LeftAssociative, OperatorGreater);
+        table.Add(">=", 5, LeftAssociative, OperatorGreaterEqual);
+        table.Add("==", 4, LeftAssociative, OperatorEqual);
+        table.Add("!=", 4, LeftAssociative, OperatorNotEqual);
+        return table;
+    }
+
+    //symbol 已存在时替换原有定义;node 必须是二元运算节点
+    void Add(const std::string &symbol, int precedence, Associativity assoc, ASTNodeType node)
+    {
+        if (symbol.empty() || !IsBinaryOperator(node))
+            throw std::invalid_argument("Invalid operator definition");
+        for (char ch : symbol)
+        {
+            if (ch == 0 || IsAsciiAlnum(ch) || IsAsciiSpace(ch) ||
+                std::strchr("_().,", ch) != nullptr)
+                throw std::invalid_argument("Operator symbol '" + symbol + "' conflicts with other tokens");
+        }
+
+        TokenType token = Operator;
+        if (symbol.size() == 1)
+        {
+            const char builtin[] = "+-*/";
+            if (const char *found = std::strchr(builtin, symbol[0]))
+                token = static_cast<TokenType>(Plus + (found - builtin));
+        }
+        OperatorInfo info{symbol, precedence, assoc, node, token};
+        m_Tokens |= TokenBit(token);
+        m_LongestSymbol = symbol.size() > m_LongestSymbol ? symbol.size() : m_LongestSymbol;
+        for (OperatorInfo &existing : m_Operators)
+        {
+            if (existing.Symbol == symbol)
+            {
+                existing = info;
+                return;
+            }
+        }
+        m_Operators.push_back(info);
+    }
+
+    //[text, end) 开头最长的运算符,没有时返回 false
+    bool Match(const char *text, const char *end, std::uint32_t &index) const
+    {
+        std::size_t longest = 0;
+        for (std::size_t i = 0; i < m_Operators.size(); i++)
+        {
+            const std::string &symbol = m_Operators[i].Symbol;
+            if (symbol[0] == text[0] && symbol.size() > longest && symbol.size() <= std::size_t(end - text) &&
+                symbol.compare(0, symbol.size(), text, symbol.size()) == 0)
+            {
+                longest = symbol.size();
+                index = static_cast<std::uint32_t>(i);
+            }
+        }
+        return longest != 0;
+    }
+
+    const OperatorInfo &operator[](std::uint32_t index) const
+    {
+        return m_Operators[index];
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Operators.size();
+    }
+
+    int UnaryPrecedence() const noexcept
+    {
+        return m_UnaryPrecedence;
+    }
+
+    void SetUnaryPrecedence(int precedence) noexcept
+    {
+        m_UnaryPrecedence = precedence;
+    }
+
+    //表中运算符对应的令牌类型集合,用于错误信息中期望的令牌
+    TokenSet Tokens() const noexcept
+    {
+        return m_Tokens;
+    }
+
+    //最长的运算符的字节数;分块输入时,距块尾不足这个长度的运算符可能还没有结束
+    std::size_t LongestSymbol() const noexcept
+    {
+        return m_LongestSymbol;
+    }
+};
+
+//可能是运算符一部分的字符,与 OperatorTable::Add 的限制一致
+inline bool IsOperatorCharacter(char ch)
+{
+    return ch != 0 && !IsAsciiAlnum(ch) && !IsAsciiSpace(ch) && std::strchr("_().,", ch) == nullptr;
+}
+
+//prev 之后的 ch 是否可能接续同一个数值(含后面紧跟的字母,例如 "2e" 可能成为 "2e5"):
+//数字、字母、'_'、'.' 以及指数标记之后的符号
+inline bool IsNumberContinuation(char prev, char ch)
+{
+    if (ch == '+' || ch == '-')
+        return prev == 'e' || prev == 'E' || prev == 'p' || prev == 'P';
+    return IsIdentifierCharacter(ch) || ch == '.';
+}
+
+enum TokenizeMode
+{
+    TokenizeAll, //输入到此结束,末尾追加 EndOfText
+    TokenizeHold,    //后面还有输入,延伸到末尾、可能还没有结束的令牌不追加
+    TokenizeVariable //同 TokenizeHold,但已知末尾的标识符之后不是 '(',直接作为变量追加
+};
+
+//一次词法分析的全部令牌,各字段分别存放在连续的数组中,第 i 个令牌的类型、起始偏移、数值与附加信息下标都是 i.
+//完整的输入以 EndOfText 结尾,或是无法识别的输入处的 Error(此时不再继续分析).只保存文本的指针,文本须在使用期间保持有效;
+//同一个 TokenBuffer 反复用于不同的输入时,容量足够就不再分配内存
+class TokenBuffer
+{
+    static constexpr std::uint32_t NoOperator = 0xFFFFFFFFu;
+
+    const char *m_Text = nullptr;
+    std::size_t m_Base = 0; //m_Text 在整个输入中的偏移
+    std::size_t m_Size = 0;
+    std::vector<std::uint8_t> m_Types;
+    std::vector<std::uint32_t> m_Offsets; //相对整个输入
+    std::vector<std::uint32_t> m_Extras;  //运算符令牌为 OperatorTable 中的下标,标识符与函数名为名称长度,数值为 m_Values 中的下标
+    std::vector<double> m_Values;         //只保存数值令牌的值
+
+    static constexpr std::size_t InitialCapacity = 64;
+
+    void Reset(const char *text, std::size_t length, std::size_t base)
+    {
+        if (length >= NoOperator || base >= NoOperator - length)
+            throw std::length_error("Text too long to tokenize!");
+        m_Text = text;
+        m_Base = base;
+        m_Size = 0;
+    }
+
+    //令牌数组按需成倍扩容,不超过令牌个数的上限 length + 1;长文本不再预先按字节数分配
+    void GrowTokens(std::size_t length)
+    {
+        std::size_t capacity = std::min(length + 1, std::max(InitialCapacity, m_Types.size() * 2));
+        m_Types.resize(capacity);
+        m_Offsets.resize(capacity);
+        m_Extras.resize(capacity);
+    }
+
+    void GrowValues()
+    {
+        m_Values.resize(std::max(InitialCapacity, m_Values.size() * 2));
+    }
+
+public:
+    //一趟扫描 [text, text + length);运算符按 operators 识别,解析时须使用同一张表
+    void Tokenize(const char *text, std::size_t length, const OperatorTable &operators)
+    {
+        Tokenize(text, length, operators, 0, TokenizeAll);
+    }
+
+    //扫描分块输入中的一块,base 为 text 在整个输入中的偏移,令牌的偏移相对整个输入.
+    //遇到 NUL 时追加 EndOfText 并结束;遇到无法识别的字符时追加 Error 并结束;
+    //返回已经处理的字节数,TokenizeHold 时其后是尚未结束的令牌,需要与后续输入一起重新扫描
+    std::size_t Tokenize(const char *text, std::size_t length, const OperatorTable &operators, std::size_t base, TokenizeMode mode)
+    {
+        Reset(text, length, base);
+        //写入 uint8_t 数组可能与任何对象重叠,用局部指针避免每个令牌之后重新读取成员
+        std::uint8_t *types = m_Types.data();
+        std::uint32_t *offsets = m_Offsets.data();
+        std::uint32_t *extras = m_Extras.data();
+        std::size_t capacity = m_Types.size();
+        double *values = m_Values.data();
+        std::size_t numbers = 0;
+        std::size_t count = 0;
+        auto append = [&](TokenType type, std::size_t offset) {
+            if (count == capacity)
+            {
+                GrowTokens(length);
+                types = m_Types.data();
+                offsets = m_Offsets.data();
+                extras = m_Extras.data();
+                capacity = m_Types.size();
+            }
+            types[count] = static_cast<std::uint8_t>(type);
+            offsets[count] = static_cast<std::uint32_t>(base + offset);
+            return count++;
+        };
+        //先追加再写入附加值:append 可能扩容,不能写成 extras[append(...)]
+        auto appendExtra = [&](TokenType type, std::size_t offset, std::uint32_t extra) {
+            std::size_t token = append(type, offset);
+            extras[token] = extra;
+        };
+        //运算符或无法识别的字符之后到末尾都是运算符字符且不够最长的运算符,后续输入可能把它变成更长的运算符
+        bool hold = mode != TokenizeAll;
+        auto holdOperator = [&](std::size_t index) {
+            if (!hold || length - index >= operators.LongestSymbol())
+                return false;
+            for (std::size_t i = index; i < length; i++)
+            {
+                if (!IsOperatorCharacter(text[i]))
+                    return false;
+            }
+            return true;
+        };
+
+        const char *end = text + length;
+        std::size_t index = 0;
+        for (;;)
+        {
+            //大多数令牌之间最多一个空格,先逐字节判断,遇到成段的空白再交给向量化的 SkipWhitespace
+            if (index < length && IsAsciiSpace(text[index]))
+            {
+                index++;
+                if (index < length && IsAsciiSpace(text[index]))
+                    index = SkipWhitespace(text + index, end) - text;
+            }
+
+            if (index == length)
+            {
+                if (mode == TokenizeAll)
+                    append(EndOfText, index);
+                break;
+            }
+
+            //遇到 NUL 时结束,与 NUL 结尾的字符串一致
+            char ch = text[index];
+            if (ch == 0)
+            {
+                append(EndOfText, index);
+                break;
+            }
+
+            if (IsDecimalDigit(ch))
+            {
+                NumberScanResult number = ScanNumber(text + index, end);
+                if (hold)
+                {
+                    const char *p = number.End;
+                    while (p != end && IsNumberContinuation(p[-1], *p))
+                        p++;
+                    if (p == end)
+                        break;
+                }
+                if (numbers == m_Values.size())
+                {
+                    GrowValues();
+                    values = m_Values.data();
+                }
+                values[numbers] = number.Value;
+                appendExtra(Number, index, static_cast<std::uint32_t>(numbers++));
+                index = number.End - text;
+                continue;
+            }
+
+            //标识符之后是否为 '(' 决定它是变量还是函数名;之后到末尾只有空白时还无法判断
+            if (IsIdentifierStart(ch))
+            {
+                std::size_t start = index;
+                while (index < length && IsIdentifierCharacter(text[index]))
+                    index++;
+                std::size_t next = index;
+                while (next < length && IsAsciiSpace(text[next]))
+                    next++;
+                if (hold && next == length && mode != TokenizeVariable)
+                {
+                    index = start;
+                    break;
+                }
+                bool call = next < length && text[next] == '(';
+                appendExtra(call ? FunctionName : Identifier, start, static_cast<std::uint32_t>(index - start));
+                index = call ? next + 1 : index;
+                continue;
+            }
+
+            if (ch == '(' || ch == ')')
+            {
+                append(ch == '(' ? OpenParenthesis : CloseParenthesis, index++);
+                continue;
+            }
+
+            if (ch == ',')
+            {
+                append(Comma, index++);
+                continue;
+            }
+
+            if (holdOperator(index))
+                break;
+
+            std::uint32_t op;
+            if (operators.Match(text + index, end, op))
+            {
+                appendExtra(operators[op].Token, index, op);
+                index += operators[op].Symbol.size();
+                continue;
+            }
+
+            //运算符表中没有 '-' 时仍然允许一元负号
+            if (ch == '-')
+            {
+                appendExtra(Minus, index++, NoOperator);
+                continue;
+            }
+
+            //无法识别的字符:停在此处,由语法分析决定如何报告
+            append(Error, index);
+            break;
+        }
+        m_Size = count;
+        EXPRESSION_STATS_ADD(Tokens, count);
+        return index;
+    }
+
+    //令牌个数,含末尾的 EndOfText 或 Error
+    std::size_t Size() const noexcept
+    {
+        return m_Size;
+    }
+
+    const char *Text() const noexcept
+    {
+        return m_Text;
+    }
+
+    TokenType Type(std::size_t index) const
+    {
+        return static_cast<TokenType>(m_Types[index]);
+    }
+
+    //令牌起始的字节偏移
+    std::size_t Offset(std::size_t index) const
+    {
+        return m_Offsets[index];
+    }
+
+    //令牌的第一个字符,EndOfText 为 '\0'
+    char Symbol(std::size_t index) const
+    {
+        return Type(index) == EndOfText ? '\0' : m_Text[m_Offsets[index] - m_Base];
+    }
+
+    //仅对 Number 有意义
+    double Value(std::size_t index) const
+    {
+        return m_Values[m_Extras[index]];
+    }
+
+    //仅对 Identifier 与 FunctionName 有意义
+    std::string_view Name(std::size_t index) const
+    {
+        return std::string_view(m_Text + (m_Offsets[index] - m_Base), m_Extras[index]);
+    }
+
+    //运算符令牌在 OperatorTable 中的下标;不在表中的一元负号返回 0xFFFFFFFF
+    std::uint32_t Operator(std::size_t index) const
+    {
+        return m_Extras[index];
+    }
+};
+
+class ParserException : public std::runtime_error
+{
+    int m_Pos;
+    ParseError m_Error;
+
+public:
+    explicit ParserException(const ParseError &error)
+        : std::runtime_error(error.Message()),
+          m_Pos{int(error.Offset)},
+          m_Error(error){};
+
+    int Position() const noexcept
+    {
+        return m_Pos;
+    }
+
+    const ParseError &Error() const noexcept
+    {
+        return m_Error;
+    }
+};
+
+class PushParser;
+class ParallelParser;
+
+//优先级爬升解析器:按 OperatorTable 在一个循环中归约,运算符与操作数放在显式的栈上,
+//调用栈深度与表达式长度无关;出错时不抛出异常,而是记录第一个错误并返回 InvalidNode
+class Parser
+{
+    friend class PushParser;
+    friend class ParallelParser;
+
+    //运算符栈中除了 OperatorTable 的下标外,还有一元负号、左括号与函数调用的左括号
+    static constexpr std::uint32_t PendingCall = 0xFFFFFFFDu;
+    static constexpr std::uint32_t PendingUnary = 0xFFFFFFFEu;
+    static constexpr std::uint32_t PendingParenthesis = 0xFFFFFFFFu;
+
+    //尚未结束的函数调用,与运算符栈中的 PendingCall 一一对应
+    struct Call
+    {
+        std::uint32_t Function; //FunctionRegistry 中的编号
+        std::uint32_t Arguments;
+    };
+
+    TokenBuffer m_Buffer; //从文本解析时使用,跨调用复用
+    const TokenBuffer *m_Tokens;
+    size_t m_Cursor; //当前令牌的下标
+    ASTArena *m_Arena;
+    VariableTable *m_Variables;
+    ParseError m_Error;
+
+    OperatorTable m_Table;
+    size_t m_MaxDepth;
+    std::vector<NodeIndex> m_Operands;
+    std::vector<std::uint32_t> m_Operators;
+    std::vector<Call> m_Calls;
+    size_t m_OpenParentheses = 0; //含函数调用的括号
+    bool m_ExpectOperand = true;
+    bool m_Suspended = false; //令牌用完但表达式还没有结束,等待后续输入
+
+private:
+    NodeIndex CreateNode(ASTNodeType type, NodeIndex left, NodeIndex right)
+    {
+        return m_Arena->Create(type, left, right);
+    }
+    NodeIndex CreateUnaryNode(NodeIndex left)
+    {
+        return m_Arena->Create(UnaryMinus, left, InvalidNode);
+    }
+
+    NodeIndex CreateNodeNumber(double value)
+    {
+        return m_Arena->Create(NumberValue, InvalidNode, InvalidNode, value);
+    }
+
+    NodeIndex CreateNodeVariable(std::uint32_t slot)
+    {
+        return m_Arena->Create(VariableValue, InvalidNode, InvalidNode, 0, slot);
+    }
+
+    NodeIndex CreateNodeCall(std::uint32_t function, NodeIndex left, NodeIndex right)
+    {
+        return m_Arena->Create(FunctionCall, left, right, 0, function);
+    }
+
+    //在当前令牌处记录错误;词法错误优先于语法错误
+    NodeIndex Fail(ParseErrorCode code, TokenSet expected)
+    {
+        TokenType type = m_Tokens->Type(m_Cursor);
+        m_Error.Code = type == Error ? ParseUnexpectedCharacter : code;
+        m_Error.Offset = m_Tokens->Offset(m_Cursor);
+        m_Error.Found = type;
+        m_Error.Symbol = m_Tokens->Symbol(m_Cursor);
+        m_Error.Expected = expected;
+        return InvalidNode;
+    }
+
+    bool PushOperator(std::uint32_t op)
+    {
+        if (m_Operators.size() >= m_MaxDepth)
+        {
+            Fail(ParseTooDeep, 0);
+            return false;
+        }
+        m_Operators.push_back(op);
+        return true;
+    }
+
+    //用栈顶的运算符归约栈顶的操作数
+    void Reduce()
+    {
+        std::uint32_t op = m_Operators.back();
+        m_Operators.pop_back();
+        if (op == PendingUnary)
+        {
+            m_Operands.back() = CreateUnaryNode(m_Operands.back());
+            return;
+        }
+        NodeIndex right = m_Operands.back();
+        m_Operands.pop_back();
+        m_Operands.back() = CreateNode(m_Table[op].Node, m_Operands.back(), right);
+    }
+
+    static bool IsBoundary(std::uint32_t op)
+    {
+        return op == PendingParenthesis || op == PendingCall;
+    }
+
+    //归约到最近的左括号(或函数调用的左括号)为止
+    void ReduceToBoundary()
+    {
+        while (!IsBoundary(m_Operators.back()))
+            Reduce();
+    }
+
+    //新来的二元运算符优先级为 precedence 时,先归约栈顶结合更紧的运算符;左括号是归约的边界
+    void ReduceWhileTighter(int precedence, Associativity assoc)
+    {
+        while (!m_Operators.empty() && !IsBoundary(m_Operators.back()))
+        {
+            std::uint32_t top = m_Operators.back();
+            int topPrecedence = top == PendingUnary ? m_Table.UnaryPrecedence() : m_Table[top].Precedence;
+            if (topPrecedence < precedence || (topPrecedence == precedence && assoc == RightAssociative))
+                break;
+            Reduce();
+        }
+    }
+
+    TokenSet OperandExpected() const
+    {
+        return OperandTokens | (m_Variables != nullptr ? TokenBit(Identifier) : 0);
+    }
+
+    //最内层的括号是否属于函数调用;只在出错时调用
+    bool InsideCall() const
+    {
+        for (auto it = m_Operators.rbegin(); it != m_Operators.rend(); ++it)
+        {
+            if (IsBoundary(*it))
+                return *it == PendingCall;
+        }
+        return false;
+    }
+
+    //操作数之后既不是运算符也不是 ')' 时的错误:在括号内缺少 ')',否则应当结束
+    NodeIndex FailAfterOperand()
+    {
+        if (m_OpenParentheses != 0)
+            return Fail(ParseMissingParenthesis, m_Table.Tokens() | TokenBit(CloseParenthesis) | (InsideCall() ? TokenBit(Comma) : 0));
+        return Fail(ParseUnexpectedToken, m_Table.Tokens() | TokenBit(EndOfText));
+    }
+
+    void Begin(ASTArena &arena, VariableTable *variables)
+    {
+        m_Arena = &arena;
+        m_Variables = variables;
+        m_Error = ParseError{};
+        m_Operands.clear();
+        m_Operators.clear();
+        m_Calls.clear();
+        m_OpenParentheses = 0;
+        m_ExpectOperand = true;
+    }
+
+    //归约 *m_Tokens 中从 m_Cursor 开始的令牌,直到 EndOfText 或出错;令牌用完时设置 m_Suspended 并返回 InvalidNode,
+    //运算符栈与操作数栈保留在成员中,换上后续的令牌后再次调用即可继续
+    NodeIndex Expression()
+    {
+        m_Suspended = false;
+        bool expectOperand = m_ExpectOperand;
+        for (std::size_t size = m_Tokens->Size();; m_Cursor++)
+        {
+            if (m_Cursor == size)
+            {
+                m_ExpectOperand = expectOperand;
+                m_Suspended = true;
+                return InvalidNode;
+            }
+            TokenType type = m_Tokens->Type(m_Cursor);
+            if (expectOperand)
+            {
+                switch (type)
+                {
+                case Number:
+                    m_Operands.push_back(CreateNodeNumber(m_Tokens->Value(m_Cursor)));
+                    expectOperand = false;
+                    break;
+                case Identifier:
+                    if (m_Variables == nullptr)
+                        return Fail(ParseUnexpectedToken, OperandExpected());
+                    m_Operands.push_back(CreateNodeVariable(m_Variables->Resolve(m_Tokens->Name(m_Cursor))));
+                    expectOperand = false;
+                    break;
+                case FunctionName:
+                {
+                    //名称在解析时就换成编号,之后的运算不再查找
+                    std::uint32_t function = Functions().Find(m_Tokens->Name(m_Cursor));
+                    if (function == FunctionRegistry::NoFunction)
+                        return Fail(ParseUnknownFunction, 0);
+                    if (!PushOperator(PendingCall))
+                        return InvalidNode;
+                    m_Calls.push_back({function, 1});
+                    m_OpenParentheses++;
+                    break;
+                }
+                case Minus:
+                    if (!PushOperator(PendingUnary))
+                        return InvalidNode;
+                    break;
+                case OpenParenthesis:
+                    if (!PushOperator(PendingParenthesis))
+                        return InvalidNode;
+                    m_OpenParentheses++;
+                    break;
+                default:
+                    return Fail(ParseUnexpectedToken, OperandExpected());
+                }
+                continue;
+            }
+
+            switch (type)
+            {
+            case Plus:
+            case Minus:
+            case Mul:
+            case Div:
+            case Operator:
+            {
+                //不在表中的 '-' 只能作一元负号
+                std::uint32_t op = m_Tokens->Operator(m_Cursor);
+                if (op >= m_Table.Size())
+                    return FailAfterOperand();
+                const OperatorInfo &info = m_Table[op];
+                ReduceWhileTighter(info.Precedence, info.Assoc);
+                if (!PushOperator(op))
+                    return InvalidNode;
+                expectOperand = true;
+                break;
+            }
+            case Comma:
+                if (m_OpenParentheses == 0)
+                    return FailAfterOperand();
+                ReduceToBoundary();
+                if (m_Operators.back() != PendingCall)
+                    return FailAfterOperand();
+                if (m_Calls.back().Arguments == std::uint32_t(Functions()[m_Calls.back().Function].Arity))
+                    return Fail(ParseArgumentCount, TokenBit(CloseParenthesis));
+                m_Calls.back().Arguments++;
+                expectOperand = true;
+                break;
+            case CloseParenthesis:
+                if (m_OpenParentheses == 0)
+                    return FailAfterOperand();
+                ReduceToBoundary();
+                if (m_Operators.back() == PendingCall)
+                {
+                    Call call = m_Calls.back();
+                    if (call.Arguments != std::uint32_t(Functions()[call.Function].Arity))
+                        return Fail(ParseArgumentCount, TokenBit(Comma));
+                    NodeIndex right = InvalidNode;
+                    if (call.Arguments == 2)
+                    {
+                        right = m_Operands.back();
+                        m_Operands.pop_back();
+                    }
+                    m_Operands.back() = CreateNodeCall(call.Function, m_Operands.back(), right);
+                    m_Calls.pop_back();
+                }
+                m_Operators.pop_back();
+                m_OpenParentheses--;
+                break;
+            case EndOfText:
+                if (m_OpenParentheses != 0)
+                    return FailAfterOperand();
+                while (!m_Operators.empty())
+                    Reduce();
+                return m_Operands.back();
+            default:
+                return FailAfterOperand();
+            }
+        }
+    }
+
+    ParseResult Parse(const TokenBuffer &tokens, ASTArena &arena, VariableTable *variables)
+    {
+        if (tokens.Size() == 0 || (tokens.Type(tokens.Size() - 1) != EndOfText && tokens.Type(tokens.Size() - 1) != Error))
+            throw std::invalid_argument("Token buffer does not hold a complete input");
+        Begin(arena, variables);
+        m_Tokens = &tokens;
+        m_Cursor = 0;
+
+        ParseResult result;
+        result.Root = Expression();
+        result.Error = m_Error;
+        EXPRESSION_STATS_MAX(PeakArenaNodes, arena.Size());
+        return result;
+    }
+
+    ParseResult Parse(const char *text, size_t length, ASTArena &arena, VariableTable *variables)
+    {
+        EXPRESSION_STATS_ADD(Parses, 1);
+        EXPRESSION_STATS_TIME(ParseNanoseconds);
+        m_Buffer.Tokenize(text, length, m_Table);
+        return Parse(m_Buffer, arena, variables);
+    }
+
+    NodeIndex ParseOrThrow(const char *text, size_t length, ASTArena &arena, VariableTable *variables)
+    {
+        ParseResult result = Parse(text, length, arena, variables);
+        if (!result)
+            throw ParserException(result.Error);
+        return result.Root;
+    }
+
+    NodeIndex ParseOrThrow(const TokenBuffer &tokens, ASTArena &arena, VariableTable *variables)
+    {
+        EXPRESSION_STATS_ADD(Parses, 1);
+        EXPRESSION_STATS_TIME(ParseNanoseconds);
+        ParseResult result = Parse(tokens, arena, variables);
+        if (!result)
+            throw ParserException(result.Error);
+        return result.Root;
+    }
+
+public:
+    static constexpr size_t DefaultMaxDepth = 10000;
+
+    //maxDepth 限制括号、一元负号与右结合运算符的嵌套层数,超出时报告 ParseTooDeep;
+    //左结合的长链(例如 1+2+...+n)不受限制
+    explicit Parser(OperatorTable table = OperatorTable(), size_t maxDepth = DefaultMaxDepth)
+        : m_Table(std::move(table)), m_MaxDepth(maxDepth)
+    {
+    }
+
+    const OperatorTable &Operators() const noexcept
+    {
+        return m_Table;
+    }
+
+    //节点创建在 arena 中,返回根节点索引;arena 的生命周期由调用者管理;输入有误时抛出 ParserException
+    NodeIndex Parse(const char *text, ASTArena &arena)
+    {
+        return ParseOrThrow(text, std::strlen(text), arena, nullptr);
+    }
+
+    //允许表达式中出现变量,变量名登记到 variables 中并分配槽位
+    NodeIndex Parse(const char *text, ASTArena &arena, VariableTable &variables)
+    {
+        return ParseOrThrow(text, std::strlen(text), arena, &variables);
+    }
+
+    //解析 [text, text + length),不要求以 NUL 结尾
+    NodeIndex Parse(const char *text, size_t length, ASTArena &arena)
+    {
+        return ParseOrThrow(text, length, arena, nullptr);
+    }
+
+    NodeIndex Parse(const char *text, size_t length, ASTArena &arena, VariableTable &variables)
+    {
+        return ParseOrThrow(text, length, arena, &variables);
+    }
+
+    //不抛出异常的版本:输入有误时返回错误码、偏移与期望的令牌集合,出错前已创建的节点留在 arena 中
+    ParseResult Parse(std::nothrow_t, const char *text, size_t length, ASTArena &arena)
+    {
+        return Parse(text, length, arena, nullptr);
+    }
+
+    ParseResult Parse(std::nothrow_t, const char *text, size_t length, ASTArena &arena, VariableTable &variables)
+    {
+        return Parse(text, length, arena, &variables);
+    }
+
+    //按本解析器的运算符表对 [text, text + length) 做词法分析,结果可以交给下面的 Parse 重复解析
+    void Tokenize(const char *text, size_t length, TokenBuffer &tokens) const
+    {
+        tokens.Tokenize(text, length, m_Table);
+    }
+
+    //从已有的令牌解析,tokens 须由本解析器(或运算符表相同的解析器)的 Tokenize 产生;语法树与错误信息与直接解析文本相同
+    NodeIndex Parse(const TokenBuffer &tokens, ASTArena &arena)
+    {
+        return ParseOrThrow(tokens, arena, nullptr);
+    }
+
+    NodeIndex Parse(const TokenBuffer &tokens, ASTArena &arena, VariableTable &variables)
+    {
+        return ParseOrThrow(tokens, arena, &variables);
+    }
+
+    ParseResult Parse(std::nothrow_t, const TokenBuffer &tokens, ASTArena &arena)
+    {
+        EXPRESSION_STATS_ADD(Parses, 1);
+        EXPRESSION_STATS_TIME(ParseNanoseconds);
+        return Parse(tokens, arena, nullptr);
+    }
+
+    ParseResult Parse(std::nothrow_t, const TokenBuffer &tokens, ASTArena &arena, VariableTable &variables)
+    {
+        EXPRESSION_STATS_ADD(Parses, 1);
+        EXPRESSION_STATS_TIME(ParseNanoseconds);
+        return Parse(tokens, arena, &variables);
+    }
+
+    //只做词法分析,返回令牌个数(不含 EndOfText),遇到无法识别的输入时停止
+    size_t CountTokens(const char *text, size_t length)
+    {
+        m_Buffer.Tokenize(text, length, m_Table);
+        return m_Buffer.Size() - 1;
+    }
+};
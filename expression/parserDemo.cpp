@@ -1,7 +1,16 @@
-#include <exception>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <string_view>
+#include <vector>
+
+#include "numberscan.hpp"
+#include "textscan.hpp"
+#include "validator.hpp"
 
 enum TokenType
 {
@@ -23,21 +32,28 @@ struct Token
     char symbol = 0;
 };
 
-class ParserException : public std::exception
+class ParserException : public std::runtime_error
 {
     int m_Pos;
 
 public:
     ParserException(const std::string &message, int pos)
-        : std::exception(message.c_str()),
+        : std::runtime_error(message),
           m_Pos{pos} {};
+
+    int Position() const noexcept
+    {
+        return m_Pos;
+    }
 };
 
 class Parser
 {
     Token m_crtToken;
     const char *m_Text;
+    const char *m_End;
     size_t m_Index;
+    size_t m_TokenStart;
 
 private:
     void Expression()
@@ -60,6 +76,10 @@ private:
             Term();
             Expression1();
             break;
+        case Error:
+            Unexpected();
+        default: //ε:其余令牌由调用者检查
+            break;
         }
     }
 
@@ -83,6 +103,10 @@ private:
             Factor();
             Term1();
             break;
+        case Error:
+            Unexpected();
+        default: //ε:其余令牌由调用者检查
+            break;
         }
     }
 
@@ -103,17 +127,20 @@ private:
             GetNextToken();
             break;
         default:
-        {
-            std::stringstream sstr;
-            sstr << "Unexpected token '" << m_crtToken.symbol << "' at position " << m_Index;
-            throw ParserException(sstr.str(), m_Index);
-        }
+            Unexpected();
         }
     }
 
+    [[noreturn]] void Unexpected()
+    {
+        std::stringstream sstr;
+        sstr << "Unexpected token '" << m_crtToken.symbol << "' at position " << m_Index;
+        throw ParserException(sstr.str(), m_Index);
+    }
+
     void Match(char expected)
     {
-        if (m_Text[m_Index - 1] == expected)
+        if (m_crtToken.symbol == expected)
         {
             GetNextToken();
         }
@@ -127,13 +154,13 @@ private:
 
     void SkipWhitespaces()
     {
-        while (std::isspace(m_Text[m_Index]))
-            m_Index++;
+        m_Index = SkipWhitespace(&m_Text[m_Index], m_End) - m_Text;
     }
 
     void GetNextToken()
     {
         SkipWhitespaces();
+        m_TokenStart = m_Index;
 
         m_crtToken.value = 0;
         m_crtToken.symbol = 0;
@@ -145,7 +172,7 @@ private:
             return;
         }
 
-        if (std::isdigit(m_Text[m_Index]))
+        if (IsDecimalDigit(m_Text[m_Index]))
         {
             m_crtToken.type = Number;
             m_crtToken.value = GetNumber();
@@ -190,44 +217,111 @@ private:
 
     double GetNumber()
     {
-        SkipWhitespaces();
-        int index = m_Index;
-        while (std::isdigit(m_Text[m_Index]))
-            m_Index++;
-        if (m_Text[m_Index] == '.')
-            m_Index++;
-        while (std::isdigit(m_Text[m_Index]))
-            m_Index++;
-        if (m_Index - index == 0)
-            throw ParserException("Number expected but not found!", m_Index);
-
-        char buffer[32] = {0};
-        std::memcpy(buffer, &m_Text[index], m_Index - index);
-        return std::atof(buffer);
+        NumberScanResult number = ScanNumber(&m_Text[m_Index], m_End);
+        m_Index = number.End - m_Text;
+        return number.Value;
     }
 
 public:
     void Parse(const char *text)
     {
         m_Text = text;
+        m_End = text + std::strlen(text);
         m_Index = 0;
         GetNextToken();
         Expression();
+        if (m_crtToken.type != EndOfText)
+        {
+            std::stringstream sstr;
+            sstr << "Unexpected token '" << m_Text[m_TokenStart] << "' at position " << m_TokenStart;
+            throw ParserException(sstr.str(), m_TokenStart);
+        }
     }
 };
 
 void Test(const char *text)
 {
     Parser parser;
+    ValidationResult valid = ValidateExpression(text, std::strlen(text));
     try
     {
         parser.Parse(text);
-        std::cout << "\"" << text << "\"\t OK\n";
+        std::cout << "\"" << text << "\"\t OK";
     }
     catch (ParserException &ex)
     {
-        std::cout << "\"" << text << "\"\t " << ex.what() << "\n";
+        std::cout << "\"" << text << "\"\t " << ex.what();
     }
+    if (valid)
+        std::cout << "\t[validator: OK]\n";
+    else
+        std::cout << "\t[validator: error at " << valid.Offset << "]\n";
+}
+
+//随机生成表达式,约一半再改坏一个字符;批量检查后与递归下降的 Parser 逐个比较结论与出错位置
+void TestValidator(std::size_t count)
+{
+    const char *atoms[] = {"1", "0", "42", "2.5", "3.", "1e3", "7.5E-2", "0x1F", "0x.8p1", "0x1.8p+1"};
+    const char *ops[] = {"+", "-", "*", "/", " + ", " * "};
+    const char noise[] = "0123456789+-*/(). eExXpPa,&";
+    std::mt19937 random(2020);
+    std::vector<std::string> texts;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::string text;
+        int open = 0;
+        for (int k = 0, terms = 1 + random() % 8; k < terms; k++)
+        {
+            if (k != 0)
+                text += ops[random() % 6];
+            while (random() % 4 == 0)
+            {
+                text += random() % 2 ? "(" : "-";
+                open += text.back() == '(';
+            }
+            text += atoms[random() % 10];
+            for (; open > 0 && random() % 3 == 0; open--)
+                text += ")";
+        }
+        text.append(open, ')');
+        if (random() % 2)
+            text[random() % text.size()] = noise[random() % (sizeof(noise) - 1)];
+        texts.push_back(text);
+    }
+
+    std::vector<std::string_view> views(texts.begin(), texts.end());
+    std::vector<ValidationResult> results(count);
+    auto start = std::chrono::steady_clock::now();
+    std::size_t valid = ValidateExpressions(views.data(), count, results.data());
+    auto middle = std::chrono::steady_clock::now();
+    std::size_t accepted = 0;
+    std::size_t mismatches = 0;
+    Parser parser;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        bool ok = true;
+        std::size_t offset = 0;
+        try
+        {
+            parser.Parse(texts[i].c_str());
+        }
+        catch (ParserException &ex)
+        {
+            ok = false;
+            offset = static_cast<std::size_t>(ex.Position());
+        }
+        accepted += ok;
+        if (ok != results[i].Ok || offset != results[i].Offset)
+        {
+            if (mismatches++ < 5)
+                std::cout << "mismatch: \"" << texts[i] << "\" parser " << offset << ", validator " << results[i].Offset << "\n";
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << count << " expressions, " << valid << " valid (parser " << accepted << "), " << mismatches
+              << " mismatches; validator " << std::chrono::duration<double, std::nano>(middle - start).count() / count
+              << " ns/expr, parser " << std::chrono::duration<double, std::nano>(end - middle).count() / count
+              << " ns/expr\n";
 }
 int main()
 {
@@ -246,14 +340,25 @@ int main()
     Test("-1");
     Test("-1+(-2)");
     Test("-1+(-2.0)");
+    Test("   1*2.5e2");
+    Test("0x1.8p1 / 1E-3");
 
     Test("   1*2,5");
-    Test("   1*2.5e2");
+    Test("   1*2.5e");
     Test("M1 + 2.5");
     Test("1 + 2&5");
     Test("1 * 2.5.6");
     Test("1 ** 2.5");
     Test("*1 / 2.5");
+    Test("1 2");
+    Test("(1+2))");
+    Test("((1+2)");
+    Test("(1 2.5)");
+    Test("2*(3 (4))");
+    Test("0x + 1");
+    Test("1 - )");
+
+    TestValidator(200000);
 
     return 0;
 }
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "parser.hpp"
+
+//分块输入的解析器:Begin 之后用 Feed 依次送入任意切分的文本,最后 Finish 取得语法树.
+//词法与语法分析的状态在两次 Feed 之间保留:块内完整的令牌直接在调用者的缓冲上分析,Feed 返回后不再引用;
+//只有延伸到块尾、可能还没有结束的一个令牌(例如被切开的数值 "12" | "3.5e2")被复制下来,与下一块开头的字节拼接后继续分析.
+//语法树、错误码与错误位置(相对整个输入)与一次解析完整文本相同
+class PushParser
+{
+    Parser m_Parser;
+    TokenBuffer m_Tokens;
+    std::string m_Pending;      //延伸到上一块末尾的未完成令牌
+    std::size_t m_Spaces = 0;   //m_Pending 为标识符时,其后已经送入、未复制下来的空白字节数
+    std::size_t m_Position = 0; //已送入的字节数
+    NodeIndex m_Root = InvalidNode;
+    bool m_Done = true; //已经遇到 EndOfText(或 NUL)或出错,之后的输入被忽略
+
+    //分析 [text, text + length),base 为其在整个输入中的偏移,返回已处理的字节数
+    std::size_t Consume(const char *text, std::size_t length, std::size_t base, TokenizeMode mode)
+    {
+        std::size_t consumed = m_Tokens.Tokenize(text, length, m_Parser.m_Table, base, mode);
+        m_Parser.m_Tokens = &m_Tokens;
+        m_Parser.m_Cursor = 0;
+        m_Root = m_Parser.Expression();
+        m_Done = !m_Parser.m_Suspended;
+        return consumed;
+    }
+
+    std::size_t PendingBase() const noexcept
+    {
+        return m_Position - m_Spaces - m_Pending.size();
+    }
+
+    //data 开头可能延续未完成令牌的字节数;只是为了让被切开的长数值、长标识符一次拼接完,是否结束由 Tokenize 判断
+    std::size_t ContinuationLength(const char *data, std::size_t size) const
+    {
+        std::size_t length = 0;
+        char first = m_Pending[0];
+        if (IsDecimalDigit(first))
+        {
+            char prev = m_Pending.back();
+            while (length < size && IsNumberContinuation(prev, data[length]))
+                prev = data[length++];
+        }
+        else if (IsIdentifierStart(first))
+        {
+            while (length < size && IsIdentifierCharacter(data[length]))
+                length++;
+        }
+        return length;
+    }
+
+    //标识符之后到块尾都是空白时,还要等下一个非空白字符才能区分变量与函数名;
+    //空白本身不影响结果,只记下字节数,不随后续的块无限制地复制下来
+    void DropPendingSpaces()
+    {
+        char first = m_Pending.empty() ? 0 : m_Pending[0];
+        if (!IsIdentifierStart(first))
+            return;
+        std::size_t length = m_Pending.size();
+        while (length > 0 && IsAsciiSpace(m_Pending[length - 1]))
+            length--;
+        m_Spaces += m_Pending.size() - length;
+        m_Pending.resize(length);
+    }
+
+    //标识符与块尾的空白之后出现了 data 开头的非空白字符:是 '(' 时连同它一起作为函数名提交,否则作为变量提交
+    std::size_t CommitPendingName(const char *data)
+    {
+        std::size_t base = PendingBase();
+        bool call = *data == '(';
+        if (call)
+            m_Pending += '(';
+        m_Spaces = 0;
+        Consume(m_Pending.data(), m_Pending.size(), base, call ? TokenizeHold : TokenizeVariable);
+        m_Pending.clear();
+        return call ? 1 : 0;
+    }
+
+    void Begin(ASTArena &arena, VariableTable *variables)
+    {
+        m_Parser.Begin(arena, variables);
+        m_Pending.clear();
+        m_Spaces = 0;
+        m_Position = 0;
+        m_Root = InvalidNode;
+        m_Done = false;
+    }
+
+public:
+    explicit PushParser(OperatorTable table = OperatorTable(), std::size_t maxDepth = Parser::DefaultMaxDepth)
+        : m_Parser(std::move(table), maxDepth)
+    {
+    }
+
+    //开始解析一个新的表达式,节点创建在 arena 中;同一个 PushParser 可以依次解析多个表达式
+    void Begin(ASTArena &arena)
+    {
+        Begin(arena, nullptr);
+    }
+
+    //允许表达式中出现变量
+    void Begin(ASTArena &arena, VariableTable &variables)
+    {
+        Begin(arena, &variables);
+    }
+
+    //送入下一块输入;返回 false 表示已经出错,不必再送入后续输入
+    bool Feed(const char *data, std::size_t size)
+    {
+        //先拼接上一块留下的令牌;每轮至少取一个字节,直到它结束或本块用完
+        while (!m_Done && !m_Pending.empty() && size != 0)
+        {
+            std::size_t length;
+            if (m_Spaces != 0)
+            {
+                std::size_t spaces = 0;
+                while (spaces < size && IsAsciiSpace(data[spaces]))
+                    spaces++;
+                m_Spaces += spaces;
+                m_Position += spaces;
+                data += spaces;
+                size -= spaces;
+                length = size == 0 ? 0 : CommitPendingName(data);
+            }
+            else
+            {
+                length = ContinuationLength(data, size);
+                length = length == 0 ? 1 : length;
+                m_Pending.append(data, length);
+            }
+            data += length;
+            size -= length;
+            m_Position += length;
+            if (!m_Done && !m_Pending.empty())
+            {
+                m_Pending.erase(0, Consume(m_Pending.data(), m_Pending.size(), PendingBase(), TokenizeHold));
+                DropPendingSpaces();
+            }
+        }
+        if (!m_Done && size != 0)
+        {
+            std::size_t consumed = Consume(data, size, m_Position, TokenizeHold);
+            m_Pending.assign(data + consumed, size - consumed);
+            m_Position += size;
+            DropPendingSpaces();
+        }
+        return !Failed();
+    }
+
+    bool Feed(std::string_view chunk)
+    {
+        return Feed(chunk.data(), chunk.size());
+    }
+
+    bool Failed() const noexcept
+    {
+        return m_Parser.m_Error.Code != ParseOk;
+    }
+
+    //输入结束:分析留下的令牌并返回语法树的根节点;输入有误时抛出 ParserException
+    NodeIndex Finish()
+    {
+        ParseResult result = Finish(std::nothrow);
+        if (!result)
+            throw ParserException(result.Error);
+        return result.Root;
+    }
+
+    //不抛出异常的版本,错误信息与 Parser::Parse(std::nothrow, ...) 相同
+    ParseResult Finish(std::nothrow_t)
+    {
+        EXPRESSION_STATS_ADD(Parses, 1);
+        //标识符之后还有未复制的空白时先作为变量提交,EndOfText 仍位于整个输入的末尾
+        if (!m_Done && m_Spaces != 0)
+        {
+            Consume(m_Pending.data(), m_Pending.size(), PendingBase(), TokenizeVariable);
+            m_Pending.clear();
+            m_Spaces = 0;
+        }
+        if (!m_Done)
+            Consume(m_Pending.data(), m_Pending.size(), m_Position - m_Pending.size(), TokenizeAll);
+        m_Pending.clear();
+        m_Done = true;
+        ParseResult result;
+        result.Root = m_Root;
+        result.Error = m_Parser.m_Error;
+        EXPRESSION_STATS_MAX(PeakArenaNodes, m_Parser.m_Arena->Size());
+        return result;
+    }
+};
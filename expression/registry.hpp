@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "compiled.hpp"
+
+//发布后的一个版本,读者持有期间不会被释放
+struct PublishedExpression
+{
+    CompiledExpression Expression;
+    std::uint64_t Version = 0; //同一名称从 1 开始递增
+};
+
+struct ExpressionRegistryStats
+{
+    std::uint64_t Published = 0;
+    std::uint64_t Reclaimed = 0;
+    std::size_t Pending = 0; //已替换、等待读者离开的旧版本
+    std::size_t Names = 0;
+};
+
+//具名编译结果的注册表:读取不加锁,取得当前版本只需一次原子读;写者加锁后原子地替换版本,
+//旧版本按纪元回收:读者进入时公布当时的全局纪元,旧版本记下替换后的纪元,所有活动读者公布的纪元都不小于它时才释放.
+//名称的编号分配后不再改变,查找名称同样不加锁
+class ExpressionRegistry
+{
+public:
+    static constexpr std::uint32_t NoExpression = 0xFFFFFFFFu;
+
+private:
+    static constexpr std::uint64_t Idle = std::numeric_limits<std::uint64_t>::max();
+
+    struct Entry
+    {
+        std::string Name;
+        std::atomic<const PublishedExpression *> Current{nullptr};
+        std::uint64_t Versions = 0; //只由持锁的写者访问
+    };
+
+    struct alignas(64) ReaderRecord
+    {
+        std::atomic<std::uint64_t> Epoch{Idle}; //读取期间为进入时的全局纪元
+        std::atomic<bool> InUse{false};
+    };
+
+    struct Retired
+    {
+        const PublishedExpression *Expression;
+        std::uint64_t Epoch;
+    };
+
+    std::unique_ptr<Entry[]> m_Entries;
+    std::unique_ptr<std::atomic<std::uint32_t>[]> m_Index; //编号 + 1,0 为空位;装载率不超过 1/2
+    std::unique_ptr<ReaderRecord[]> m_Readers;
+    std::size_t m_Capacity;
+    std::size_t m_IndexMask;
+    std::size_t m_MaxReaders;
+
+    std::atomic<std::uint64_t> m_Epoch{1};
+    std::atomic<std::uint32_t> m_Count{0};
+
+    std::mutex m_Mutex; //串行化写者
+    std::vector<Retired> m_Retired;
+    std::uint64_t m_Published = 0;
+    std::uint64_t m_Reclaimed = 0;
+
+    std::size_t Slot(std::string_view name) const noexcept
+    {
+        return std::hash<std::string_view>{}(name) & m_IndexMask;
+    }
+
+    //持锁调用;不存在时登记新的名称
+    std::uint32_t Intern(std::string_view name)
+    {
+        std::uint32_t id = Find(name);
+        if (id != NoExpression)
+            return id;
+        id = m_Count.load(std::memory_order_relaxed);
+        if (id == m_Capacity)
+            throw std::length_error("Too many named expressions!");
+
+        m_Entries[id].Name = std::string(name);
+        std::size_t i = Slot(name);
+        while (m_Index[i].load(std::memory_order_relaxed) != 0)
+            i = (i + 1) & m_IndexMask;
+        //先写好名称再发布编号
+        m_Index[i].store(id + 1, std::memory_order_release);
+        m_Count.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    //持锁调用:old 已从注册表中摘下,推进全局纪元后记入待回收列表
+    void Retire(const PublishedExpression *old)
+    {
+        if (old == nullptr)
+            return;
+        std::uint64_t epoch = m_Epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+        m_Retired.push_back({old, epoch});
+        ReclaimLocked();
+    }
+
+    std::size_t ReclaimLocked()
+    {
+        std::uint64_t oldest = Idle;
+        for (std::size_t i = 0; i < m_MaxReaders; i++)
+            oldest = std::min(oldest, m_Readers[i].Epoch.load(std::memory_order_seq_cst));
+
+        auto kept = std::partition(m_Retired.begin(), m_Retired.end(),
+                                   [oldest](const Retired &retired) { return retired.Epoch > oldest; });
+        std::size_t count = static_cast<std::size_t>(m_Retired.end() - kept);
+        for (auto it = kept; it != m_Retired.end(); ++it)
+            delete it->Expression;
+        m_Retired.erase(kept, m_Retired.end());
+        m_Reclaimed += count;
+        return count;
+    }
+
+public:
+    //每个读取线程持有一个 Reader;Enter 与 Leave 之间通过 Get 取得的版本保持有效.
+    //Enter、Get、Leave 都只有固定几次原子操作,不等待写者
+    class Reader
+    {
+        ExpressionRegistry &m_Registry;
+        ReaderRecord *m_Record = nullptr;
+        int m_Depth = 0;
+
+    public:
+        //读者数量超过构造注册表时给定的上限时抛出 std::length_error
+        explicit Reader(ExpressionRegistry &registry) : m_Registry(registry)
+        {
+            for (std::size_t i = 0; i < registry.m_MaxReaders; i++)
+            {
+                bool expected = false;
+                if (registry.m_Readers[i].InUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                {
+                    m_Record = &registry.m_Readers[i];
+                    return;
+                }
+            }
+            throw std::length_error("Too many registry readers!");
+        }
+
+        ~Reader()
+        {
+            m_Record->Epoch.store(Idle, std::memory_order_release);
+            m_Record->InUse.store(false, std::memory_order_release);
+        }
+
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        //可以嵌套,最外层的 Leave 之后不再持有任何版本
+        void Enter() noexcept
+        {
+            if (m_Depth++ == 0)
+                m_Record->Epoch.store(m_Registry.m_Epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+
+        void Leave() noexcept
+        {
+            if (--m_Depth == 0)
+                m_Record->Epoch.store(Idle, std::memory_order_release);
+        }
+
+        //必须在 Enter 与 Leave 之间调用;名称尚未发布或已移除时返回 nullptr
+        const PublishedExpression *Get(std::uint32_t id) const noexcept
+        {
+            if (id >= m_Registry.m_Capacity)
+                return nullptr;
+            return m_Registry.m_Entries[id].Current.load(std::memory_order_seq_cst);
+        }
+    };
+
+    class ReadGuard
+    {
+        Reader &m_Reader;
+
+    public:
+        explicit ReadGuard(Reader &reader) noexcept : m_Reader(reader)
+        {
+            m_Reader.Enter();
+        }
+
+        ~ReadGuard()
+        {
+            m_Reader.Leave();
+        }
+
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard &operator=(const ReadGuard &) = delete;
+
+        const PublishedExpression *Get(std::uint32_t id) const noexcept
+        {
+            return m_Reader.Get(id);
+        }
+    };
+
+    explicit ExpressionRegistry(std::size_t capacity = 4096, std::size_t maxReaders = 64)
+        : m_Capacity(capacity), m_MaxReaders(maxReaders)
+    {
+        if (capacity == 0 || capacity >= NoExpression || maxReaders == 0)
+            throw std::invalid_argument("Invalid registry size");
+        std::size_t indexSize = 16;
+        while (indexSize < capacity * 2)
+            indexSize *= 2;
+        m_IndexMask = indexSize - 1;
+        m_Entries = std::make_unique<Entry[]>(capacity);
+        m_Index = std::make_unique<std::atomic<std::uint32_t>[]>(indexSize);
+        for (std::size_t i = 0; i < indexSize; i++)
+            m_Index[i].store(0, std::memory_order_relaxed);
+        m_Readers = std::make_unique<ReaderRecord[]>(maxReaders);
+    }
+
+    //销毁时不能再有 Reader
+    ~ExpressionRegistry()
+    {
+        for (std::size_t i = 0; i < m_Capacity; i++)
+            delete m_Entries[i].Current.load(std::memory_order_relaxed);
+        for (const Retired &retired : m_Retired)
+            delete retired.Expression;
+    }
+
+    ExpressionRegistry(const ExpressionRegistry &) = delete;
+    ExpressionRegistry &operator=(const ExpressionRegistry &) = delete;
+
+    //不存在时返回 NoExpression;编号在注册表的生命周期内不变,读者应缓存编号而不是每次按名称查找
+    std::uint32_t Find(std::string_view name) const noexcept
+    {
+        for (std::size_t i = Slot(name);; i = (i + 1) & m_IndexMask)
+        {
+            std::uint32_t id = m_Index[i].load(std::memory_order_acquire);
+            if (id == 0)
+                return NoExpression;
+            if (m_Entries[id - 1].Name == name)
+                return id - 1;
+        }
+    }
+
+    const std::string &Name(std::uint32_t id) const
+    {
+        return m_Entries[id].Name;
+    }
+
+    //发布新版本并返回名称的编号,正在读取旧版本的读者不受影响;名称数量超过容量时抛出 std::length_error
+    std::uint32_t Publish(std::string_view name, CompiledExpression expression)
+    {
+        if (name.empty())
+            throw std::invalid_argument("Expression name must not be empty");
+        auto published = std::make_unique<PublishedExpression>();
+        published->Expression = std::move(expression);
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        std::uint32_t id = Intern(name);
+        Entry &entry = m_Entries[id];
+        published->Version = ++entry.Versions;
+        const PublishedExpression *old = entry.Current.exchange(published.release(), std::memory_order_seq_cst);
+        m_Published++;
+        Retire(old);
+        return id;
+    }
+
+    //解析并编译后发布,输入有误时抛出 ParserException,原有版本保持不变
+    std::uint32_t Publish(std::string_view name, const char *text)
+    {
+        return Publish(name, CompileExpression(text));
+    }
+
+    //移除当前版本,编号保留;名称不存在时返回 false
+    bool Remove(std::string_view name)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        std::uint32_t id = Find(name);
+        if (id == NoExpression)
+            return false;
+        Retire(m_Entries[id].Current.exchange(nullptr, std::memory_order_seq_cst));
+        return true;
+    }
+
+    //释放所有读者都已离开的旧版本,返回释放的数量;Publish 与 Remove 也会顺带回收
+    std::size_t Reclaim()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return ReclaimLocked();
+    }
+
+    ExpressionRegistryStats Stats()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return {m_Published, m_Reclaimed, m_Retired.size(), m_Count.load(std::memory_order_relaxed)};
+    }
+};
@@ -0,0 +1,518 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+#include "ast.hpp"
+#include "parser.hpp"
+#include "numberscan.hpp"
+#include "evaluator.hpp"
+
+//编译期解析:语法与 Parser 的默认运算符表一致(+ - * /、一元负号、括号、变量),构造同样左结合的树.
+//在常量表达式中出错时调用非 constexpr 的 Fail,编译失败;运行时调用则抛出 ParserException
+
+struct StaticNode
+{
+    ASTNodeType Type = Undefined;
+    std::size_t Left = 0;
+    std::size_t Right = 0;
+    double Value = 0;
+    std::size_t Slot = 0;
+};
+
+//编译期十进制转换用的定长大整数,按 32 位字小端存放
+struct StaticBigInteger
+{
+    static constexpr std::size_t Capacity = 128; //4096 位,足以容纳 StaticDecimalToDouble 中最大的中间结果
+
+    std::uint32_t Words[Capacity] = {};
+    std::size_t Size = 0; //最高的字不为 0
+
+    [[noreturn]] static void Overflow()
+    {
+        throw std::length_error("Static number literal too long!");
+    }
+
+    constexpr void MulAdd(std::uint32_t factor, std::uint32_t addend)
+    {
+        std::uint64_t carry = addend;
+        for (std::size_t i = 0; i < Size; i++)
+        {
+            std::uint64_t product = std::uint64_t(Words[i]) * factor + carry;
+            Words[i] = static_cast<std::uint32_t>(product);
+            carry = product >> 32;
+        }
+        if (carry != 0)
+        {
+            if (Size == Capacity)
+                Overflow();
+            Words[Size++] = static_cast<std::uint32_t>(carry);
+        }
+    }
+
+    constexpr void MulPow10(int exponent)
+    {
+        for (; exponent >= 9; exponent -= 9)
+            MulAdd(1000000000u, 0);
+        std::uint32_t factor = 1;
+        for (; exponent > 0; exponent--)
+            factor *= 10;
+        MulAdd(factor, 0);
+    }
+
+    constexpr void ShiftLeft(std::size_t bits)
+    {
+        if (Size == 0 || bits == 0)
+            return;
+        std::size_t words = bits / 32;
+        unsigned shift = static_cast<unsigned>(bits % 32);
+        if (Size + words + 1 > Capacity)
+            Overflow();
+        Words[Size + words] = 0;
+        for (std::size_t i = Size; i-- > 0;)
+        {
+            Words[i + words + 1] |= shift == 0 ? 0 : Words[i] >> (32 - shift);
+            Words[i + words] = Words[i] << shift;
+        }
+        for (std::size_t i = 0; i < words; i++)
+            Words[i] = 0;
+        Size += words + 1;
+        while (Size != 0 && Words[Size - 1] == 0)
+            Size--;
+    }
+
+    constexpr std::size_t BitLength() const
+    {
+        if (Size == 0)
+            return 0;
+        std::size_t bits = (Size - 1) * 32;
+        for (std::uint32_t top = Words[Size - 1]; top != 0; top >>= 1)
+            bits++;
+        return bits;
+    }
+
+    static constexpr int Compare(const StaticBigInteger &a, const StaticBigInteger &b)
+    {
+        if (a.Size != b.Size)
+            return a.Size < b.Size ? -1 : 1;
+        for (std::size_t i = a.Size; i-- > 0;)
+        {
+            if (a.Words[i] != b.Words[i])
+                return a.Words[i] < b.Words[i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    //调用者保证 *this >= other
+    constexpr void Subtract(const StaticBigInteger &other)
+    {
+        std::int64_t borrow = 0;
+        for (std::size_t i = 0; i < Size; i++)
+        {
+            std::int64_t difference = std::int64_t(Words[i]) - (i < other.Size ? other.Words[i] : 0) - borrow;
+            borrow = difference < 0 ? 1 : 0;
+            Words[i] = static_cast<std::uint32_t>(difference + (borrow << 32));
+        }
+        while (Size != 0 && Words[Size - 1] == 0)
+            Size--;
+    }
+};
+
+//正确舍入 digits × 10^exponent(digits > 0,共 count 位十进制数字),与运行时的 ScanNumber 逐位一致:
+//先确定二进制指数 k(2^k <= 值 < 2^(k+1)),再用大整数除法求出 53 位(次正规数时更少)的商与余数,按就近偶数舍入
+constexpr double StaticDecimalToDouble(const StaticBigInteger &digits, int count, int exponent)
+{
+    if (count - 1 + exponent >= 309)
+        return std::numeric_limits<double>::infinity();
+    if (count + exponent <= -324)
+        return 0;
+
+    StaticBigInteger numerator = digits;
+    StaticBigInteger denominator;
+    denominator.MulAdd(1, 1);
+    if (exponent >= 0)
+        numerator.MulPow10(exponent);
+    else
+        denominator.MulPow10(-exponent);
+
+    int k = static_cast<int>(numerator.BitLength()) - static_cast<int>(denominator.BitLength());
+    StaticBigInteger a = numerator;
+    StaticBigInteger b = denominator;
+    if (k >= 0)
+        b.ShiftLeft(k);
+    else
+        a.ShiftLeft(-k);
+    if (StaticBigInteger::Compare(a, b) < 0)
+        k--;
+    if (k > 1023)
+        return std::numeric_limits<double>::infinity();
+
+    //商 = 值 × 2^shift,正规数时在 [2^52, 2^53) 中
+    int shift = k >= -1022 ? 52 - k : 1074;
+    a = numerator;
+    b = denominator;
+    if (shift >= 0)
+        a.ShiftLeft(shift);
+    else
+        b.ShiftLeft(-shift);
+    std::uint64_t quotient = 0;
+    for (int bit = 54; bit >= 0; bit--)
+    {
+        StaticBigInteger part = b;
+        part.ShiftLeft(bit);
+        if (StaticBigInteger::Compare(a, part) >= 0)
+        {
+            a.Subtract(part);
+            quotient |= std::uint64_t(1) << bit;
+        }
+    }
+    a.ShiftLeft(1);
+    int half = StaticBigInteger::Compare(a, b);
+    if (half > 0 || (half == 0 && (quotient & 1) != 0))
+        quotient++;
+    if (k == 1023 && quotient == (std::uint64_t(1) << 53))
+        return std::numeric_limits<double>::infinity();
+
+    //quotient 不超过 2^53,乘除 2 的幂的每一步都是精确的
+    double value = static_cast<double>(quotient);
+    for (int scale = -shift; scale > 0; scale -= 32)
+        value *= static_cast<double>(std::uint64_t(1) << (scale < 32 ? scale : 32));
+    for (int scale = shift; scale > 0; scale -= 32)
+        value /= static_cast<double>(std::uint64_t(1) << (scale < 32 ? scale : 32));
+    return value;
+}
+
+//节点按后序存放,子节点的下标总是小于父节点;N 为源文本长度,节点数不会超过它
+template <std::size_t N>
+struct StaticTree
+{
+    StaticNode Nodes[N] = {};
+    std::size_t Count = 0;
+    std::size_t Root = 0;
+    std::string_view Variables[N] = {}; //按首次出现的顺序分配槽位,与 VariableTable 相同
+    std::size_t VariableCount = 0;
+
+    //未知的变量名返回 VariableCount
+    constexpr std::size_t Slot(std::string_view name) const
+    {
+        for (std::size_t i = 0; i < VariableCount; i++)
+        {
+            if (Variables[i] == name)
+                return i;
+        }
+        return VariableCount;
+    }
+};
+
+template <std::size_t N>
+class StaticParser
+{
+    std::string_view m_Text;
+    std::size_t m_Index = 0;
+    StaticTree<N> m_Tree;
+
+    static constexpr bool IsSpace(char ch)
+    {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v';
+    }
+
+    static constexpr bool IsDigit(char ch)
+    {
+        return ch >= '0' && ch <= '9';
+    }
+
+    static constexpr bool IsIdentifierStart(char ch)
+    {
+        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_';
+    }
+
+    [[noreturn]] static void Fail(ParseErrorCode code, std::size_t offset, char symbol)
+    {
+        ParseError error;
+        error.Code = code;
+        error.Offset = offset;
+        error.Found = symbol == '\0' ? EndOfText : Error;
+        error.Symbol = symbol;
+        throw ParserException(error);
+    }
+
+    constexpr char Peek()
+    {
+        while (m_Index < m_Text.size() && IsSpace(m_Text[m_Index]))
+            m_Index++;
+        return m_Index < m_Text.size() ? m_Text[m_Index] : '\0';
+    }
+
+    constexpr std::size_t Create(ASTNodeType type, std::size_t left, std::size_t right, double value = 0, std::size_t slot = 0)
+    {
+        if (m_Tree.Count == N)
+            Fail(ParseTooDeep, m_Index, Peek());
+        m_Tree.Nodes[m_Tree.Count] = StaticNode{type, left, right, value, slot};
+        return m_Tree.Count++;
+    }
+
+    //与 ScanNumber 一样正确舍入:尾数不超过 2^53 且十进制指数在 ±22 以内时一次乘除,其余情况由 StaticDecimalToDouble 精确计算.
+    //超过 MaxDigits 位有效数字时,其后的非零数字折合为末尾的一个 1,不影响舍入的结果
+    static constexpr int MaxDigits = 780;
+
+    constexpr double Number()
+    {
+        std::uint64_t mantissa = 0;
+        StaticBigInteger big;
+        int digits = 0;
+        int exponent = 0;
+        bool truncated = false;
+        if (m_Text[m_Index] == '0' && m_Index + 1 < m_Text.size() && (m_Text[m_Index + 1] == 'x' || m_Text[m_Index + 1] == 'X'))
+            Fail(ParseUnexpectedCharacter, m_Index + 1, m_Text[m_Index + 1]); //不支持十六进制字面量
+
+        auto digit = [&](char ch, bool fraction) {
+            if (digits == 0 && ch == '0')
+            {
+                exponent -= fraction ? 1 : 0;
+                return;
+            }
+            if (digits < 19)
+                mantissa = mantissa * 10 + (ch - '0');
+            if (digits < MaxDigits)
+            {
+                big.MulAdd(10, static_cast<std::uint32_t>(ch - '0'));
+                exponent -= fraction ? 1 : 0;
+            }
+            else
+            {
+                truncated = truncated || ch != '0';
+                exponent += fraction ? 0 : 1;
+            }
+            digits++;
+        };
+        while (m_Index < m_Text.size() && IsDigit(m_Text[m_Index]))
+            digit(m_Text[m_Index++], false);
+        if (m_Index < m_Text.size() && m_Text[m_Index] == '.')
+        {
+            for (m_Index++; m_Index < m_Text.size() && IsDigit(m_Text[m_Index]); m_Index++)
+                digit(m_Text[m_Index], true);
+        }
+        if (m_Index < m_Text.size() && (m_Text[m_Index] == 'e' || m_Text[m_Index] == 'E'))
+        {
+            std::size_t index = m_Index + 1;
+            bool negative = false;
+            if (index < m_Text.size() && (m_Text[index] == '+' || m_Text[index] == '-'))
+                negative = m_Text[index++] == '-';
+            if (index < m_Text.size() && IsDigit(m_Text[index]))
+            {
+                int value = 0;
+                for (; index < m_Text.size() && IsDigit(m_Text[index]); index++)
+                    value = value < 100000 ? value * 10 + (m_Text[index] - '0') : value;
+                exponent += negative ? -value : value;
+                m_Index = index;
+            }
+        }
+
+        if (digits == 0)
+            return 0;
+        if (digits <= 19 && mantissa <= (std::uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+        {
+            double value = static_cast<double>(mantissa);
+            return exponent < 0 ? value / ExactPowersOf10[-exponent] : value * ExactPowersOf10[exponent];
+        }
+        int count = digits < MaxDigits ? digits : MaxDigits;
+        if (truncated)
+        {
+            big.MulAdd(10, 1);
+            count++;
+            exponent--;
+        }
+        return StaticDecimalToDouble(big, count, exponent);
+    }
+
+    constexpr std::size_t Variable()
+    {
+        std::size_t begin = m_Index;
+        while (m_Index < m_Text.size() && (IsIdentifierStart(m_Text[m_Index]) || IsDigit(m_Text[m_Index])))
+            m_Index++;
+        std::string_view name = m_Text.substr(begin, m_Index - begin);
+        std::size_t slot = m_Tree.Slot(name);
+        if (slot == m_Tree.VariableCount)
+            m_Tree.Variables[m_Tree.VariableCount++] = name;
+        return Create(VariableValue, 0, 0, 0, slot);
+    }
+
+    //FACTOR -> ( EXP ) | - FACTOR | number | identifier
+    constexpr std::size_t Factor()
+    {
+        char ch = Peek();
+        if (ch == '(')
+        {
+            m_Index++;
+            std::size_t node = Expression();
+            if (Peek() != ')')
+                Fail(ParseMissingParenthesis, m_Index, Peek());
+            m_Index++;
+            return node;
+        }
+        if (ch == '-')
+        {
+            m_Index++;
+            std::size_t operand = Factor();
+            return Create(UnaryMinus, operand, 0);
+        }
+        if (IsDigit(ch))
+            return Create(NumberValue, 0, 0, Number());
+        if (IsIdentifierStart(ch))
+            return Variable();
+        Fail(ch == '\0' || ch == '+' || ch == '*' || ch == '/' || ch == ')' ? ParseUnexpectedToken : ParseUnexpectedCharacter, m_Index, ch);
+    }
+
+    //TERM -> FACTOR { (*|/) FACTOR }
+    constexpr std::size_t Term()
+    {
+        std::size_t left = Factor();
+        for (char ch = Peek(); ch == '*' || ch == '/'; ch = Peek())
+        {
+            m_Index++;
+            std::size_t right = Factor();
+            left = Create(ch == '*' ? OperatorMul : OperatorDiv, left, right);
+        }
+        return left;
+    }
+
+    //EXP -> TERM { (+|-) TERM }
+    constexpr std::size_t Expression()
+    {
+        std::size_t left = Term();
+        for (char ch = Peek(); ch == '+' || ch == '-'; ch = Peek())
+        {
+            m_Index++;
+            std::size_t right = Term();
+            left = Create(ch == '+' ? OperatorPlus : OperatorMinus, left, right);
+        }
+        return left;
+    }
+
+public:
+    constexpr explicit StaticParser(std::string_view text)
+        : m_Text(text)
+    {
+    }
+
+    constexpr StaticTree<N> Parse()
+    {
+        m_Tree.Root = Expression();
+        char ch = Peek();
+        if (ch != '\0')
+            Fail(ch == '(' || IsDigit(ch) || IsIdentifierStart(ch) ? ParseUnexpectedToken : ParseUnexpectedCharacter, m_Index, ch);
+        return m_Tree;
+    }
+};
+
+template <std::size_t N>
+constexpr StaticTree<N> ParseStatic(const char (&text)[N])
+{
+    return StaticParser<N>(std::string_view(text, N - 1)).Parse();
+}
+
+//按后序线性运算,不含变量的表达式可以在常量表达式中求值
+template <std::size_t N>
+constexpr double EvaluateStatic(const StaticTree<N> &tree, const double *variables = nullptr)
+{
+    double values[N] = {};
+    for (std::size_t i = 0; i < tree.Count; i++)
+    {
+        const StaticNode &node = tree.Nodes[i];
+        switch (node.Type)
+        {
+        case NumberValue:
+            values[i] = node.Value;
+            break;
+        case VariableValue:
+            if (variables == nullptr)
+                throw EvaluatorException("Variable values not provided!");
+            values[i] = variables[node.Slot];
+            break;
+        case UnaryMinus:
+            values[i] = -values[node.Left];
+            break;
+        case OperatorPlus:
+            values[i] = values[node.Left] + values[node.Right];
+            break;
+        case OperatorMinus:
+            values[i] = values[node.Left] - values[node.Right];
+            break;
+        case OperatorMul:
+            values[i] = values[node.Left] * values[node.Right];
+            break;
+        case OperatorDiv:
+            values[i] = values[node.Left] / values[node.Right];
+            break;
+        default:
+            throw EvaluatorException("Incorrect syntax tree!");
+        }
+    }
+    return values[tree.Root];
+}
+
+template <std::size_t N>
+constexpr double EvaluateStatic(const char (&text)[N])
+{
+    return EvaluateStatic(ParseStatic(text));
+}
+
+//Tree 中第 Index 个节点对应的运算,节点类型与子节点在编译期展开,调用完全内联
+template <const auto &Tree, std::size_t Index>
+struct StaticNodeEvaluator
+{
+    static constexpr double Apply(const double *variables)
+    {
+        constexpr StaticNode node = Tree.Nodes[Index];
+        if constexpr (node.Type == NumberValue)
+        {
+            return node.Value;
+        }
+        else if constexpr (node.Type == VariableValue)
+        {
+            return variables[node.Slot];
+        }
+        else if constexpr (node.Type == UnaryMinus)
+        {
+            return -StaticNodeEvaluator<Tree, node.Left>::Apply(variables);
+        }
+        else
+        {
+            double left = StaticNodeEvaluator<Tree, node.Left>::Apply(variables);
+            double right = StaticNodeEvaluator<Tree, node.Right>::Apply(variables);
+            if constexpr (node.Type == OperatorPlus)
+                return left + right;
+            else if constexpr (node.Type == OperatorMinus)
+                return left - right;
+            else if constexpr (node.Type == OperatorMul)
+                return left * right;
+            else
+                return left / right;
+        }
+    }
+};
+
+//由编译期解析出的树生成的函数对象类型;Tree 须为静态存储期的 constexpr 对象:
+//    static constexpr auto priceTree = ParseStatic("price * (1 - discount)");
+//    using Price = StaticExpression<priceTree>;
+//    double values[Price::VariableCount] = {...};
+//    Price{}(values);
+template <const auto &Tree>
+struct StaticExpression
+{
+    static constexpr std::size_t VariableCount = Tree.VariableCount;
+
+    //变量在 variables 中的下标;未知的变量名返回 VariableCount
+    static constexpr std::size_t Slot(std::string_view name)
+    {
+        return Tree.Slot(name);
+    }
+
+    constexpr double operator()(const double *variables = nullptr) const
+    {
+        return StaticNodeEvaluator<Tree, Tree.Root>::Apply(variables);
+    }
+};
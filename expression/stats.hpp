@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+//定义 EXPRESSION_STATS=1 (CMake 选项 -DEXPRESSION_STATS=ON) 时,解析与运算过程在当前线程的 ExpressionStats 中计数;
+//未定义时下面的宏展开为空,不产生任何开销
+#ifndef EXPRESSION_STATS
+#define EXPRESSION_STATS 0
+#endif
+
+struct ExpressionStats
+{
+    std::uint64_t Parses = 0;
+    std::uint64_t Tokens = 0;          //词法分析产生的令牌,含 EndOfText
+    std::uint64_t Nodes = 0;           //创建的语法树节点
+    std::uint64_t ArenaGrowths = 0;    //ASTArena 扩容次数
+    std::uint64_t ArenaBytes = 0;      //ASTArena 扩容时新分配的字节数
+    std::uint64_t PeakArenaNodes = 0;  //解析结束时 arena 中节点数的最大值,可用来预先 Reserve
+    std::uint64_t Evaluations = 0;
+    std::uint64_t EvaluationSteps = 0; //运算时访问的节点数
+    std::uint64_t MaxEvaluationDepth = 0;
+    std::uint64_t ParseNanoseconds = 0; //含词法分析与构建语法树
+    std::uint64_t EvaluateNanoseconds = 0;
+
+    void Merge(const ExpressionStats &other)
+    {
+        Parses += other.Parses;
+        Tokens += other.Tokens;
+        Nodes += other.Nodes;
+        ArenaGrowths += other.ArenaGrowths;
+        ArenaBytes += other.ArenaBytes;
+        PeakArenaNodes = PeakArenaNodes > other.PeakArenaNodes ? PeakArenaNodes : other.PeakArenaNodes;
+        Evaluations += other.Evaluations;
+        EvaluationSteps += other.EvaluationSteps;
+        MaxEvaluationDepth = MaxEvaluationDepth > other.MaxEvaluationDepth ? MaxEvaluationDepth : other.MaxEvaluationDepth;
+        ParseNanoseconds += other.ParseNanoseconds;
+        EvaluateNanoseconds += other.EvaluateNanoseconds;
+    }
+
+    void Print(std::FILE *file) const
+    {
+        auto perCall = [](std::uint64_t total, std::uint64_t calls) {
+            return calls == 0 ? 0.0 : double(total) / calls;
+        };
+        std::fprintf(file,
+                     "parse:    %llu calls, %llu tokens, %llu nodes, peak %llu nodes/arena, %.3f ms (%.1f ns/call)\n"
+                     "arena:    %llu growths, %llu bytes allocated\n"
+                     "evaluate: %llu calls, %llu steps, max depth %llu, %.3f ms (%.1f ns/call)\n",
+                     (unsigned long long)Parses, (unsigned long long)Tokens, (unsigned long long)Nodes,
+                     (unsigned long long)PeakArenaNodes, ParseNanoseconds / 1e6, perCall(ParseNanoseconds, Parses),
+                     (unsigned long long)ArenaGrowths, (unsigned long long)ArenaBytes,
+                     (unsigned long long)Evaluations, (unsigned long long)EvaluationSteps,
+                     (unsigned long long)MaxEvaluationDepth, EvaluateNanoseconds / 1e6,
+                     perCall(EvaluateNanoseconds, Evaluations));
+    }
+};
+
+//每个线程一份,多线程时由调用者在各线程结束前取出并 Merge
+inline ExpressionStats &ThreadExpressionStats()
+{
+    static thread_local ExpressionStats stats;
+    return stats;
+}
+
+//作用域结束时把经过的时间累加到 total
+class ExpressionPhaseTimer
+{
+    std::uint64_t &m_Total;
+    std::chrono::steady_clock::time_point m_Start;
+
+public:
+    explicit ExpressionPhaseTimer(std::uint64_t &total)
+        : m_Total(total), m_Start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ExpressionPhaseTimer(const ExpressionPhaseTimer &) = delete;
+    ExpressionPhaseTimer &operator=(const ExpressionPhaseTimer &) = delete;
+
+    ~ExpressionPhaseTimer()
+    {
+        m_Total += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count();
+    }
+};
+
+#if EXPRESSION_STATS
+#define EXPRESSION_STATS_ADD(field, count) (ThreadExpressionStats().field += (count))
+#define EXPRESSION_STATS_MAX(field, value)                                   \
+    do                                                                       \
+    {                                                                        \
+        std::uint64_t expressionStatsValue = (value);                        \
+        if (ThreadExpressionStats().field < expressionStatsValue)            \
+            ThreadExpressionStats().field = expressionStatsValue;            \
+    } while (0)
+#define EXPRESSION_STATS_TIME(field) ExpressionPhaseTimer expressionPhaseTimer(ThreadExpressionStats().field)
+#else
+#define EXPRESSION_STATS_ADD(field, count) ((void)0)
+#define EXPRESSION_STATS_MAX(field, value) ((void)0)
+#define EXPRESSION_STATS_TIME(field) ((void)0)
+#endif
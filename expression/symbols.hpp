@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//名称到连续编号的映射:编号按首次出现的顺序分配 0, 1, 2...,之后以编号为下标访问平坦数组,不再比较字符串.
+//开放寻址的散列索引中只保存编号,查找时不分配内存
+class SymbolTable
+{
+    std::vector<std::string> m_Names;
+    std::vector<std::uint32_t> m_Index; //编号 + 1,0 为空位;大小为 2 的幂,装载率不超过 1/2
+
+    //name 所在的位置,不存在时为应当插入的空位
+    std::size_t Probe(std::string_view name) const
+    {
+        std::size_t mask = m_Index.size() - 1;
+        for (std::size_t i = std::hash<std::string_view>{}(name) & mask;; i = (i + 1) & mask)
+        {
+            std::uint32_t id = m_Index[i];
+            if (id == 0 || m_Names[id - 1] == name)
+                return i;
+        }
+    }
+
+    void Grow()
+    {
+        m_Index.assign(m_Index.empty() ? 16 : m_Index.size() * 2, 0);
+        for (std::size_t id = 0; id < m_Names.size(); id++)
+            m_Index[Probe(m_Names[id])] = static_cast<std::uint32_t>(id + 1);
+    }
+
+public:
+    static constexpr std::uint32_t NoSymbol = 0xFFFFFFFFu;
+
+    //返回 name 的编号,第一次出现时分配新的编号
+    std::uint32_t Intern(std::string_view name)
+    {
+        if ((m_Names.size() + 1) * 2 > m_Index.size())
+            Grow();
+        std::size_t i = Probe(name);
+        if (m_Index[i] == 0)
+        {
+            m_Names.emplace_back(name);
+            m_Index[i] = static_cast<std::uint32_t>(m_Names.size());
+        }
+        return m_Index[i] - 1;
+    }
+
+    //不存在时返回 NoSymbol
+    std::uint32_t Find(std::string_view name) const
+    {
+        if (m_Index.empty())
+            return NoSymbol;
+        return m_Index[Probe(name)] - 1;
+    }
+
+    const std::string &Name(std::uint32_t id) const
+    {
+        return m_Names[id];
+    }
+
+    const std::vector<std::string> &Names() const noexcept
+    {
+        return m_Names;
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Names.size();
+    }
+
+    //清空名称,保留已分配的索引
+    void Reset() noexcept
+    {
+        m_Names.clear();
+        std::fill(m_Index.begin(), m_Index.end(), 0u);
+    }
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "cpufeatures.hpp"
+
+//与 C locale 下的 isspace 相同:空格与 \t \n \v \f \r,不查 locale 表
+inline bool IsAsciiSpace(char ch)
+{
+    return ch == ' ' || static_cast<unsigned char>(ch - '\t') <= '\r' - '\t';
+}
+
+//标识符、数值与运算符共用的字符分类,在编译期生成,与 C locale 下的 isalpha / isdigit 相同;
+//std::isalnum 等按当前 locale 分类,在 Latin-1 等单字节 locale 下会把 0x80 以上的字节当作字母
+enum AsciiCharClass : std::uint8_t
+{
+    AsciiLetter = 1,
+    AsciiDigit = 2,
+    AsciiUnderscore = 4
+};
+
+using AsciiClassTable = std::array<std::uint8_t, 256>;
+
+constexpr AsciiClassTable MakeAsciiClassTable()
+{
+    AsciiClassTable table{};
+    for (int ch = 0; ch < 256; ch++)
+    {
+        if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'))
+            table[ch] = AsciiLetter;
+        else if (ch >= '0' && ch <= '9')
+            table[ch] = AsciiDigit;
+        else if (ch == '_')
+            table[ch] = AsciiUnderscore;
+    }
+    return table;
+}
+
+inline constexpr AsciiClassTable AsciiClasses = MakeAsciiClassTable();
+
+constexpr bool IsAsciiAlnum(char ch)
+{
+    return (AsciiClasses[static_cast<unsigned char>(ch)] & (AsciiLetter | AsciiDigit)) != 0;
+}
+
+//标识符(变量名、函数名)的首字符:字母或 '_'
+constexpr bool IsIdentifierStart(char ch)
+{
+    return (AsciiClasses[static_cast<unsigned char>(ch)] & (AsciiLetter | AsciiUnderscore)) != 0;
+}
+
+//标识符的后续字符:字母、数字或 '_'
+constexpr bool IsIdentifierCharacter(char ch)
+{
+    return AsciiClasses[static_cast<unsigned char>(ch)] != 0;
+}
+
+inline const char *ScalarSkipWhitespace(const char *p, const char *end)
+{
+    while (p != end && IsAsciiSpace(*p))
+        p++;
+    return p;
+}
+
+inline const char *ScalarSkipDigits(const char *p, const char *end)
+{
+    while (p != end && static_cast<unsigned char>(*p - '0') <= 9)
+        p++;
+    return p;
+}
+
+//向量版本每步分类 16 或 32 字节:x - low 按无符号比较不超过 span 即属于 [low, low + span];
+//第一个不属于该类的字节由比较结果的掩码给出,不足一个向量的尾部交给标量版本
+#if EXPRESSION_X86
+inline int FirstSetBit(unsigned mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+#if EXPRESSION_SSE2
+inline __m128i Sse2InRange(__m128i bytes, char low, char span)
+{
+    __m128i x = _mm_sub_epi8(bytes, _mm_set1_epi8(low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(span)), x);
+}
+
+inline const char *Sse2SkipWhitespace(const char *p, const char *end)
+{
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), Sse2InRange(bytes, '\t', '\r' - '\t'));
+        unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(space)) & 0xFFFFu;
+        if (mask != 0)
+            return p + FirstSetBit(mask);
+    }
+    return ScalarSkipWhitespace(p, end);
+}
+
+inline const char *Sse2SkipDigits(const char *p, const char *end)
+{
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(Sse2InRange(bytes, '0', 9))) & 0xFFFFu;
+        if (mask != 0)
+            return p + FirstSetBit(mask);
+    }
+    return ScalarSkipDigits(p, end);
+}
+#endif
+
+#if EXPRESSION_AVX2
+EXPRESSION_TARGET_AVX2 inline __m256i Avx2InRange(__m256i bytes, char low, char span)
+{
+    __m256i x = _mm256_sub_epi8(bytes, _mm256_set1_epi8(low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(span)), x);
+}
+
+EXPRESSION_TARGET_AVX2 inline const char *Avx2SkipWhitespace(const char *p, const char *end)
+{
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')), Avx2InRange(bytes, '\t', '\r' - '\t'));
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(space));
+        if (mask != 0)
+            return p + FirstSetBit(mask);
+    }
+    return ScalarSkipWhitespace(p, end);
+}
+
+EXPRESSION_TARGET_AVX2 inline const char *Avx2SkipDigits(const char *p, const char *end)
+{
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(Avx2InRange(bytes, '0', 9)));
+        if (mask != 0)
+            return p + FirstSetBit(mask);
+    }
+    return ScalarSkipDigits(p, end);
+}
+#endif
+
+enum ScanIsa
+{
+    ScanIsaAuto,
+    ScanIsaScalar,
+    ScanIsaSSE2,
+    ScanIsaAVX2
+};
+
+//返回 [p, end) 中第一个不属于该类字符的位置
+using SkipFunction = const char *(*)(const char *p, const char *end);
+
+struct ScanKernels
+{
+    ScanIsa Isa;
+    const char *Name;
+    SkipFunction SkipWhitespace;
+    SkipFunction SkipDigits;
+};
+
+//Auto 时按运行时检测的结果选择,请求的指令集不可用时退回到可用的最高指令集
+inline ScanKernels SelectScanKernels(ScanIsa isa = ScanIsaAuto)
+{
+#if EXPRESSION_AVX2
+    if ((isa == ScanIsaAuto || isa == ScanIsaAVX2) && CpuSupportsAvx2())
+        return {ScanIsaAVX2, "AVX2", &Avx2SkipWhitespace, &Avx2SkipDigits};
+#endif
+#if EXPRESSION_SSE2
+    if (isa != ScanIsaScalar)
+        return {ScanIsaSSE2, "SSE2", &Sse2SkipWhitespace, &Sse2SkipDigits};
+#endif
+    return {ScanIsaScalar, "Scalar", &ScalarSkipWhitespace, &ScalarSkipDigits};
+}
+
+//进程内只检测一次
+inline const ScanKernels &DefaultScanKernels()
+{
+    static const ScanKernels kernels = SelectScanKernels();
+    return kernels;
+}
+
+//跳过空白:长段空白(例如生成的表达式中的缩进)走运行时选择的向量版本
+inline const char *SkipWhitespace(const char *p, const char *end)
+{
+    return DefaultScanKernels().SkipWhitespace(p, end);
+}
+
+//跳过十进制数字:数字串通常很短,间接调用与 AVX2 的收益抵不过开销,直接内联 SSE2 版本
+inline const char *SkipDigits(const char *p, const char *end)
+{
+#if EXPRESSION_SSE2
+    return Sse2SkipDigits(p, end);
+#else
+    return ScalarSkipDigits(p, end);
+#endif
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//工作窃取线程池:ParallelFor 将任务区间切块后平均分给各工作线程,
+//线程从自己队列的头部取块,空闲时从其它线程队列的尾部窃取一半
+class WorkStealingPool
+{
+    struct alignas(64) Queue
+    {
+        std::mutex Mutex;
+        std::size_t Head = 0; //[Head, Tail) 为尚未处理的块
+        std::size_t Tail = 0;
+    };
+
+    using Body = std::function<void(std::size_t worker, std::size_t begin, std::size_t end)>;
+
+    std::vector<std::thread> m_Threads;
+    std::unique_ptr<Queue[]> m_Queues;
+    std::size_t m_Workers = 0;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_Start;
+    std::condition_variable m_Done;
+    std::uint64_t m_Generation = 0;
+    std::size_t m_Busy = 0;
+    bool m_Stop = false;
+
+    const Body *m_Body = nullptr;
+    std::size_t m_Count = 0;
+    std::size_t m_Grain = 1;
+    std::exception_ptr m_Exception;
+
+    bool PopOwn(std::size_t worker, std::size_t &chunk)
+    {
+        Queue &queue = m_Queues[worker];
+        std::lock_guard<std::mutex> lock(queue.Mutex);
+        if (queue.Head == queue.Tail)
+            return false;
+        chunk = queue.Head++;
+        return true;
+    }
+
+    bool Steal(std::size_t worker, std::size_t &chunk)
+    {
+        for (std::size_t i = 1; i < m_Workers; i++)
+        {
+            Queue &victim = m_Queues[(worker + i) % m_Workers];
+            std::size_t begin;
+            std::size_t end;
+            {
+                std::lock_guard<std::mutex> lock(victim.Mutex);
+                std::size_t remaining = victim.Tail - victim.Head;
+                if (remaining == 0)
+                    continue;
+                begin = victim.Tail - (remaining + 1) / 2;
+                end = victim.Tail;
+                victim.Tail = begin;
+            }
+            Queue &own = m_Queues[worker];
+            std::lock_guard<std::mutex> lock(own.Mutex);
+            own.Head = begin + 1;
+            own.Tail = end;
+            chunk = begin;
+            return true;
+        }
+        return false;
+    }
+
+    void Work(std::size_t worker)
+    {
+        std::size_t chunk;
+        while (PopOwn(worker, chunk) || Steal(worker, chunk))
+        {
+            std::size_t begin = chunk * m_Grain;
+            std::size_t end = std::min(m_Count, begin + m_Grain);
+            try
+            {
+                (*m_Body)(worker, begin, end);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                if (!m_Exception)
+                    m_Exception = std::current_exception();
+            }
+        }
+    }
+
+    void Run(std::size_t worker)
+    {
+        std::uint64_t generation = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Start.wait(lock, [&] { return m_Stop || m_Generation != generation; });
+                if (m_Stop)
+                    return;
+                generation = m_Generation;
+            }
+            Work(worker);
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                if (--m_Busy == 0)
+                    m_Done.notify_all();
+            }
+        }
+    }
+
+public:
+    //threads 为 0 时使用硬件线程数;调用 ParallelFor 的线程也作为 0 号工作线程参与运算
+    explicit WorkStealingPool(std::size_t threads = 0)
+    {
+        if (threads == 0)
+            threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+        m_Workers = threads;
+        m_Queues = std::make_unique<Queue[]>(threads);
+        for (std::size_t i = 1; i < threads; i++)
+            m_Threads.emplace_back(&WorkStealingPool::Run, this, i);
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Stop = true;
+        }
+        m_Start.notify_all();
+        for (std::thread &thread : m_Threads)
+            thread.join();
+    }
+
+    std::size_t Size() const noexcept
+    {
+        return m_Workers;
+    }
+
+    //对 [0, count) 按 grain 切块并行调用 body(worker, begin, end),阻塞到全部完成;
+    //worker 为 [0, Size()) 中的工作线程编号,可用于索引线程私有的状态;同一时刻只能有一个线程调用
+    void ParallelFor(std::size_t count, std::size_t grain, const Body &body)
+    {
+        if (count == 0)
+            return;
+        grain = std::max<std::size_t>(1, grain);
+        std::size_t chunks = (count + grain - 1) / grain;
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Body = &body;
+        m_Count = count;
+        m_Grain = grain;
+        m_Exception = nullptr;
+        for (std::size_t i = 0; i < m_Workers; i++)
+        {
+            std::lock_guard<std::mutex> queueLock(m_Queues[i].Mutex);
+            m_Queues[i].Head = chunks * i / m_Workers;
+            m_Queues[i].Tail = chunks * (i + 1) / m_Workers;
+        }
+        m_Busy = m_Workers - 1;
+        m_Generation++;
+        lock.unlock();
+        m_Start.notify_all();
+
+        Work(0);
+
+        lock.lock();
+        m_Done.wait(lock, [&] { return m_Busy == 0; });
+        m_Body = nullptr;
+        if (m_Exception)
+            std::rethrow_exception(std::exchange(m_Exception, nullptr));
+    }
+};
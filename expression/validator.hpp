@@ -0,0 +1,302 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+//只检查语法的识别器,语法与 parserDemo 相同:+ - * /、一元负号、括号与数值字面量(含指数与十六进制形式).
+//字符分类表与状态转移表在编译期生成,运行时每个字节查两次表,括号只需要一个计数器:
+//不分配内存、不递归、不抛出异常
+
+struct ValidationResult
+{
+    bool Ok = false;
+    std::size_t Offset = 0; //与 parserDemo 中 Parser 报告的位置相同;在文本末尾出错时等于文本长度
+
+    explicit operator bool() const noexcept
+    {
+        return Ok;
+    }
+};
+
+enum ValidatorCharClass : std::uint8_t
+{
+    ClassSpace,
+    ClassZero,
+    ClassDigit,     //1-9
+    ClassE,         //e E:十进制的指数,十六进制的数字
+    ClassHexLetter, //a-f A-F 中除 e E 以外的字母
+    ClassX,
+    ClassP,
+    ClassDot,
+    ClassPlus,
+    ClassMinus,
+    ClassMulDiv,
+    ClassOpen,
+    ClassClose,
+    ClassOther,
+    ClassCount
+};
+
+enum ValidatorState : std::uint8_t
+{
+    StateOperand,      //需要操作数
+    StateAfterOperand, //需要运算符、')' 或结束
+    StateZero,         //以 0 开头,可能是十六进制
+    StateInteger,
+    StateFraction,
+    StateExponentStart,
+    StateExponentSign,
+    StateExponent,
+    StateHexStart,
+    StateHexInteger,
+    StateHexDot, //0x. 之后还没有数字
+    StateHexFraction,
+    StateHexExponentStart,
+    StateHexExponentSign,
+    StateHexExponent,
+    StateReject,
+    StateCount
+};
+
+//转移表项:低 4 位为下一状态,高位为对括号计数器的操作
+constexpr std::uint8_t ValidatorOpen = 0x10;
+constexpr std::uint8_t ValidatorClose = 0x20;
+constexpr std::uint8_t ValidatorStateMask = 0x0F;
+
+static_assert(StateCount <= 16, "state must fit in the low 4 bits of a transition");
+
+using ValidatorClassTable = std::array<std::uint8_t, 256>;
+using ValidatorTransitionTable = std::array<std::array<std::uint8_t, ClassCount>, StateCount>;
+
+constexpr ValidatorClassTable MakeValidatorClassTable()
+{
+    ValidatorClassTable table{};
+    for (int ch = 0; ch < 256; ch++)
+    {
+        std::uint8_t cls = ClassOther;
+        if (ch == ' ' || (ch >= '\t' && ch <= '\r'))
+            cls = ClassSpace;
+        else if (ch == '0')
+            cls = ClassZero;
+        else if (ch >= '1' && ch <= '9')
+            cls = ClassDigit;
+        else if (ch == 'e' || ch == 'E')
+            cls = ClassE;
+        else if ((ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F'))
+            cls = ClassHexLetter;
+        else if (ch == 'x' || ch == 'X')
+            cls = ClassX;
+        else if (ch == 'p' || ch == 'P')
+            cls = ClassP;
+        else if (ch == '.')
+            cls = ClassDot;
+        else if (ch == '+')
+            cls = ClassPlus;
+        else if (ch == '-')
+            cls = ClassMinus;
+        else if (ch == '*' || ch == '/')
+            cls = ClassMulDiv;
+        else if (ch == '(')
+            cls = ClassOpen;
+        else if (ch == ')')
+            cls = ClassClose;
+        table[ch] = cls;
+    }
+    return table;
+}
+
+constexpr ValidatorTransitionTable MakeValidatorTransitionTable()
+{
+    ValidatorTransitionTable table{};
+    for (auto &row : table)
+    {
+        for (auto &entry : row)
+            entry = StateReject;
+    }
+
+    //操作数之后(包括结束在可接受状态的数值之后)的分隔符
+    auto delimiters = [&table](ValidatorState state) {
+        table[state][ClassSpace] = StateAfterOperand;
+        table[state][ClassPlus] = StateOperand;
+        table[state][ClassMinus] = StateOperand;
+        table[state][ClassMulDiv] = StateOperand;
+        table[state][ClassClose] = StateAfterOperand | ValidatorClose;
+    };
+    auto digits = [&table](ValidatorState state, ValidatorState next) {
+        table[state][ClassZero] = next;
+        table[state][ClassDigit] = next;
+    };
+    auto hexDigits = [&table](ValidatorState state, ValidatorState next) {
+        table[state][ClassZero] = next;
+        table[state][ClassDigit] = next;
+        table[state][ClassE] = next;
+        table[state][ClassHexLetter] = next;
+    };
+
+    table[StateOperand][ClassSpace] = StateOperand;
+    table[StateOperand][ClassMinus] = StateOperand;
+    table[StateOperand][ClassOpen] = StateOperand | ValidatorOpen;
+    table[StateOperand][ClassZero] = StateZero;
+    table[StateOperand][ClassDigit] = StateInteger;
+
+    delimiters(StateAfterOperand);
+
+    //十进制:digits [. digits] [(e|E) [+-] digits]
+    digits(StateZero, StateInteger);
+    table[StateZero][ClassDot] = StateFraction;
+    table[StateZero][ClassE] = StateExponentStart;
+    table[StateZero][ClassX] = StateHexStart;
+    delimiters(StateZero);
+
+    digits(StateInteger, StateInteger);
+    table[StateInteger][ClassDot] = StateFraction;
+    table[StateInteger][ClassE] = StateExponentStart;
+    delimiters(StateInteger);
+
+    digits(StateFraction, StateFraction);
+    table[StateFraction][ClassE] = StateExponentStart;
+    delimiters(StateFraction);
+
+    table[StateExponentStart][ClassPlus] = StateExponentSign;
+    table[StateExponentStart][ClassMinus] = StateExponentSign;
+    digits(StateExponentStart, StateExponent);
+    digits(StateExponentSign, StateExponent);
+    digits(StateExponent, StateExponent);
+    delimiters(StateExponent);
+
+    //十六进制:0x hexdigits [. hexdigits] [(p|P) [+-] digits],小数点两侧至少有一个数字
+    hexDigits(StateHexStart, StateHexInteger);
+    table[StateHexStart][ClassDot] = StateHexDot;
+
+    hexDigits(StateHexInteger, StateHexInteger);
+    table[StateHexInteger][ClassDot] = StateHexFraction;
+    table[StateHexInteger][ClassP] = StateHexExponentStart;
+    delimiters(StateHexInteger);
+
+    hexDigits(StateHexDot, StateHexFraction);
+
+    hexDigits(StateHexFraction, StateHexFraction);
+    table[StateHexFraction][ClassP] = StateHexExponentStart;
+    delimiters(StateHexFraction);
+
+    table[StateHexExponentStart][ClassPlus] = StateHexExponentSign;
+    table[StateHexExponentStart][ClassMinus] = StateHexExponentSign;
+    digits(StateHexExponentStart, StateHexExponent);
+    digits(StateHexExponentSign, StateHexExponent);
+    digits(StateHexExponent, StateHexExponent);
+    delimiters(StateHexExponent);
+    return table;
+}
+
+inline constexpr ValidatorClassTable ValidatorCharClasses = MakeValidatorClassTable();
+inline constexpr ValidatorTransitionTable ValidatorTransitions = MakeValidatorTransitionTable();
+
+//文本结束时可以接受的状态:操作数之后,或停在一个完整的数值中
+constexpr bool ValidatorAcceptsAtEnd(std::uint8_t state)
+{
+    return state == StateAfterOperand || state == StateZero || state == StateInteger || state == StateFraction ||
+           state == StateExponent || state == StateHexInteger || state == StateHexFraction || state == StateHexExponent;
+}
+
+constexpr bool ValidatorIsNumber(std::uint8_t state)
+{
+    return state >= StateZero && state <= StateHexExponent;
+}
+
+//从 start 处的数字开始,按 ScanNumber 的规则能读入的最长数值的结尾
+inline std::size_t ValidatorNumberEnd(const char *text, std::size_t start, std::size_t length) noexcept
+{
+    std::uint8_t state = StateOperand;
+    std::size_t end = start;
+    for (std::size_t i = start; i < length; i++)
+    {
+        std::uint8_t next = ValidatorTransitions[state][ValidatorCharClasses[static_cast<unsigned char>(text[i])]] & ValidatorStateMask;
+        if (!ValidatorIsNumber(next))
+            break;
+        state = next;
+        if (ValidatorAcceptsAtEnd(state))
+            end = i + 1;
+    }
+    return end;
+}
+
+//Parser 报告的出错位置:Parser 读入整个令牌后才发现语法错误,报告令牌之后的位置;无法识别的字符报告其自身的位置;
+//不完整的数值(如 "2.5e")按其中最长的合法数值读入,报告其后的字符.只在出错时调用,从头重放一遍状态转移,
+//记下拒绝前的状态、括号深度与当前数值中合法部分的结尾;stop 为拒绝的位置,在文本末尾出错时为 length
+inline std::size_t ValidatorErrorOffset(const char *text, std::size_t length, std::size_t stop) noexcept
+{
+    std::uint8_t state = StateOperand;
+    std::size_t depth = 0;
+    std::size_t numberEnd = 0;
+    for (std::size_t i = 0; i < stop; i++)
+    {
+        std::uint8_t entry = ValidatorTransitions[state][ValidatorCharClasses[static_cast<unsigned char>(text[i])]];
+        state = entry & ValidatorStateMask;
+        depth += (entry & ValidatorOpen) ? 1 : 0;
+        depth -= (entry & ValidatorClose) ? 1 : 0;
+        if (ValidatorIsNumber(state) && ValidatorAcceptsAtEnd(state))
+            numberEnd = i + 1;
+    }
+    if (ValidatorIsNumber(state) && !ValidatorAcceptsAtEnd(state))
+        return numberEnd;
+    if (stop == length)
+        return length;
+
+    switch (ValidatorCharClasses[static_cast<unsigned char>(text[stop])])
+    {
+    case ClassPlus:
+    case ClassMulDiv:
+    case ClassClose:
+        return state == StateOperand ? stop + 1 : stop;
+    case ClassOpen:
+        //操作数之后的 '(':括号外是多余的令牌,括号内是缺少的 ')'
+        return depth == 0 ? stop : stop + 1;
+    case ClassZero:
+    case ClassDigit:
+        return depth == 0 ? stop : ValidatorNumberEnd(text, stop, length);
+    default:
+        return stop;
+    }
+}
+
+inline ValidationResult ValidateExpression(const char *text, std::size_t length) noexcept
+{
+    std::uint8_t state = StateOperand;
+    std::size_t depth = 0;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        std::uint8_t entry = ValidatorTransitions[state][ValidatorCharClasses[static_cast<unsigned char>(text[i])]];
+        state = entry & ValidatorStateMask;
+        if (entry & (ValidatorOpen | ValidatorClose))
+        {
+            if (entry & ValidatorOpen)
+                depth++;
+            else if (depth-- == 0)
+                return ValidationResult{false, i};
+        }
+        if (state == StateReject)
+            return ValidationResult{false, ValidatorErrorOffset(text, length, i)};
+    }
+    if (!ValidatorAcceptsAtEnd(state) || depth != 0)
+        return ValidationResult{false, ValidatorErrorOffset(text, length, length)};
+    return ValidationResult{true, 0};
+}
+
+inline ValidationResult ValidateExpression(std::string_view text) noexcept
+{
+    return ValidateExpression(text.data(), text.size());
+}
+
+//一次检查 count 段文本,结果写入调用者提供的 results[0, count),返回通过检查的个数
+inline std::size_t ValidateExpressions(const std::string_view *texts, std::size_t count, ValidationResult *results) noexcept
+{
+    std::size_t valid = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        results[i] = ValidateExpression(texts[i].data(), texts[i].size());
+        valid += results[i].Ok;
+    }
+    return valid;
+}